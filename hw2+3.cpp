@@ -1,20 +1,59 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <barrier>
+#include <bit>
+#include <cassert>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
 #include <climits>
+#include <cmath>
 #include <concepts>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
 #include <functional>
 #include <iomanip>
 #include <iostream>
-#include <map>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <numbers>
+#include <optional>
 #include <queue>
+#include <random>
 #include <set>
+#include <span>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <tuple>
 #include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <variant>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the highest trace level compiled in (see trace_level); -DMAX_TRACE_LEVEL=0 compiles all tracing out
+#ifndef MAX_TRACE_LEVEL
+#define MAX_TRACE_LEVEL 3
+#endif
+
 // The double parentheses in decltype are significant.
 #define SET(var_name) \
     template <typename T> \
@@ -39,23 +78,28 @@
     auto getter_name() && { return std::move(var_name); }
 
 /*
-This is unreliable. The static constructor seems to only be called in
-non-template classes, including non-template subclasses of template classes.
-Even then, the standard doesn't even guarantee that it will be called in a
-non-template classes.
+Gives the class a compile-time type name and tag: type_name is the class name
+and type_tag is its hash (type_tag_of), so a name always gets the same tag
+without registering anything at startup, and type() and get_type_tag() return
+them for the dynamic type without allocating. The registries of the families
+(see type_list) are built from them. This must be used in a private section.
 */
-#define STATIC_CONSTRUCTOR(body) STATIC_CONSTRUCTOR_IMPL1(body, __COUNTER__)
-
-#define STATIC_CONSTRUCTOR_IMPL1(body, counter) STATIC_CONSTRUCTOR_IMPL2(body, counter) // Expands __COUNTER__
+#define TYPE_TAG(class_name) \
+    public: \
+        static constexpr std::string_view type_name = #class_name; \
+        static constexpr std::uint32_t type_tag = type_tag_of(#class_name); \
+        std::string_view type() const override { return type_name; } \
+        std::uint32_t get_type_tag() const override { return type_tag; } \
+    private:
 
-#define STATIC_CONSTRUCTOR_IMPL2(body, counter) \
-    class static_constructor##counter { \
-        public: \
-            static_constructor##counter() { \
-                body \
-            } \
-    }; \
-    static inline static_constructor##counter static_constructor;
+// TYPE_TAG for the trivially copyable classes (headers, payloads and packets), which have no vtable
+#define POD_TYPE_TAG(class_name) \
+    public: \
+        static constexpr std::string_view type_name = #class_name; \
+        static constexpr std::uint32_t type_tag = type_tag_of(#class_name); \
+        std::string_view type() const { return type_name; } \
+        std::uint32_t get_type_tag() const { return type_tag; } \
+    private:
 
 #define DEFAULTED_SPECIAL_MEMBERS(class_name) \
     virtual ~class_name() = default; \
@@ -68,9 +112,276 @@ non-template classes.
     class_name &operator=(const class_name &other) = default; \
     class_name &operator=(class_name &&other) = default;
 
+/*
+Gives the class its own event_pools, one for each thread that runs events (see
+event_pool::set_slot); the pools are printed under class_name. The pools are
+never destroyed because the pending events are only destroyed with the
+scheduler at exit. This must be used in a private section.
+*/
+#define POOL_ALLOCATED(class_name) \
+    public: \
+        static event_pool &pool() { \
+            static event_pool::family *const pools = new event_pool::family(#class_name, sizeof(class_name)); \
+            thread_local event_pool *instance = nullptr; \
+            thread_local std::size_t instance_slot = 0; \
+            if (instance == nullptr || instance_slot != event_pool::get_slot()) { \
+                instance_slot = event_pool::get_slot(); \
+                instance = &pools->at(instance_slot); \
+            } \
+            return *instance; \
+        } \
+        static void *operator new(std::size_t size) { return pool().allocate(size); } \
+        static void operator delete(void *p, std::size_t size) { pool().deallocate(p, size); } \
+    private:
+
 template<typename... Ts>
 struct overloaded : Ts... { using Ts::operator()...; };
 
+// the tag of a type name (32-bit FNV-1a); see TYPE_TAG
+constexpr std::uint32_t type_tag_of(std::string_view name) {
+    std::uint32_t hash = 2166136261u;
+    for (char c: name) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+constexpr bool unique_tags(std::initializer_list<std::uint32_t> tags) {
+    for (auto it = tags.begin(); it != tags.end(); it++) {
+        if (std::find(tags.begin(), it, *it) != it) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+The registry of a family of types, e.g. all header types, made at compile time
+from their TYPE_TAGs. It is declared after the types, and a new type is
+registered by adding it here.
+*/
+template <typename... Types>
+class type_list {
+        static_assert(unique_tags({Types::type_tag...}), "Two types of a family have the same tag");
+
+    public:
+        static constexpr std::array<std::string_view, sizeof...(Types)> names = {Types::type_name...};
+        static constexpr std::array<std::uint32_t, sizeof...(Types)> tags = {Types::type_tag...};
+
+        // the name of the type with the tag; empty if there is none
+        static constexpr std::string_view name_of(std::uint32_t tag) {
+            for (std::size_t i = 0; i < tags.size(); i++) {
+                if (tags[i] == tag) {
+                    return names[i];
+                }
+            }
+            return {};
+        }
+
+        // a variant of the types, after the given ones
+        template <typename... Others>
+        using variant = std::variant<Others..., Types...>;
+
+        // calls f(std::type_identity<T>{}) for the type T with the tag; returns false if there is none
+        template <typename F>
+        static bool visit(std::uint32_t tag, F &&f) {
+            return ((Types::type_tag == tag ? (f(std::type_identity<Types>{}), true) : false) || ...);
+        }
+
+        static void print(std::string_view family) {
+            std::cout << "registered " << family << " types:\n";
+            for (std::string_view name: names) {
+                std::cout << name << '\n';
+            }
+        }
+};
+
+/*
+A copy-on-write handle. Copies of a handle share one T, which is only copied
+when it is written through a handle that isn't the only owner, so the readers
+never pay for a copy. A default-constructed handle reads as T{} and doesn't
+allocate until it is written.
+
+The owners are counted in the body. A handle releases it with a release
+decrement, and mutate checks that it is the only owner with an acquire load, so
+the reads of an owner that has just released the body on another thread (e.g.
+the receiver of a shared packet in the parallel engine) happen before the
+writes.
+
+Every body also has a Kept, which holds what the value refers to but doesn't
+own (see packet_refs). It is made from the value, with whether the value was
+copied into the body, and copied with the body by mutate. After the value has
+been written through mutate, the next copy or move of the handle refreshes the
+Kept from the value.
+*/
+class nothing_kept {
+    public:
+        template <typename T>
+        nothing_kept(const T &, bool) {}
+        template <typename T>
+        void refresh(const T &) {}
+};
+
+template <typename T, typename Kept = nothing_kept>
+class copy_on_write {
+        class body {
+            public:
+                std::atomic<std::size_t> owner_num{1};
+                bool written = false; // through mutate since kept was refreshed
+                T value;
+                Kept kept; // after value, which it is made from
+
+                body() : kept(value, false) {}
+                template <typename U>
+                requires (!std::same_as<std::remove_cvref_t<U>, body>)
+                explicit body(U &&_value) : value(std::forward<U>(_value)), kept(value, std::is_lvalue_reference_v<U>) {}
+                body(const body &other) : value(other.value), kept(other.kept) {}
+        };
+        body *shared = nullptr;
+
+        static const T &empty() {
+            static const T value{};
+            return value;
+        }
+        void release() noexcept {
+            if (shared != nullptr && shared->owner_num.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete shared;
+            }
+        }
+        // only the sole owner can have written the body, so no other thread reads written meanwhile
+        void refresh() const noexcept {
+            if (shared != nullptr && shared->written) {
+                shared->kept.refresh(shared->value);
+                shared->written = false;
+            }
+        }
+
+    public:
+        copy_on_write() = default;
+        template <typename U>
+        requires (!std::same_as<std::remove_cvref_t<U>, copy_on_write>) && std::constructible_from<T, U>
+        copy_on_write(U &&value) : shared(new body(std::forward<U>(value))) {} // NOLINT(google-explicit-constructor)
+        copy_on_write(const copy_on_write &other) noexcept : shared(other.shared) {
+            if (shared != nullptr) {
+                refresh();
+                shared->owner_num.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        copy_on_write(copy_on_write &&other) noexcept : shared(std::exchange(other.shared, nullptr)) { refresh(); }
+        copy_on_write &operator=(copy_on_write other) noexcept {
+            std::swap(shared, other.shared);
+            return *this;
+        }
+        ~copy_on_write() { release(); }
+
+        const T &get() const { return shared ? shared->value : empty(); }
+        T &mutate() {
+            if (shared == nullptr) {
+                shared = new body();
+            }
+            else if (shared->owner_num.load(std::memory_order_acquire) > 1) {
+                body *copy = new body(*shared);
+                release();
+                shared = copy;
+            }
+            shared->written = true;
+            return shared->value;
+        }
+};
+
+/*
+A table keyed by node ID. The IDs are expected to be dense and mostly
+contiguous, so they index a vector directly and a lookup is a single array
+access. The few IDs that are much larger than the number of entries are kept in
+a hash map instead, so that they don't blow up the vector.
+*/
+template <typename T>
+class id_table {
+        std::vector<std::optional<T>> dense;
+        std::unordered_map<unsigned int, T> sparse; // every key is at least dense.size()
+        std::size_t num = 0;
+
+        static constexpr std::size_t DENSE_SLACK = 1024;
+
+        void grow_dense(std::size_t new_size) {
+            dense.resize(new_size);
+            for (auto it = sparse.begin(); it != sparse.end();) {
+                if (it->first < dense.size()) {
+                    dense[it->first] = std::move(it->second);
+                    it = sparse.erase(it);
+                }
+                else {
+                    it++;
+                }
+            }
+        }
+
+    public:
+        T *find(unsigned int id) {
+            if (id < dense.size()) {
+                return dense[id] ? &*dense[id] : nullptr;
+            }
+            const auto it = sparse.find(id);
+            return it != sparse.end() ? &it->second : nullptr;
+        }
+        const T *find(unsigned int id) const {
+            return const_cast<id_table *>(this)->find(id); // NOLINT(cppcoreguidelines-pro-type-const-cast)
+        }
+        bool contains(unsigned int id) const { return find(id) != nullptr; }
+
+        // inserts the value, or replaces the existing one
+        T &insert(unsigned int id, T value) {
+            if (T *existing = find(id)) {
+                *existing = std::move(value);
+                return *existing;
+            }
+            num++;
+            if (id >= dense.size() && id < 2 * num + DENSE_SLACK) {
+                grow_dense(std::max<std::size_t>(static_cast<std::size_t>(id) + 1, 2 * dense.size()));
+            }
+            if (id < dense.size()) {
+                return dense[id].emplace(std::move(value));
+            }
+            return sparse.emplace(id, std::move(value)).first->second;
+        }
+
+        bool erase(unsigned int id) {
+            if (id < dense.size()) {
+                if (!dense[id]) {
+                    return false;
+                }
+                dense[id].reset();
+            }
+            else if (sparse.erase(id) == 0) {
+                return false;
+            }
+            num--;
+            return true;
+        }
+
+        std::size_t size() const { return num; }
+
+        // calls f(id, value) for every entry in ascending order of ID
+        template <typename F>
+        void for_each(F &&f) {
+            for (std::size_t id = 0; id < dense.size(); id++) {
+                if (dense[id]) {
+                    f(static_cast<unsigned int>(id), *dense[id]);
+                }
+            }
+            std::vector<unsigned int> sparse_ids;
+            sparse_ids.reserve(sparse.size());
+            for (const auto &entry: sparse) {
+                sparse_ids.push_back(entry.first);
+            }
+            std::sort(sparse_ids.begin(), sparse_ids.end());
+            for (unsigned int id: sparse_ids) {
+                f(id, sparse.at(id));
+            }
+        }
+};
+
 class header;
 class payload;
 
@@ -80,6 +391,13 @@ class packet;
 class node;
 class event;
 class link; // new
+class workload_stream;
+class spanning_tree;
+class benchmark;
+class sweep;
+class snapshot_writer;
+class snapshot_reader;
+class checkpoint;
 
 // for simplicity, we use a const int to simulate the delay
 // if you want to simulate the more details, you should revise it to be a class
@@ -88,10 +406,13 @@ const unsigned int BROADCAST_ID = UINT_MAX;
 
 // BROADCAST_ID means that all neighbors are receivers; UINT_MAX is the maximum value of unsigned int
 
+/*
+The headers, payloads and packets are trivially copyable and have no vtable, so
+copying a packet is a memcpy; the packet types are told apart by
+node::PacketTypes, and their type names are resolved at compile time.
+*/
 class header {
     public:
-        virtual ~header() = default;
-
         SET(src_ID)
         SET(dst_ID)
         SET(pre_ID)
@@ -100,18 +421,12 @@ class header {
         GET(dst_ID)
         GET(pre_ID)
         GET(nex_ID)
-    virtual std::string type() = 0;
 
-        static void print () {
-            std::cout << "registered header types:\n";
-            for (const auto &name: derived_class_names) {
-                std::cout << name << '\n';
-            }
-        }
+        static void print (); // prints header_types
 
     protected:
         DEFAULTED_SPECIAL_MEMBERS_WITHOUT_DESTRUCTOR(header)
-        static inline std::vector<std::string> derived_class_names;
+        ~header() = default;
 
     private:
         unsigned int src_ID = BROADCAST_ID;
@@ -121,121 +436,495 @@ class header {
 };
 
 class IoT_data_header : public header{
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("IoT_data_header");
-        )
-
-    public:
-        std::string type() override { return "IoT_data_header"; }
+        POD_TYPE_TAG(IoT_data_header)
 };
 
 class IoT_ctrl_header : public header{
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("IoT_ctrl_header");
-        )
-
-    public:
-        std::string type() override { return "IoT_ctrl_header"; }
+        POD_TYPE_TAG(IoT_ctrl_header)
 };
 
 class AGG_ctrl_header : public header{
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("AGG_ctrl_header");
-        )
+        POD_TYPE_TAG(AGG_ctrl_header)
+};
+
+class DIS_ctrl_header : public header{
+        POD_TYPE_TAG(DIS_ctrl_header)
+};
+
+class route_ctrl_header : public header{
+        POD_TYPE_TAG(route_ctrl_header)
+};
+
+using header_types = type_list<IoT_data_header, IoT_ctrl_header, AGG_ctrl_header, DIS_ctrl_header, route_ctrl_header>;
+static_assert(sizeof(IoT_data_header) == 16 && std::is_trivially_copyable_v<IoT_data_header>);
+void header::print () { header_types::print("header"); }
+
+/*
+The arena of the data that the packets refer to but don't own, like the msgs
+that don't fit in a payload, so that the packets stay trivially copyable. Every
+thread copies the data to its own current block, without a lock.
+
+A block counts its holders: the thread while it is the thread's current block,
+and every holder of the data in it, e.g. the body of a packet (see
+packet_refs). When its block is full, a thread starts a new one and retires the
+full one, but only lets go of it at the end of the event that filled it
+(end_event, called by event::run), so the packets made by the event can still be
+put in a body until then. The last holder of a block frees it, on any thread.
+*/
+class packet_arena {
+    public:
+        class block {
+                std::atomic<std::size_t> holder_num{1}; // the thread that made it
+                std::size_t size;
+                std::size_t used = 0;
+                std::unique_ptr<char[]> bytes;
+
+                friend class packet_arena;
+
+            public:
+                explicit block(std::size_t _size) : size(_size), bytes(std::make_unique<char[]>(_size)) {
+                    arena_size.fetch_add(size, std::memory_order_relaxed);
+                }
+                ~block() { arena_size.fetch_sub(size, std::memory_order_relaxed); }
+                block(const block &) = delete;
+                block &operator=(const block &) = delete;
+
+                void retain() noexcept { holder_num.fetch_add(1, std::memory_order_relaxed); }
+                void release() noexcept {
+                    if (holder_num.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                        delete this;
+                    }
+                }
+        };
+
+        // holds a block (or nothing) while it lives
+        class holder {
+                block *held = nullptr;
+
+            public:
+                holder() = default;
+                explicit holder(block *_held) noexcept : held(_held) {
+                    if (held != nullptr) {
+                        held->retain();
+                    }
+                }
+                holder(const holder &other) noexcept : holder(other.held) {}
+                holder(holder &&other) noexcept : held(std::exchange(other.held, nullptr)) {}
+                holder &operator=(holder other) noexcept {
+                    std::swap(held, other.held);
+                    return *this;
+                }
+                ~holder() {
+                    if (held != nullptr) {
+                        held->release();
+                    }
+                }
+        };
+
+    private:
+        static constexpr std::size_t BLOCK_SIZE = std::size_t{1} << 16;
+
+        static inline std::atomic<std::size_t> arena_size; // the bytes of the blocks that are held
+
+        // the blocks that a thread holds
+        class thread_blocks {
+            public:
+                block *current = nullptr;
+                std::vector<block *> retired; // by the running event
+
+                thread_blocks() = default;
+                thread_blocks(const thread_blocks &) = delete;
+                thread_blocks &operator=(const thread_blocks &) = delete;
+                ~thread_blocks() {
+                    release_retired();
+                    if (current != nullptr) {
+                        current->release();
+                    }
+                }
+
+                void release_retired() noexcept {
+                    for (block *full: retired) {
+                        full->release();
+                    }
+                    retired.clear();
+                }
+        };
+        static thread_blocks &get_thread_blocks() {
+            static thread_local thread_blocks blocks;
+            return blocks;
+        }
 
     public:
-        std::string type() override { return "AGG_ctrl_header"; }
+        // size bytes at a multiple of alignment (at most alignof(std::max_align_t)) in the current block of the calling thread
+        static std::pair<char *, block *> allocate(std::size_t size, std::size_t alignment = 1) {
+            thread_blocks &mine = get_thread_blocks();
+            block *b = mine.current;
+            std::size_t begin = b != nullptr ? (b->used + alignment - 1) / alignment * alignment : 0;
+            if (b == nullptr || size > b->size || begin > b->size - size) {
+                if (b != nullptr) {
+                    mine.retired.push_back(b);
+                }
+                b = mine.current = new block(std::max(size, BLOCK_SIZE));
+                begin = 0;
+            }
+            b->used = begin + size;
+            return {b->bytes.get() + begin, b};
+        }
+
+        // lets go of the blocks that the running event has filled
+        static void end_event() {
+            thread_blocks &mine = get_thread_blocks();
+            if (!mine.retired.empty()) {
+                mine.release_retired();
+            }
+        }
+
+        static std::size_t get_size() { return arena_size.load(std::memory_order_relaxed); }
 };
 
-class DIS_ctrl_header : public header{
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("DIS_ctrl_header");
-        )
+/*
+The msg of a payload. A msg of up to INLINE_SIZE chars is kept in the payload
+itself, and a longer one is copied once to the packet_arena, which keeps it as
+long as it is held (hold). So a payload stays trivially copyable however long
+its msg is, and the body of a packet holds the msg of the packet.
+*/
+class packet_msg {
+        static constexpr std::size_t INLINE_SIZE = 20;
+
+        // a msg in the arena
+        class stored {
+            public:
+                packet_arena::block *in;
+                const char *begin;
+        };
+        static_assert(sizeof(stored) <= INLINE_SIZE && std::is_trivially_copyable_v<stored>);
+
+        std::uint32_t size = 0;
+        char chars[INLINE_SIZE] = {}; // the msg, or where it is stored
+
+        stored get_stored() const {
+            stored where{};
+            std::memcpy(&where, chars, sizeof(where));
+            return where;
+        }
 
     public:
-        std::string type() override { return "DIS_ctrl_header"; }
+        packet_msg() = default;
+        packet_msg(std::string_view msg) { *this = msg; } // NOLINT(google-explicit-constructor)
+        packet_msg &operator=(std::string_view msg) {
+            if (msg.size() > UINT32_MAX) {
+                throw std::length_error("The msg is too long");
+            }
+            size = static_cast<std::uint32_t>(msg.size());
+            if (msg.size() <= INLINE_SIZE) {
+                std::copy(msg.begin(), msg.end(), chars);
+            }
+            else {
+                const auto [begin, in] = packet_arena::allocate(msg.size());
+                std::copy(msg.begin(), msg.end(), begin);
+                const stored where{in, begin};
+                std::memcpy(chars, &where, sizeof(where));
+            }
+            return *this;
+        }
+
+        std::string_view view() const {
+            if (size <= INLINE_SIZE) {
+                return {chars, size};
+            }
+            return {get_stored().begin, size};
+        }
+        // keeps a long msg in the arena while the holder lives
+        packet_arena::holder hold() const {
+            return size <= INLINE_SIZE ? packet_arena::holder() : packet_arena::holder(get_stored().in);
+        }
+
+        // whether a msg is kept in the payload, so the bytes of a payload hold it; see checkpoint
+        static bool is_inline(std::string_view msg) { return msg.size() <= INLINE_SIZE; }
 };
 
-class payload {
-        std::string msg;
+/*
+The neighbor lists of AGG_ctrl_packets. A list is encoded as varints (7 bits a
+byte, the high bit set on all but the last byte of a number): the device ID, the
+number of its neighbors, the first neighbor ID and then the gaps between the
+sorted neighbor IDs, so a list of close IDs takes about one byte per neighbor.
+
+The lists are a chain of parts, each either an encoded list or the chain of
+another packet. Merging the lists of several packets only adds a part for each
+of them, so every list is stored once however many hops it is forwarded and
+merged. The parts are made in the packet_arena, followed by their encoded list,
+and count their holders: a chain holds its first part, and a part holds the
+next one and the chain it refers to, so a part is freed with the last chain
+that reaches it. A payload keeps a borrowed chain, which is trivially copyable,
+and the body of the packet holds it (see packet_refs).
+*/
+class nblist_chain {
+        class part {
+            public:
+                mutable std::atomic<std::uint32_t> holder_num{1};
+                std::uint32_t byte_num = 0; // of the encoded list after the part, if nested is nullptr
+                packet_arena::holder in; // the block of the part
+                const part *nested = nullptr;
+                const part *next = nullptr;
+
+                std::string_view bytes() const { return {reinterpret_cast<const char *>(this + 1), byte_num}; }
+        };
 
-    protected:
-        DEFAULTED_SPECIAL_MEMBERS_WITHOUT_DESTRUCTOR(payload)
-        static inline std::vector<std::string> derived_class_names;
     public:
-        virtual ~payload() = default;
+        // a chain that isn't held, e.g. by a payload
+        class borrowed {
+            public:
+                const part *head = nullptr;
+                std::uint32_t byte_num = 0;
+                std::uint32_t nblist_num = 0;
+        };
+
+    private:
+        borrowed chain;
+
+        static void retain(const part *retained) {
+            if (retained != nullptr) {
+                retained->holder_num.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        // without recursion, since the chains can be long and deeply nested
+        static void release(const part *released) {
+            std::vector<const part *> pending;
+            for (;;) {
+                while (released != nullptr && released->holder_num.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    if (released->nested != nullptr) {
+                        pending.push_back(released->nested);
+                    }
+                    const part *next = released->next;
+                    released->~part(); // lets go of its block
+                    released = next;
+                }
+                if (pending.empty()) {
+                    return;
+                }
+                released = pending.back();
+                pending.pop_back();
+            }
+        }
 
-        virtual std::string type() = 0;
+        // a part with one holder, which takes over a hold on nested and on next
+        static const part *make_part(std::string_view encoded, const part *nested, const part *next) {
+            const auto [bytes, in] = packet_arena::allocate(sizeof(part) + encoded.size(), alignof(part));
+            part *added = new (bytes) part;
+            added->byte_num = static_cast<std::uint32_t>(encoded.size());
+            added->in = packet_arena::holder(in);
+            added->nested = nested;
+            added->next = next;
+            std::copy(encoded.begin(), encoded.end(), bytes + sizeof(part));
+            return added;
+        }
+        // a part in front of the chain, which takes over the chain's hold on the old head
+        void push(std::string_view encoded, const part *nested) { chain.head = make_part(encoded, nested, chain.head); }
 
-        SET(msg)
-        GET(msg)
+        static void append_varint(std::string &out, std::uint64_t value) {
+            while (value >= 0x80) {
+                out.push_back(static_cast<char>(value | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<char>(value));
+        }
+        static std::uint64_t read_varint(std::string_view &in) {
+            std::uint64_t value = 0;
+            for (unsigned int shift = 0; shift < 64 && !in.empty(); shift += 7) {
+                const auto byte = static_cast<unsigned char>(in.front());
+                in.remove_prefix(1);
+                value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+                if (byte < 0x80) {
+                    return value;
+                }
+            }
+            throw std::runtime_error("A neighbor list is truncated");
+        }
 
-        static void print () {
-            std::cout << "registered payload types:\n";
-            for (const auto &name: derived_class_names) {
-                std::cout << name << '\n';
+    public:
+        nblist_chain() = default;
+        // holds a borrowed chain, which must still be held by something else
+        explicit nblist_chain(const borrowed &_chain) : chain(_chain) { retain(chain.head); }
+        nblist_chain(const nblist_chain &other) : chain(other.chain) { retain(chain.head); }
+        nblist_chain(nblist_chain &&other) noexcept : chain(std::exchange(other.chain, {})) {}
+        nblist_chain &operator=(nblist_chain other) noexcept {
+            std::swap(chain, other.chain);
+            return *this;
+        }
+        ~nblist_chain() { release(chain.head); }
+
+        // valid while this chain (or a copy) is alive
+        const borrowed &borrow() const { return chain; }
+
+        std::uint32_t get_byte_num() const { return chain.byte_num; } // of the encoded lists
+        std::uint32_t get_nblist_num() const { return chain.nblist_num; }
+        bool empty() const { return chain.nblist_num == 0; }
+
+        // adds the list of a device; the neighbor IDs must be sorted
+        template <typename Range>
+        void append(unsigned int id, const Range &neighbors) {
+            std::string encoded;
+            append_varint(encoded, id);
+            append_varint(encoded, static_cast<std::uint64_t>(std::ranges::distance(neighbors)));
+            unsigned int previous = 0;
+            for (const unsigned int neighbor : neighbors) {
+                append_varint(encoded, neighbor - previous);
+                previous = neighbor;
+            }
+            push(encoded, nullptr);
+            chain.byte_num += static_cast<std::uint32_t>(encoded.size());
+            chain.nblist_num++;
+        }
+        // adds the lists of other without copying them
+        void append(const nblist_chain &other) {
+            if (other.empty()) {
+                return;
+            }
+            retain(other.chain.head);
+            push({}, other.chain.head);
+            chain.byte_num += other.chain.byte_num;
+            chain.nblist_num += other.chain.nblist_num;
+        }
+
+        // calls f(device ID, neighbor IDs) for every list, with the neighbor IDs sorted
+        template <typename F>
+        void for_each(F &&f) const {
+            std::vector<const part *> pending{chain.head};
+            std::vector<unsigned int> neighbors;
+            while (!pending.empty()) {
+                const part *current = pending.back();
+                pending.pop_back();
+                for (; current != nullptr; current = current->next) {
+                    if (current->nested != nullptr) {
+                        pending.push_back(current->nested);
+                        continue;
+                    }
+                    std::string_view in = current->bytes();
+                    const auto id = static_cast<unsigned int>(read_varint(in));
+                    neighbors.resize(read_varint(in));
+                    unsigned int previous = 0;
+                    for (unsigned int &neighbor : neighbors) {
+                        neighbor = previous + static_cast<unsigned int>(read_varint(in));
+                        previous = neighbor;
+                    }
+                    f(id, std::span<const unsigned int>(neighbors));
+                }
             }
         }
+
+        // see checkpoint; a chain first writes the parts that the snapshot doesn't have yet
+        void save(snapshot_writer &out) const;
+        static nblist_chain restore(snapshot_reader &in);
+};
+
+class payload {
+        packet_msg msg;
+
+    protected:
+        DEFAULTED_SPECIAL_MEMBERS_WITHOUT_DESTRUCTOR(payload)
+        ~payload() = default;
+
+    public:
+        void set_msg(std::string_view _msg) { msg = _msg; }
+        std::string_view get_msg() const { return msg.view(); }
+        packet_arena::holder hold_msg() const { return msg.hold(); }
+
+        static void print (); // prints payload_types
 };
 
 class IoT_data_payload : public payload {
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("IoT_data_payload");
-        )
+        POD_TYPE_TAG(IoT_data_payload)
+
+        unsigned int generated_time = 0; // for the end-to-end delay; see metrics
 
     public:
-        std::string type() override { return "IoT_data_payload"; }
+        SET(generated_time)
+        GET(generated_time)
 };
 
 class IoT_ctrl_payload : public payload {
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("IoT_ctrl_payload");
-        )
+        POD_TYPE_TAG(IoT_ctrl_payload)
 
         unsigned int counter = 0;
+        unsigned int parent = BROADCAST_ID; // the next hop toward the root of the device that relayed the flood
     public:
         void increase() { counter ++; } // used to increase the counter
         GET(counter) // used to get the value of counter
-
-        std::string type() override { return "IoT_ctrl_payload"; }
+        SET(parent)
+        GET(parent)
 };
 
 class AGG_ctrl_payload : public payload {
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("AGG_ctrl_payload");
-        )
+        POD_TYPE_TAG(AGG_ctrl_payload)
 
-    // unsigned int counter ;
+        nblist_chain::borrowed nblists; // of the devices whose packets were merged into this one; held by the body of the packet
 
     public:
-        // void increase() { counter ++; } // used to increase the counter
-        // GET(getCounter,unsigned int,counter); // used to get the value of counter
-
-        std::string type() override { return "AGG_ctrl_payload"; }
+        // the chain must be held until the packet is in a body (see packet_refs)
+        void set_nblists(const nblist_chain &_nblists) { nblists = _nblists.borrow(); }
+        nblist_chain get_nblists() const { return nblist_chain(nblists); }
+        std::uint32_t get_nblist_num() const { return nblists.nblist_num; }
 };
 
 class DIS_ctrl_payload : public payload {
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("DIS_ctrl_payload");
-        )
+        POD_TYPE_TAG(DIS_ctrl_payload)
 
         // unsigned int counter ;
         unsigned int parent = 0;
+        // or the parents of the devices numbered [range_begin, range_end) in a tree, which the body of the packet holds; see sink_device
+        const spanning_tree *tree = nullptr;
+        unsigned int range_begin = 0;
+        unsigned int range_end = 0;
 
     public:
         // void increase() { counter ++; } // used to increase the counter
         SET(parent)
         GET(parent) // used to get the value of counter
+        SET(tree)
+        GET(tree)
+        SET(range_begin)
+        GET(range_begin)
+        SET(range_end)
+        GET(range_end)
 
         explicit DIS_ctrl_payload(unsigned int _parent = 0): parent (_parent) {}
-        std::string type() override { return "DIS_ctrl_payload"; }
 };
 
+// a message of a route repair; see route_table
+class route_ctrl_payload : public payload {
+        POD_TYPE_TAG(route_ctrl_payload)
+
+    public:
+        enum class kind : std::uint8_t { query, reply, resolve, advert };
+
+    private:
+        kind message = kind::query;
+        unsigned int hop_num = 0; // the sender's hop count toward the root, for an advert
+
+    public:
+        SET(message)
+        GET(message)
+        SET(hop_num)
+        GET(hop_num)
+};
+
+using payload_types = type_list<IoT_data_payload, IoT_ctrl_payload, AGG_ctrl_payload, DIS_ctrl_payload, route_ctrl_payload>;
+void payload::print () { payload_types::print("payload"); }
+
 class packet_derived_classes_common_fields_holder {
+        friend class checkpoint;
+
     protected:
-        static inline std::vector<std::string> derived_class_names;
-        static inline unsigned int last_packet_id;
-        static inline unsigned int live_packet_num;
+        // of the current simulation; atomic because the packets are created by the handlers of the parallel engine
+        static std::atomic<unsigned int> &last_packet_id();
+#ifndef NDEBUG
+        // counted by the packet bodies (see packet_refs), since a trivially copyable packet cannot count its own copies
+        static std::atomic<unsigned int> &live_packet_num(); // of the current simulation
+        static inline std::atomic<std::size_t> packet_copy_num; // the number of packets that have been copied into a body, in any simulation
+        static inline std::atomic<std::size_t> packet_move_num; // the number of packets that have been moved into a body, in any simulation
+
+        friend class packet_refs;
+#endif
 };
 
 template <std::derived_from<header> HeaderType, std::derived_from<payload> PayloadType, typename Derived>
@@ -245,57 +934,29 @@ class packet : protected packet_derived_classes_common_fields_holder {
         PayloadType pld;
         unsigned int p_id;
         using packet_derived_classes_common_fields_holder::last_packet_id;
-        using packet_derived_classes_common_fields_holder::live_packet_num;
     protected:
         PayloadType &get_payload_non_const() {
             return pld;
         }
-        packet(): p_id(last_packet_id++) {
-            live_packet_num++;
-        }
-        packet(const packet &other) : hdr(other.hdr), pld(other.pld), p_id(other.p_id) {
-            live_packet_num++;
-        }
-        /*
-        The move operations does the same thing as the copy operations.
-
-        The reason why the move operations also increment live_packet_num,
-        unlike shared_ptr, is because shared_ptr is thread-safe, so incrementing
-        and decrementing the reference count is time-consuming, but here,
-        live_packet_num isn't thread-safe in the first place, so it becomes
-        pointless to do so.
-        */
-        packet(packet &&other) noexcept : hdr(std::move(other.hdr)), pld(std::move(other.pld)), p_id(std::move(other.p_id)) {
-            live_packet_num++;
-        }
-        packet &operator=(const packet &other) {
-            Derived temp(*static_cast<const Derived *>(&other)); // Derived must be a subclass so static_cast will do.
-            swap(*this, temp);
-            return *this;
-        }
-        packet &operator=(packet &&other) noexcept {
-            (void)std::move(other); // Silences "not moved from" warning
-            swap(*this, other);
-            return *this;
-        }
+        packet(): p_id(last_packet_id()++) {}
+        // a copy has the same packet ID, and copying is a memcpy
+        packet(const packet &other) = default;
+        packet(packet &&other) = default;
+        packet &operator=(const packet &other) = default;
+        packet &operator=(packet &&other) = default;
+        ~packet() = default;
         template <typename DeducedHeaderType, typename DeducedPayloadType>
         requires std::same_as<std::remove_cvref_t<DeducedHeaderType>, HeaderType> &&
             std::same_as<std::remove_cvref_t<DeducedPayloadType>, PayloadType>
         packet(DeducedHeaderType &&_hdr, DeducedPayloadType &&_pld, bool rep = false, unsigned int rep_id = 0) : hdr(std::forward<DeducedHeaderType>(_hdr)), pld(std::forward<DeducedPayloadType>(_pld)) {
             if (! rep )  { // a duplicated packet does not have a new packet id
-                p_id = last_packet_id ++;
+                p_id = last_packet_id() ++;
             }
             else {
                 p_id = rep_id;
             }
-            live_packet_num ++;
         }
     public:
-        virtual ~packet(){
-            // cout << "packet destructor begin" << '\n';
-            live_packet_num --;
-            // cout << "packet destructor end" << '\n';
-        }
         // This is friend so that ADL can find it.
         friend void swap(packet &first, packet &second) noexcept {
             using std::swap;
@@ -309,19 +970,27 @@ class packet : protected packet_derived_classes_common_fields_holder {
         GET_WITH_NAME(get_payload, pld)
         GET_WITH_NAME(get_packet_ID, p_id)
 
-        virtual std::string type () const = 0;
+        // the derived packet hides these functions; they are called on the derived type, as there is no vtable
         // you can define your own packet's addition_information
         // to print more information for recv_event and send_event
-        virtual std::string addition_information () const { return ""; }
+        std::string addition_information () const {
+            const Derived &self = static_cast<const Derived &>(*this);
+            const std::string_view label = self.addition_label();
+            return label.empty() ? "" : std::string(label) + std::to_string(self.addition_value());
+        }
+        // or a label and a number, e.g. " counter " and the counter, which the binary trace stores without building the string
+        std::string_view addition_label () const { return {}; }
+        unsigned int addition_value () const { return 0; }
 
-        static unsigned int get_live_packet_num () { return live_packet_num; }
+        static unsigned int get_packet_ID_num () { return last_packet_id(); } // the number of packet IDs assigned so far
+#ifndef NDEBUG
+        // the numbers of packets in bodies, and of deep copies and moves into bodies (of any type), for checking that packets are not copied needlessly
+        static unsigned int get_live_packet_num () { return live_packet_num(); }
+        static std::size_t get_packet_copy_num () { return packet_copy_num; }
+        static std::size_t get_packet_move_num () { return packet_move_num; }
+#endif
 
-        static void print () {
-            std::cout << "registered packet types:\n";
-            for (const auto &name: derived_class_names) {
-                std::cout << name << '\n';
-            }
-        }
+        static void print (); // prints packet_types
 
         void set_src_ID(unsigned int id) {
             hdr.set_src_ID(id);
@@ -339,16 +1008,14 @@ class packet : protected packet_derived_classes_common_fields_holder {
             hdr.set_nex_ID(id);
         }
 
-        void set_msg(const std::string &msg) {
+        void set_msg(std::string_view msg) {
             pld.set_msg(msg);
         }
 };
 
 // this packet is used to transmit the data
 class IoT_data_packet: public packet<IoT_data_header, IoT_data_payload, IoT_data_packet> {
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("IoT_data_packet");
-        )
+        POD_TYPE_TAG(IoT_data_packet)
 
     public:
         IoT_data_packet() = default;
@@ -361,15 +1028,15 @@ class IoT_data_packet: public packet<IoT_data_header, IoT_data_payload, IoT_data
         requires std::same_as<std::remove_cvref_t<DeducedHeaderType>, IoT_data_header> &&
             std::same_as<std::remove_cvref_t<DeducedPayloadType>, IoT_data_payload>
         IoT_data_packet(DeducedHeaderType &&header, DeducedPayloadType &&payload) : packet(std::forward<DeducedHeaderType>(header), std::forward<DeducedPayloadType>(payload)) {}
-        
-        std::string type() const override { return "IoT_data_packet"; }
+
+        void set_generated_time(unsigned int time) {
+            get_payload_non_const().set_generated_time(time);
+        }
 };
 
 // this packet type is used to conduct distributed BFS
 class IoT_ctrl_packet: public packet<IoT_ctrl_header, IoT_ctrl_payload, IoT_ctrl_packet> {
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("IoT_ctrl_packet");
-        )
+        POD_TYPE_TAG(IoT_ctrl_packet)
 
     public:
         IoT_ctrl_packet() = default;
@@ -383,22 +1050,19 @@ class IoT_ctrl_packet: public packet<IoT_ctrl_header, IoT_ctrl_payload, IoT_ctrl
             std::same_as<std::remove_cvref_t<DeducedPayloadType>, IoT_ctrl_payload>
         IoT_ctrl_packet(DeducedHeaderType &&header, DeducedPayloadType &&payload) : packet(std::forward<DeducedHeaderType>(header), std::forward<DeducedPayloadType>(payload)) {}
 
-        std::string type() const override { return "IoT_ctrl_packet"; }
-        std::string addition_information() const override {
-            unsigned int counter = get_payload().get_counter();
-            // cout << counter << '\n';
-            return " counter " + std::to_string(counter);
-        }
+        std::string_view addition_label() const { return " counter "; }
+        unsigned int addition_value() const { return get_payload().get_counter(); }
         void increase_payload_counter() {
             get_payload_non_const().increase();
         }
+        void set_parent(unsigned int parent) {
+            get_payload_non_const().set_parent(parent);
+        }
 };
 
 // this packet type is used to transmit each device's nblist to the sink
 class AGG_ctrl_packet: public packet<AGG_ctrl_header, AGG_ctrl_payload, AGG_ctrl_packet> {
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("AGG_ctrl_packet");
-        )
+        POD_TYPE_TAG(AGG_ctrl_packet)
 
     public:
         AGG_ctrl_packet() = default;
@@ -412,19 +1076,17 @@ class AGG_ctrl_packet: public packet<AGG_ctrl_header, AGG_ctrl_payload, AGG_ctrl
             std::same_as<std::remove_cvref_t<DeducedPayloadType>, AGG_ctrl_payload>
         AGG_ctrl_packet(DeducedHeaderType &&header, DeducedPayloadType &&payload) : packet(std::forward<DeducedHeaderType>(header), std::forward<DeducedPayloadType>(payload)) {}
 
-        std::string type() const override { return "AGG_ctrl_packet"; }
+        std::string_view addition_label() const { return " nblists "; }
+        unsigned int addition_value() const { return get_payload().get_nblist_num(); }
 
-        // virtual string addition_information() {
-        //     string msg = (dynamic_cast<AGG_ctrl_payload*>(this->get_payload()))->getMsg();
-        //     return " msg " + msg;
-        // }
+        void set_nblists(const nblist_chain &nblists) {
+            get_payload_non_const().set_nblists(nblists);
+        }
 };
 
 // this packet type is used to transmit the new parent to each device
 class DIS_ctrl_packet: public packet<DIS_ctrl_header, DIS_ctrl_payload, DIS_ctrl_packet> {
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("DIS_ctrl_packet");
-        )
+        POD_TYPE_TAG(DIS_ctrl_packet)
 
     public:
         DIS_ctrl_packet() = default;
@@ -438,36 +1100,193 @@ class DIS_ctrl_packet: public packet<DIS_ctrl_header, DIS_ctrl_payload, DIS_ctrl
             std::same_as<std::remove_cvref_t<DeducedPayloadType>, DIS_ctrl_payload>
         DIS_ctrl_packet(DeducedHeaderType &&header, DeducedPayloadType &&payload) : packet(std::forward<DeducedHeaderType>(header), std::forward<DeducedPayloadType>(payload)) {}
 
-        std::string type() const override { return "DIS_ctrl_packet"; }
-        std::string addition_information() const override {
-            unsigned int parent = get_payload().get_parent();
-            // cout << counter << '\n';
-            return " parent " + std::to_string(parent);
+        std::string_view addition_label() const { return get_payload().get_tree() ? " parents " : " parent "; }
+        unsigned int addition_value() const {
+            const DIS_ctrl_payload &payload = get_payload();
+            return payload.get_tree() ? payload.get_range_end() - payload.get_range_begin() : payload.get_parent();
         }
 
         void set_parent(unsigned int parent) {
             get_payload_non_const().set_parent(parent);
         }
+        void set_tree(const spanning_tree *tree, unsigned int range_begin, unsigned int range_end) {
+            DIS_ctrl_payload &payload = get_payload_non_const();
+            payload.set_tree(tree);
+            payload.set_range_begin(range_begin);
+            payload.set_range_end(range_end);
+        }
 };
 
-class node {
-        // all nodes created in the program
-        static inline std::map<unsigned int, std::shared_ptr<node>> id_node_table;
-        unsigned int id;
-        std::set<unsigned int> phy_neighbors;
+// the src_ID is the root whose routes are repaired; see route_table
+class route_ctrl_packet: public packet<route_ctrl_header, route_ctrl_payload, route_ctrl_packet> {
+        POD_TYPE_TAG(route_ctrl_packet)
 
-    protected:
-        static inline std::vector<std::string> derived_class_names;
-        explicit node(unsigned int _id): id(_id) {
-            if(id_node_table.find(_id) != id_node_table.end()){
-                throw std::invalid_argument("Duplicate node id");
+    public:
+        route_ctrl_packet() = default;
+
+        template <typename DeducedHeaderType, typename DeducedPayloadType>
+        requires std::same_as<std::remove_cvref_t<DeducedHeaderType>, route_ctrl_header> &&
+            std::same_as<std::remove_cvref_t<DeducedPayloadType>, route_ctrl_payload>
+        route_ctrl_packet(DeducedHeaderType &&header, DeducedPayloadType &&payload) : packet(std::forward<DeducedHeaderType>(header), std::forward<DeducedPayloadType>(payload)) {}
+
+        // the message is a part of the text, so the binary trace stores it as text; route repairs are rare
+        std::string addition_information() const {
+            static constexpr std::array<std::string_view, 4> names = {" query", " reply", " resolve", " advert"};
+            std::string information(names[static_cast<std::size_t>(get_payload().get_message())]);
+            if (get_payload().get_message() == route_ctrl_payload::kind::advert) {
+                information += " hop " + std::to_string(get_payload().get_hop_num());
+            }
+            return information;
+        }
+
+        void set_message(route_ctrl_payload::kind message) {
+            get_payload_non_const().set_message(message);
+        }
+        void set_hop_num(unsigned int hop_num) {
+            get_payload_non_const().set_hop_num(hop_num);
+        }
+};
+
+using packet_types = type_list<IoT_data_packet, IoT_ctrl_packet, AGG_ctrl_packet, DIS_ctrl_packet, route_ctrl_packet>;
+template <std::derived_from<header> HeaderType, std::derived_from<payload> PayloadType, typename Derived>
+void packet<HeaderType, PayloadType, Derived>::print () { packet_types::print("packet"); }
+
+/*
+What the body of a packet (node::SharedPacket) holds for the packet: the block
+of its msg in the packet_arena, the neighbor lists of an AGG_ctrl_packet and
+the spanning_tree of a DIS_ctrl_packet. Without NDEBUG it also counts the
+packets in the bodies for get_live_packet_num, in the simulation that made the
+body, and for get_packet_copy_num and get_packet_move_num.
+*/
+class packet_refs {
+        packet_arena::holder msg;
+        nblist_chain nblists;
+        std::shared_ptr<const spanning_tree> tree;
+#ifndef NDEBUG
+        std::atomic<unsigned int> *live_num = nullptr; // of the simulation that made the body, if it holds a packet
+#endif
+
+        template <typename Variant>
+        static packet_arena::holder hold_msg(const Variant &value) {
+            return std::visit(overloaded {
+                [](std::monostate) { return packet_arena::holder(); },
+                [](const auto &packet) { return packet.get_payload().hold_msg(); }
+            }, value);
+        }
+        template <typename Variant>
+        static nblist_chain hold_nblists(const Variant &value) {
+            if (const auto *packet = std::get_if<AGG_ctrl_packet>(&value)) {
+                return packet->get_payload().get_nblists();
+            }
+            return {};
+        }
+        template <typename Variant>
+        static std::shared_ptr<const spanning_tree> hold_tree(const Variant &value) {
+            const auto *packet = std::get_if<DIS_ctrl_packet>(&value);
+            return packet != nullptr ? hold(packet->get_payload().get_tree()) : nullptr;
+        }
+        static std::shared_ptr<const spanning_tree> hold(const spanning_tree *held); // see spanning_tree
+
+    public:
+        template <typename Variant>
+        packet_refs(const Variant &value, bool copied) : msg(hold_msg(value)), nblists(hold_nblists(value)), tree(hold_tree(value)) {
+#ifndef NDEBUG
+            if (!std::holds_alternative<std::monostate>(value)) {
+                live_num = &packet_derived_classes_common_fields_holder::live_packet_num();
+                (*live_num)++;
+                (copied ? packet_derived_classes_common_fields_holder::packet_copy_num : packet_derived_classes_common_fields_holder::packet_move_num)++;
+            }
+#else
+            (void)copied;
+#endif
+        }
+        packet_refs(const packet_refs &other) : msg(other.msg), nblists(other.nblists), tree(other.tree) {
+#ifndef NDEBUG
+            live_num = other.live_num;
+            if (live_num != nullptr) {
+                (*live_num)++;
+                packet_derived_classes_common_fields_holder::packet_copy_num++;
+            }
+#endif
+        }
+        packet_refs &operator=(const packet_refs &other) = delete;
+        ~packet_refs() {
+#ifndef NDEBUG
+            if (live_num != nullptr) {
+                (*live_num)--;
+            }
+#endif
+        }
+
+        template <typename Variant>
+        void refresh(const Variant &value) {
+            msg = hold_msg(value);
+            nblists = hold_nblists(value);
+            tree = hold_tree(value);
+        }
+};
+
+class node {
+        unsigned int id;
+        std::set<unsigned int> phy_neighbors;
+
+        /*
+        The frozen topology: once the setup is done, the neighbors of all nodes
+        are packed with their link latencies into one contiguous array (CSR), so
+        a broadcast is a linear scan instead of a tree walk with a link lookup
+        per neighbor. Any later change to the topology only marks the array
+        stale, and it is rebuilt before the next send.
+        */
+        class adjacency {
+            public:
+                unsigned int id = 0;
+                unsigned int latency = 0;
+        };
+
+    public:
+        // the nodes and the frozen topology of a simulation; see simulation
+        class state {
+            public:
+                id_table<std::shared_ptr<node>> id_node_table; // all nodes created in the simulation
+                bool topology_frozen = false;
+                bool frozen_topology_stale = false;
+                std::vector<adjacency> frozen_adjacencies;
+        };
+
+    private:
+        static state &current(); // of the current simulation
+
+        std::size_t adjacency_begin = 0; // this node's neighbors are frozen_adjacencies[adjacency_begin, adjacency_end)
+        std::size_t adjacency_end = 0;
+        static void rebuild_frozen_topology();
+
+        std::uint64_t created_event_num = 0; // the events created by this node's events; see event::seq
+        // the transmissions of the node and the packets it received; only the thread of the node writes them
+        std::uint64_t sent_packet_num = 0;
+        std::uint64_t received_packet_num = 0;
+        friend class event;
+        friend class topology_loader;
+        friend class metrics;
+        friend class benchmark;
+        friend class sweep;
+        friend class checkpoint;
+
+    protected:
+        // called after a phy_neighbor is added or deleted, e.g. to repair the routes through it
+        virtual void phy_neighbor_added(unsigned int _id) { (void)_id; }
+        virtual void phy_neighbor_deleted(unsigned int _id) { (void)_id; }
+
+        explicit node(unsigned int _id): id(_id) {
+            if(current().id_node_table.contains(_id)){
+                throw std::invalid_argument("Duplicate node id");
             }
             if ( BROADCAST_ID == _id ) {
                 throw std::invalid_argument("BROADCAST_ID cannot be used");
             }
         }
         static void register_node(const std::shared_ptr<node> &node) {
-            id_node_table[node->id] = node;
+            current().id_node_table.insert(node->id, node);
+            invalidate_frozen_topology();
         }
 
     public:
@@ -486,48 +1305,235 @@ class node {
         node &operator=(const node &other) = delete;
         node &operator=(node &&other) = delete;
         virtual ~node() = default; // erase the node
-        virtual std::string type() = 0; // please define it in your derived node class
+        virtual std::string_view type() const = 0; // please use TYPE_TAG in your derived node class
+        virtual std::uint32_t get_type_tag() const = 0;
+
+        // the state of the derived node in a checkpoint, e.g. its routes; restore reads what save wrote
+        virtual void save(snapshot_writer &out) const { (void)out; }
+        virtual void restore(snapshot_reader &in) { (void)in; }
 
         void add_phy_neighbor (unsigned int _id); // we only add a directed link from id to _id
         void del_phy_neighbor (unsigned int _id) { // we only delete a directed link from id to _id
-            phy_neighbors.erase(_id);
+            if (phy_neighbors.erase(_id) == 0) {
+                return;
+            }
+            invalidate_frozen_topology();
+            phy_neighbor_deleted(_id);
+        }
+
+        // packs the current topology for fast sends; call it when the setup is done
+        static void freeze_topology() {
+            current().topology_frozen = true;
+            rebuild_frozen_topology();
+        }
+        static void unfreeze_topology() {
+            current().topology_frozen = false;
+            current().frozen_adjacencies.clear();
+            current().frozen_adjacencies.shrink_to_fit();
         }
+        static bool is_topology_frozen() { return current().topology_frozen; }
+        // called whenever a node, a neighbor or a link changes
+        static void invalidate_frozen_topology() { current().frozen_topology_stale = current().topology_frozen; }
 
         // you can use the function to get the node's neighbors at this time
         // but in the project 3, you are not allowed to use this function
         const std::set<unsigned int> &get_phy_neighbors() { return phy_neighbors; }
 
-        using PacketTypes = std::variant<std::monostate, IoT_ctrl_packet, IoT_data_packet, AGG_ctrl_packet, DIS_ctrl_packet>;
+        using PacketTypes = packet_types::variant<std::monostate>;
+        static_assert(std::is_trivially_copyable_v<PacketTypes>, "copying a packet must be a memcpy");
+        // a transmission shares one packet body among all its events and receivers
+        // call get() to read the packet and mutate() to write it; mutate() copies the body only if it is still shared
+        // the body holds the long msg of its packet (see packet_refs)
+        using SharedPacket = copy_on_write<PacketTypes, packet_refs>;
 
-        void recv (PacketTypes &p) {
+        void recv (SharedPacket &p) {
+            received_packet_num++;
             recv_handler(p);
         } // the packet will be directly deleted after the handler
-        void send (const PacketTypes &p);
+        GET(sent_packet_num)
+        GET(received_packet_num)
+        void send (const SharedPacket &p);
 
         // receive the packet and do something; this is a pure virtual function
-        virtual void recv_handler(PacketTypes &p) = 0;
-        static void send_handler(const PacketTypes &p);
-
-        static std::shared_ptr<node> id_to_node (unsigned int _id) {
-            const auto it = id_node_table.find(_id);
-            return it != id_node_table.cend() ? it->second : nullptr;
+        virtual void recv_handler(SharedPacket &p) = 0;
+        static void send_handler(const SharedPacket &p);
+        static void send_handler(SharedPacket &&p);
+
+        // the table still owns the node; the returned pointer is valid until del_node
+        static node *id_to_node (unsigned int _id) {
+            const auto *entry = current().id_node_table.find(_id);
+            return entry != nullptr ? entry->get() : nullptr;
         }
         GET_WITH_NAME(get_node_ID, id)
 
         static void del_node (unsigned int _id) {
-            const auto it = id_node_table.find(_id);
-            if (it != id_node_table.cend()) {
-                id_node_table.erase(it);
+            current().id_node_table.erase(_id);
+            invalidate_frozen_topology();
+        }
+        static auto get_node_num () { return current().id_node_table.size(); }
+
+        static void print (); // prints node_types
+};
+
+/*
+The routes that the IoT_ctrl_packet floods build. Every node that starts a
+flood is a root, and the roots are numbered in the order of their first flood,
+so a device keeps its route to every root in a vector indexed by that number
+and finds the next hop toward a destination in O(1). A route is replaced only
+by a newer flood (a larger packet ID), and in a flood only the first copy that
+arrives is taken, so following the next hops never loops. The roots are
+numbered by IoT_ctrl_pkt_gen_event, which has no owner, so the devices can read
+the numbers while the parallel engine runs.
+
+With set_repair(true), a deleted or added phy_neighbor repairs the routes with
+route_ctrl_packets instead of a new flood from the root:
+
+- A device that loses its next hop starts a diffusing computation: it drops
+  the route and broadcasts a query. A device whose next hop sends it a query
+  drops its route and broadcasts a query as well, and every other device
+  replies at once. A device replies to the device that queried it first only
+  when all its neighbors have replied, so when the starting device has all its
+  replies, exactly the devices whose routes went through the lost link have
+  dropped them, and no stale route is left.
+- The starting device then broadcasts a resolve, which the devices that
+  dropped their routes relay once. A device with a route answers a resolve
+  with an advert of its hop count, and a device takes an advert if it has no
+  route or the advert is shorter, and broadcasts its own advert.
+- An added phy_neighbor gets an advert of every route, so only the devices
+  that it makes closer to a root change their routes.
+- The root itself always replies to a query and adverts a hop count of 0.
+
+print_repair_statistics compares the events of the repairs with those of the
+new floods that they replace.
+
+Every handler sends at most one packet, the received one changed, so a repair
+creates packet IDs only when it starts. The links must be symmetric, and the
+topology must not change around a repair until its queries are answered.
+*/
+class route_table {
+    public:
+        class route {
+            public:
+                unsigned int next_hop = BROADCAST_ID; // BROADCAST_ID if there is no route
+                unsigned int hop_num = 0;
+                unsigned int flood_ID = 0; // the packet ID of the flood that built the route
+                // the device that queried this device first (itself if it started the repair), and the replies it waits for
+                unsigned int repair_parent = BROADCAST_ID; // BROADCAST_ID if the route is not being repaired
+                std::size_t pending_reply_num = 0;
+                // the devices whose next hop is this device by the flood, and the AGG_ctrl_packets held to merge them; see IoT_device
+                unsigned int child_num = 0;
+                unsigned int held_report_num = 0;
+                nblist_chain held_nblists;
+        };
+
+        // the roots and the repairs of a simulation; see simulation
+        class state {
+            public:
+                id_table<unsigned int> root_slots; // the number of every root
+                std::vector<unsigned int> root_IDs; // the root of every number
+                bool repair_enabled = false;
+                // the statistics of the repairs; atomic because the devices of the parallel engine count them
+                std::atomic<std::uint64_t> repair_num;
+                std::atomic<std::uint64_t> repair_event_num;
+                std::atomic<std::uint64_t> reflood_event_num;
+        };
+
+    private:
+        std::vector<route> routes; // indexed by the number of the root
+
+        static state &current(); // of the current simulation
+
+    public:
+        static void add_root(unsigned int root_id) {
+            state &roots = current();
+            if (!roots.root_slots.contains(root_id)) {
+                roots.root_slots.insert(root_id, static_cast<unsigned int>(roots.root_IDs.size()));
+                roots.root_IDs.push_back(root_id);
             }
         }
-        static auto get_node_num () { return id_node_table.size(); }
+        static unsigned int get_root_num() { return static_cast<unsigned int>(current().root_IDs.size()); }
 
-        static void print () {
-            std::cout << "registered node types:\n";
-            for (const auto &name: derived_class_names) {
-                std::cout << name << '\n';
+        // the route toward dst; nullptr if dst is not a root or no flood from it has arrived
+        const route *find(unsigned int dst) const {
+            const unsigned int *slot = current().root_slots.find(dst);
+            if (slot == nullptr || *slot >= routes.size() || routes[*slot].next_hop == BROADCAST_ID) {
+                return nullptr;
+            }
+            return &routes[*slot];
+        }
+
+        // the route toward the root, valid or not; nullptr if the root has not been added
+        route *get(unsigned int root_id) {
+            const unsigned int *slot = current().root_slots.find(root_id);
+            if (slot == nullptr) {
+                return nullptr;
+            }
+            if (*slot >= routes.size()) {
+                routes.resize(*slot + 1);
+            }
+            return &routes[*slot];
+        }
+
+        // calls f(root ID, route) for every route that has been built
+        template <typename F>
+        void for_each(F &&f) {
+            for (std::size_t slot = 0; slot < routes.size(); slot++) {
+                f(current().root_IDs[slot], routes[slot]);
             }
         }
+
+        // takes the route if it comes from a newer flood; returns whether it was taken
+        bool update(unsigned int root_id, unsigned int next_hop, unsigned int hop_num, unsigned int flood_ID) {
+            route *r = get(root_id);
+            if (r == nullptr) {
+                throw std::logic_error("A flood came from a root that was not added");
+            }
+            if (r->next_hop != BROADCAST_ID && r->flood_ID >= flood_ID) {
+                return false;
+            }
+            r->next_hop = next_hop;
+            r->hop_num = hop_num;
+            r->flood_ID = flood_ID;
+            r->child_num = 0;
+            return true;
+        }
+
+        // a neighbor relayed the flood from the root as a child of this device
+        void add_child(unsigned int root_id, unsigned int flood_ID) {
+            route *r = get(root_id);
+            if (r != nullptr && r->next_hop != BROADCAST_ID && r->flood_ID == flood_ID) {
+                r->child_num++;
+            }
+        }
+
+        static void set_repair(bool enabled) { current().repair_enabled = enabled; }
+        static bool is_repair_enabled() { return current().repair_enabled; }
+
+        // a repair starts; a new flood would trigger reflood_events events instead
+        static void count_repair(std::uint64_t reflood_events) {
+            state &repairs = current();
+            repairs.repair_num++;
+            repairs.reflood_event_num += reflood_events;
+        }
+        // a send_event or recv_event of a route_ctrl_packet
+        static void count_repair_event() { current().repair_event_num.fetch_add(1, std::memory_order_relaxed); }
+
+        static std::uint64_t get_repair_num() { return current().repair_num; }
+        static std::uint64_t get_repair_event_num() { return current().repair_event_num; }
+        static std::uint64_t get_reflood_event_num() { return current().reflood_event_num; }
+        // see checkpoint; the roots are saved once, and the routes of every device
+        void save(snapshot_writer &out) const;
+        void restore(snapshot_reader &in);
+        static void save_roots(snapshot_writer &out);
+        static void restore_roots(snapshot_reader &in);
+
+        static void print_repair_statistics(std::ostream &out) {
+            const state &repairs = current();
+            const std::uint64_t events = repairs.repair_event_num;
+            const std::uint64_t reflood_events = repairs.reflood_event_num;
+            out << "route repair: " << repairs.repair_num << " repairs took " << events << " events; new floods would take "
+                << reflood_events << " events (" << (reflood_events > events ? reflood_events - events : 0) << " saved)\n";
+        }
 };
 
 class has_parent {
@@ -540,14 +1546,27 @@ class has_parent {
 
 class IoT_device: public node, public has_parent {
         // map<unsigned int,bool> one_hop_neighbors; // you can use this variable to record the node's 1-hop neighbors
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("IoT_device");
-        )
+        TYPE_TAG(IoT_device)
 
-        bool hi = false; // this is used for example; you can remove it when doing hw2
+        route_table routes; // the routes toward the roots of the IoT_ctrl_packet floods
+        std::uint64_t delivered_num = 0; // the IoT_data_packets whose dst is this device
+        std::uint64_t delay_sum = 0; // the end-to-end delays of those packets
+        nblist_chain collected_nblists; // of the AGG_ctrl_packets whose dst is this device
+        std::uint64_t collected_generation = 0; // counts the changes to collected_nblists
         unsigned int parent_id = 0;
 
+        static bool &AGG_merging(); // of the current simulation
+
+        void phy_neighbor_added(unsigned int _id) override;
+        void phy_neighbor_deleted(unsigned int _id) override;
+        void recv_route_ctrl(SharedPacket &p); // see route_table
+        void recv_AGG_ctrl(SharedPacket &p);
+        void recv_DIS_ctrl(SharedPacket &p);
+        void deliver(const IoT_data_packet &packet);
+
+    protected:
         explicit IoT_device(unsigned int _id): node(_id) {}
+
     public:
         unsigned int get_parent_id() const override {
             return parent_id;
@@ -557,48 +1576,82 @@ class IoT_device: public node, public has_parent {
             register_node(device);
             return device;
         }
-        std::string type() override { return "IoT_device"; }
+        const route_table &get_routes() const { return routes; }
+        void save(snapshot_writer &out) const override;
+        void restore(snapshot_reader &in) override;
+        GET(delivered_num)
+        GET(delay_sum)
+        GET(collected_nblists)
+        GET(collected_generation)
+        void clear_collected_nblists() {
+            collected_nblists = nblist_chain();
+            collected_generation++;
+        }
+
+        // with merging, a device holds the AGG_ctrl_packets toward a root until it has its own and one from each of its
+        // children by the last flood, and forwards their lists in one packet; so every device must send one per round
+        static void set_AGG_merging(bool enabled) { AGG_merging() = enabled; }
+        static bool is_AGG_merging() { return AGG_merging(); }
 
         // please define recv_handler function to deal with the incoming packet
         // you have to write the code in recv_handler of IoT_device
-        void recv_handler (PacketTypes &p) override {
+        void recv_handler (SharedPacket &p) override {
             // in this function, you are "not" allowed to use node::id_to_node(id) !!!!!!!!
 
-            // this is a simple example
-            // node 0 broadcasts its message to every node and every node relays the packet "only once" and increases its counter
-            // the variable hi is used to examine whether the packet has been received by this node before
-            // you can remove the variable hi and create your own routing table in class IoT_device
+            // a root (e.g., the sink) broadcasts an IoT_ctrl_packet with counter 0, and every device relays the first copy of
+            // every flood that it receives and increases its counter, so the counter is the hop count of a BFS from the root
+            // the sender of that copy is the next hop toward the root; see route_table
             std::visit(
                 overloaded {
-                    [&](IoT_ctrl_packet &packet) { // the device receives a packet from the sink
-                        if (hi) {
+                    [&](const IoT_ctrl_packet &received) { // the device receives a packet from the sink
+                        const auto &header = received.get_header();
+                        const unsigned int next_hop = header.get_pre_ID();
+                        const bool taken = routes.update(header.get_src_ID(), next_hop, received.get_payload().get_counter(), received.get_packet_ID());
+                        if (received.get_payload().get_parent() == get_node_ID()) {
+                            routes.add_child(header.get_src_ID(), received.get_packet_ID());
+                        }
+                        if (!taken) {
                             return;
                         }
+                        // the packet is only copied here if the other receivers still share it
+                        auto &packet = std::get<IoT_ctrl_packet>(p.mutate());
+                        packet.set_parent(next_hop);
                         packet.set_pre_ID(get_node_ID());
                         packet.set_nex_ID(BROADCAST_ID);
                         packet.set_dst_ID(BROADCAST_ID);
                         packet.increase_payload_counter();
-                        hi = true;
                         send_handler(p);
                         // unsigned mat = l3->getMatID();
                     // unsigned act = l3->getActID();
                     // string msg = l3->getMsg(); // get the msg
                     },
-                    [&](IoT_data_packet &packet) { // the device receives a packet
-                        (void)packet;
-                        // cout << "node " << getNodeID() << " send the packet" << '\n';
+                    [&](const IoT_data_packet &received) { // the device receives a packet
+                        if (received.get_header().get_dst_ID() == get_node_ID()) {
+                            deliver(received);
+                            return;
+                        }
+                        // unicast to the next hop toward dst; the packet is dropped if no flood from dst has arrived
+                        const route_table::route *r = routes.find(received.get_header().get_dst_ID());
+                        if (r == nullptr) {
+                            return;
+                        }
+                        auto &packet = std::get<IoT_data_packet>(p.mutate());
+                        packet.set_pre_ID(get_node_ID());
+                        packet.set_nex_ID(r->next_hop);
+                        send_handler(p);
+                    },
+                    [&](const AGG_ctrl_packet &) { // the device sends its nblist to the sink
+                        recv_AGG_ctrl(p);
                     },
-                    [&](AGG_ctrl_packet &packet) {
-                        (void)packet;
-                        // cout << "node id = " << getNodeID() << ", msg = "  << l3->getMsg() << '\n';
+                    [&](const DIS_ctrl_packet &) { // the device receives its new parent from the sink
+                        recv_DIS_ctrl(p);
                     },
-                    [&](DIS_ctrl_packet &packet) {
-                        (void)packet;
-                        // cout << "node id = " << getNodeID() << ", parent = "  << l3->get_parent() << '\n';
+                    [&](const route_ctrl_packet &) {
+                        recv_route_ctrl(p);
                     },
                     [](std::monostate) {}
                 },
-                p
+                p.get()
             );
 
         // you should implement the OSPF algorithm in recv_handler
@@ -650,805 +1703,6413 @@ class IoT_device: public node, public has_parent {
         // IoT_device::generator is derived from node::generator to generate a node
 };
 
-class mycomp {
-    bool reverse;
-
+/*
+The spanning tree that a sink_device computes from the neighbor lists it has
+collected (see nblist_chain), which gives every device a parent.
+
+The lists are packed into a CSR whose rows are numbered in the order of the
+device IDs; a link to a device that sent no list is added both ways, but two
+lists needn't agree, so the CSR can be directed. A level-synchronous BFS from
+the sink then finds the parents, so every device is as few hops from the sink as
+it can be. A level is expanded top-down along the links out of the frontier
+while the frontier is small and bottom-up along the links into the unvisited
+devices (through the transpose of the CSR) once its links outnumber those of the
+unvisited devices by ALPHA, and the rows are split among the threads either way.
+In both directions a device takes the device with the smallest ID in the
+previous level that links to it, so the tree does not depend on the number of
+threads.
+
+At last the devices are numbered in DFS preorder, so the devices under any
+device are a range of numbers, and one DIS_ctrl_packet carries the parents of
+all the devices under its sender.
+*/
+class spanning_tree: public std::enable_shared_from_this<spanning_tree> {
     public:
-        explicit mycomp(bool revparam = false) : reverse(revparam) {}
-        bool operator() (const std::unique_ptr<event> &lhs, const std::unique_ptr<event> &rhs) const;
-};
+        class statistics {
+            public:
+                std::size_t device_num = 0; // in the tree
+                std::size_t unreached_num = 0; // the devices in the lists that the tree doesn't reach
+                std::size_t link_num = 0; // the directed links of the CSR
+                unsigned int depth = 0;
+                unsigned int bottom_up_level_num = 0;
+                unsigned int thread_num = 1;
+                double build_seconds = 0; // decoding the lists and packing the CSR
+                double BFS_seconds = 0;
+                double order_seconds = 0; // numbering the devices in preorder
+
+                void print(std::ostream &out) const {
+                    std::ostringstream line;
+                    line << std::fixed << std::setprecision(3);
+                    line << "spanning tree: " << device_num << " devices of depth " << depth << " from " << link_num << " links in "
+                         << build_seconds + BFS_seconds + order_seconds << " s (build " << build_seconds << " s, BFS " << BFS_seconds
+                         << " s on " << thread_num << " threads with " << bottom_up_level_num << " bottom-up levels, order "
+                         << order_seconds << " s)";
+                    if (unreached_num > 0) {
+                        line << "; " << unreached_num << " devices unreached";
+                    }
+                    out << line.str() << '\n';
+                }
+        };
 
-class event {
-        static std::priority_queue<std::unique_ptr<event>, std::vector<std::unique_ptr<event>>, mycomp> events;
-        static inline unsigned int cur_time; // timer
-        static inline unsigned int end_time;
+    private:
+        static constexpr unsigned int UNVISITED = UINT_MAX;
+        static constexpr std::uint64_t ALPHA = 14; // switches to bottom-up
+        static constexpr std::uint64_t BETA = 24; // switches back to top-down when the frontier has fewer than 1 / BETA of the rows
+
+        // by the number in preorder; the sink is 0
+        std::vector<unsigned int> IDs;
+        std::vector<unsigned int> parents;
+        std::vector<unsigned int> ends; // the end of the range of the devices under each device
+        id_table<unsigned int> numbers; // of the IDs
+        statistics stats;
+
+        class csr {
+            public:
+                std::vector<unsigned int> IDs; // of the rows, ascending
+                std::vector<std::uint64_t> offsets;
+                std::vector<unsigned int> targets; // the rows, each sorted
+        };
 
-        // get the next event
-        static std::unique_ptr<event> get_next_event() {
-            if(events.empty()) {
-                return nullptr;
+        static csr build(unsigned int root_id, const nblist_chain &nblists) {
+            // the lists, the first one of each device
+            std::vector<unsigned int> owners;
+            std::vector<std::uint64_t> list_offsets{0};
+            std::vector<unsigned int> neighbors;
+            owners.reserve(nblists.get_nblist_num());
+            list_offsets.reserve(std::size_t{nblists.get_nblist_num()} + 1);
+            nblists.for_each([&](unsigned int id, std::span<const unsigned int> list) {
+                owners.push_back(id);
+                neighbors.insert(neighbors.end(), list.begin(), list.end());
+                list_offsets.push_back(neighbors.size());
+            });
+
+            // the rows; the neighbors that sent no list are usually few, so the rows are numbered again only if there are any
+            csr graph;
+            id_table<unsigned int> rows;
+            const auto number_rows = [&] {
+                std::sort(graph.IDs.begin(), graph.IDs.end());
+                graph.IDs.erase(std::unique(graph.IDs.begin(), graph.IDs.end()), graph.IDs.end());
+                rows = id_table<unsigned int>();
+                for (std::size_t row = 0; row < graph.IDs.size(); row++) {
+                    rows.insert(graph.IDs[row], static_cast<unsigned int>(row));
+                }
+            };
+            graph.IDs = owners;
+            graph.IDs.push_back(root_id);
+            number_rows();
+            const std::size_t owner_row_num = graph.IDs.size();
+            for (const unsigned int neighbor: neighbors) {
+                if (!rows.contains(neighbor)) {
+                    graph.IDs.push_back(neighbor);
+                }
             }
-            // This is safe and the only way to move a unique_ptr out of a priority_queue. The elements are never actually const.
-            std::unique_ptr<event> e = std::move(const_cast<std::unique_ptr<event> &>(events.top())); // NOLINT(cppcoreguidelines-pro-type-const-cast)
-            events.pop();
-            // cout << events.size() << " events remains" << '\n';
-            return e;
+            if (graph.IDs.size() > owner_row_num) {
+                number_rows();
+            }
+            const std::size_t row_num = graph.IDs.size();
+            const auto row_of = [&](unsigned int id) { return *rows.find(id); };
+
+            std::vector<char> has_list(row_num, 0);
+            std::vector<char> list_taken(owners.size(), 0);
+            for (std::size_t list = 0; list < owners.size(); list++) {
+                char &has = has_list[row_of(owners[list])];
+                list_taken[list] = !has;
+                has = 1;
+            }
+            // counts the rows, and then fills them from the back
+            graph.offsets.assign(row_num + 1, 0);
+            const auto for_each_link = [&](auto &&f) {
+                for (std::size_t list = 0; list < owners.size(); list++) {
+                    if (!list_taken[list]) {
+                        continue;
+                    }
+                    const unsigned int owner = row_of(owners[list]);
+                    for (std::uint64_t i = list_offsets[list]; i < list_offsets[list + 1]; i++) {
+                        const unsigned int neighbor = row_of(neighbors[i]);
+                        f(owner, neighbor);
+                        if (!has_list[neighbor]) {
+                            f(neighbor, owner);
+                        }
+                    }
+                }
+            };
+            for_each_link([&](unsigned int from, unsigned int) { graph.offsets[from + 1]++; });
+            for (std::size_t row = 0; row < row_num; row++) {
+                graph.offsets[row + 1] += graph.offsets[row];
+            }
+            graph.targets.resize(graph.offsets[row_num]);
+            std::vector<std::uint64_t> cursors(graph.offsets.begin(), graph.offsets.end() - 1);
+            for_each_link([&](unsigned int from, unsigned int to) { graph.targets[cursors[from]++] = to; });
+            for (std::size_t row = 0; row < row_num; row++) { // only the rows with links added both ways are out of order
+                const auto begin = graph.targets.begin() + static_cast<std::ptrdiff_t>(graph.offsets[row]);
+                const auto end = graph.targets.begin() + static_cast<std::ptrdiff_t>(graph.offsets[row + 1]);
+                if (!std::is_sorted(begin, end)) {
+                    std::sort(begin, end);
+                }
+            }
+            return graph;
         }
-        static inline std::hash<std::string> event_seq;
-        unsigned int trigger_time = 0;
-
-    protected:
-        SET(trigger_time)
-        static inline std::vector<std::string> derived_class_names;
-        explicit event(unsigned int _trigger_time): trigger_time(_trigger_time) {}
-        event() = default;
-        event(const event &other) = default;
-        event(event &&other) = default;
-        event &operator=(const event &other) = default;
-        event &operator=(event &&other) = default;
-        static void add_event (std::unique_ptr<event> &&e) { events.push(std::move(e)); }
-    public:
-        virtual void trigger()=0;
-        virtual ~event() = default;
 
-        virtual unsigned int event_priority() const = 0;
-        static unsigned int get_hash_value(const std::string &string_for_hash) {
-            size_t priority = event_seq(string_for_hash);
-            return static_cast<unsigned int>(priority);
+        // the links reversed: the rows that link to every row, each sorted; a list needn't be mirrored by its neighbors'
+        // lists, so the bottom-up levels of the BFS look for a parent among these and not among the row's own targets
+        static csr transpose(const csr &graph) {
+            const std::size_t row_num = graph.IDs.size();
+            csr sources;
+            sources.IDs = graph.IDs;
+            sources.offsets.assign(row_num + 1, 0);
+            for (const unsigned int target: graph.targets) {
+                sources.offsets[target + 1]++;
+            }
+            for (std::size_t row = 0; row < row_num; row++) {
+                sources.offsets[row + 1] += sources.offsets[row];
+            }
+            sources.targets.resize(graph.targets.size());
+            std::vector<std::uint64_t> cursors(sources.offsets.begin(), sources.offsets.end() - 1);
+            for (std::size_t row = 0; row < row_num; row++) { // in ascending order, so every row comes out sorted
+                for (std::uint64_t i = graph.offsets[row]; i < graph.offsets[row + 1]; i++) {
+                    sources.targets[cursors[graph.targets[i]]++] = static_cast<unsigned int>(row);
+                }
+            }
+            return sources;
         }
 
-        static void flush_events () { // only for debug
-            std::cout << "**flush begin" << '\n';
-            while ( ! events.empty() ) {
-                std::cout << std::setw(11) << events.top()->trigger_time << ": " << std::setw(11) << events.top()->event_priority() << '\n';
-                events.pop();
+    public:
+        // the rows of the parents; the root's parent is itself, and an unreached row's is UNVISITED
+        static std::vector<unsigned int> BFS(const csr &graph, unsigned int root, unsigned int thread_num, statistics &stats);
+
+        static spanning_tree compute(unsigned int root_id, const nblist_chain &nblists, unsigned int thread_num) {
+            using clock = std::chrono::steady_clock;
+            const auto seconds_since = [](clock::time_point start) { return std::chrono::duration<double>(clock::now() - start).count(); };
+            spanning_tree tree;
+            statistics &stats = tree.stats;
+            stats.thread_num = std::max(thread_num, 1U);
+
+            clock::time_point start = clock::now();
+            const csr graph = build(root_id, nblists);
+            const std::size_t row_num = graph.IDs.size();
+            stats.link_num = graph.targets.size();
+            stats.build_seconds = seconds_since(start);
+
+            start = clock::now();
+            const auto root = static_cast<unsigned int>(std::lower_bound(graph.IDs.begin(), graph.IDs.end(), root_id) - graph.IDs.begin());
+            const std::vector<unsigned int> row_parents = BFS(graph, root, stats.thread_num, stats);
+            stats.BFS_seconds = seconds_since(start);
+
+            // the children of every row in ascending order, and the numbers in preorder
+            start = clock::now();
+            std::vector<std::uint64_t> child_offsets(row_num + 1, 0);
+            for (std::size_t row = 0; row < row_num; row++) {
+                if (row != root && row_parents[row] != UNVISITED) {
+                    child_offsets[row_parents[row] + 1]++;
+                }
             }
-            std::cout << "**flush end" << '\n';
+            for (std::size_t row = 0; row < row_num; row++) {
+                child_offsets[row + 1] += child_offsets[row];
+            }
+            std::vector<unsigned int> children(child_offsets[row_num]);
+            std::vector<std::uint64_t> cursors(child_offsets.begin(), child_offsets.end() - 1);
+            for (std::size_t row = 0; row < row_num; row++) {
+                if (row != root && row_parents[row] != UNVISITED) {
+                    children[cursors[row_parents[row]]++] = static_cast<unsigned int>(row);
+                }
+            }
+            stats.device_num = children.size() + 1;
+            stats.unreached_num = row_num - stats.device_num;
+            tree.IDs.reserve(stats.device_num);
+            tree.parents.reserve(stats.device_num);
+            tree.ends.resize(stats.device_num);
+            std::vector<std::pair<unsigned int, std::uint64_t>> path{{root, child_offsets[root]}}; // a row and its next child
+            tree.IDs.push_back(graph.IDs[root]);
+            tree.parents.push_back(graph.IDs[root]);
+            std::vector<unsigned int> path_numbers{0};
+            while (!path.empty()) {
+                auto &[row, next_child] = path.back();
+                if (next_child == child_offsets[row + 1]) {
+                    tree.ends[path_numbers.back()] = static_cast<unsigned int>(tree.IDs.size());
+                    path.pop_back();
+                    path_numbers.pop_back();
+                    continue;
+                }
+                const unsigned int child = children[next_child++];
+                const unsigned int parent_row = row; // the reference dies with the push
+                path_numbers.push_back(static_cast<unsigned int>(tree.IDs.size()));
+                tree.IDs.push_back(graph.IDs[child]);
+                tree.parents.push_back(graph.IDs[parent_row]);
+                path.emplace_back(child, child_offsets[child]);
+            }
+            for (std::size_t number = 0; number < tree.IDs.size(); number++) {
+                tree.numbers.insert(tree.IDs[number], static_cast<unsigned int>(number));
+            }
+            stats.order_seconds = seconds_since(start);
+            return tree;
         }
 
-        GET(trigger_time)
+        const statistics &get_statistics() const { return stats; }
+        std::size_t size() const { return IDs.size(); }
 
-        static void start_simulate( unsigned int _end_time ) { // the function is used to start the simulation
-            end_time = _end_time;
-            std::unique_ptr<event> e = get_next_event();
-            while (e && e->trigger_time <= end_time ) {
-                if ( cur_time > e->trigger_time ) {
-                    std::cerr << "cur_time = " << cur_time << ", event trigger_time = " << e->trigger_time << '\n';
-                    break;
-                    
+        // the number of the device in preorder; nullptr if the tree doesn't reach it
+        const unsigned int *find(unsigned int id) const { return numbers.find(id); }
+        unsigned int get_ID(unsigned int number) const { return IDs[number]; }
+        unsigned int get_parent(unsigned int number) const { return parents[number]; }
+        unsigned int get_end(unsigned int number) const { return ends[number]; }
+
+        // see checkpoint
+        void save(snapshot_writer &out) const;
+        static spanning_tree restore(snapshot_reader &in);
+};
+
+std::shared_ptr<const spanning_tree> packet_refs::hold(const spanning_tree *held) {
+    return held != nullptr ? held->weak_from_this().lock() : nullptr;
+}
+
+std::vector<unsigned int> spanning_tree::BFS(const csr &graph, unsigned int root, unsigned int thread_num, statistics &stats) {
+    const std::size_t row_num = graph.IDs.size();
+    const auto degree = [&](unsigned int row) { return graph.offsets[row + 1] - graph.offsets[row]; };
+    // a row is claimed by the smallest row of the frontier that links to it, and joins the next frontier at the end of the level
+    std::vector<std::atomic<unsigned int>> levels(row_num);
+    std::vector<std::atomic<unsigned int>> parents(row_num);
+    for (std::size_t row = 0; row < row_num; row++) {
+        levels[row].store(UNVISITED, std::memory_order_relaxed);
+        parents[row].store(UNVISITED, std::memory_order_relaxed);
+    }
+    levels[root].store(0, std::memory_order_relaxed);
+    parents[root].store(root, std::memory_order_relaxed);
+
+    const csr sources = transpose(graph); // for the bottom-up levels
+    std::vector<unsigned int> frontier{root};
+    std::vector<std::vector<unsigned int>> nexts(thread_num); // of every thread
+    std::vector<std::uint64_t> frontier_links(thread_num, 0); // of every thread's part of the next frontier
+    std::uint64_t unvisited_links = graph.targets.size() - degree(root);
+    std::uint64_t next_frontier_links = degree(root);
+    unsigned int level = 0;
+    bool bottom_up = false;
+    bool done = false;
+    bool expanding = true; // the barrier alternates between expanding a level and settling the next frontier
+
+    const auto part = [&](std::size_t size, unsigned int index) {
+        return std::pair<std::size_t, std::size_t>(size * index / thread_num, size * (index + 1) / thread_num);
+    };
+    const auto expand = [&](unsigned int index) {
+        std::vector<unsigned int> &next = nexts[index];
+        if (bottom_up) {
+            const auto [begin, end] = part(row_num, index);
+            for (std::size_t row = begin; row < end; row++) {
+                if (levels[row].load(std::memory_order_relaxed) != UNVISITED) {
+                    continue;
+                }
+                for (std::uint64_t i = sources.offsets[row]; i < sources.offsets[row + 1]; i++) {
+                    if (levels[sources.targets[i]].load(std::memory_order_relaxed) == level) {
+                        parents[row].store(sources.targets[i], std::memory_order_relaxed);
+                        next.push_back(static_cast<unsigned int>(row));
+                        break;
+                    }
+                }
+            }
+            return;
+        }
+        const auto [begin, end] = part(frontier.size(), index);
+        for (std::size_t i = begin; i < end; i++) {
+            const unsigned int row = frontier[i];
+            for (std::uint64_t j = graph.offsets[row]; j < graph.offsets[row + 1]; j++) {
+                const unsigned int target = graph.targets[j];
+                if (levels[target].load(std::memory_order_relaxed) != UNVISITED) {
+                    continue;
+                }
+                unsigned int parent = parents[target].load(std::memory_order_relaxed);
+                while (row < parent) {
+                    if (parents[target].compare_exchange_weak(parent, row, std::memory_order_relaxed)) {
+                        if (parent == UNVISITED) {
+                            next.push_back(target);
+                        }
+                        break;
+                    }
                 }
-                cur_time = e->trigger_time;
+            }
+        }
+    };
+    const auto settle = [&](unsigned int index) {
+        const auto [begin, end] = part(frontier.size(), index);
+        std::uint64_t links = 0;
+        for (std::size_t i = begin; i < end; i++) {
+            levels[frontier[i]].store(level + 1, std::memory_order_relaxed);
+            links += degree(frontier[i]);
+        }
+        frontier_links[index] = links;
+    };
+    // runs on the last thread to arrive, between the phases
+    const auto next_phase = [&]() noexcept {
+        if (expanding) {
+            frontier.clear();
+            for (std::vector<unsigned int> &next: nexts) {
+                frontier.insert(frontier.end(), next.begin(), next.end());
+                next.clear();
+            }
+            if (!bottom_up) { // the order of the threads' claims
+                std::sort(frontier.begin(), frontier.end());
+            }
+            done = frontier.empty();
+        }
+        else {
+            level++;
+            next_frontier_links = 0;
+            for (const std::uint64_t links: frontier_links) {
+                next_frontier_links += links;
+            }
+            unvisited_links -= next_frontier_links;
+            if (!bottom_up && next_frontier_links > unvisited_links / ALPHA) {
+                bottom_up = true;
+            }
+            else if (bottom_up && frontier.size() < row_num / BETA) {
+                bottom_up = false;
+            }
+            stats.bottom_up_level_num += bottom_up;
+        }
+        expanding = !expanding;
+    };
+    if (!bottom_up && next_frontier_links > unvisited_links / ALPHA) {
+        bottom_up = true;
+        stats.bottom_up_level_num++;
+    }
 
-                // cout << "event trigger_time = " << e->trigger_time << '\n';
-                e->print(); // for log
-                // cout << " event begin" << '\n';
-                e->trigger();
-                // cout << " event end" << '\n';
-                e = event::get_next_event ();
+    std::barrier sync(static_cast<std::ptrdiff_t>(thread_num), next_phase);
+    const auto run = [&](unsigned int index) {
+        while (true) {
+            expand(index);
+            sync.arrive_and_wait();
+            if (done) {
+                return;
             }
-            // cout << "no more event" << '\n';
+            settle(index);
+            sync.arrive_and_wait();
+        }
+    };
+    {
+        std::vector<std::jthread> workers;
+        for (unsigned int index = 1; index < thread_num; index++) {
+            workers.emplace_back(run, index);
         }
+        run(0);
+    }
+    stats.depth = level;
 
-        static unsigned int get_cur_time() { return cur_time; }
-        static void get_cur_time(unsigned int _cur_time) { cur_time = _cur_time; }
-        // static unsigned int getEndTime() { return end_time ; }
-        // static void getEndTime(unsigned int _end_time) { end_time = _end_time; }
+    std::vector<unsigned int> row_parents(row_num);
+    for (std::size_t row = 0; row < row_num; row++) {
+        row_parents[row] = levels[row].load(std::memory_order_relaxed) == UNVISITED ? UNVISITED : parents[row].load(std::memory_order_relaxed);
+    }
+    return row_parents;
+}
 
-        virtual void print() const = 0; // the function is used to print the event information
+/*
+The sink. It collects the AGG_ctrl_packets and floods IoT_ctrl_packets like
+any IoT_device, and when it receives a DIS_ctrl_packet that it generated, it
+computes a spanning_tree from the lists it has collected (unless they haven't
+changed since the last one) and sends the packet down the tree: every device
+takes the copy from its new parent, which carries the parents of the devices
+under that parent, and broadcasts it once if devices are under itself. So the
+parents of all devices go out in that one packet, and a device that isn't in
+the lists keeps its parent.
+
+The sink keeps only its latest tree. The packets point to it, and their bodies
+share its ownership (see packet_refs), so a flood still in flight keeps the
+tree it was sent with after a new tree replaces it.
+*/
+class sink_device: public IoT_device {
+        TYPE_TAG(sink_device)
 
-        static void print_registered_event_types () {
-            std::cout << "registered event types:\n";
-            for (const auto &name: derived_class_names) {
-                std::cout << name << '\n';
+        std::shared_ptr<const spanning_tree> tree; // the DIS_ctrl_packets in flight keep theirs alive
+        std::uint64_t tree_generation = 0; // of the collected lists that it was computed from
+        unsigned int compute_thread_num = std::max(std::thread::hardware_concurrency(), 1U);
+
+        explicit sink_device(unsigned int _id): IoT_device(_id) {}
+
+    public:
+        static std::shared_ptr<sink_device> generate(unsigned int _id) {
+            std::shared_ptr<sink_device> sink(new sink_device(_id));
+            register_node(sink);
+            return sink;
+        }
+
+        SET(compute_thread_num)
+        GET(compute_thread_num)
+        // nullptr before the first tree
+        const spanning_tree *get_tree() const { return tree.get(); }
+        // the tree is saved with the sink, unless a packet of an older flood that keeps it was saved first
+        void save(snapshot_writer &out) const override;
+        void restore(snapshot_reader &in) override;
+
+        // computes the tree now instead of when the DIS_ctrl_packet arrives, e.g., to time it
+        const spanning_tree &compute_tree() {
+            if (tree == nullptr || get_collected_generation() != tree_generation) {
+                tree = std::make_shared<const spanning_tree>(spanning_tree::compute(get_node_ID(), get_collected_nblists(), compute_thread_num));
+                tree_generation = get_collected_generation();
             }
+            return *tree;
+        }
+
+        void recv_handler (SharedPacket &p) override {
+            const auto *received = std::get_if<DIS_ctrl_packet>(&p.get());
+            if (received == nullptr || received->get_header().get_pre_ID() != get_node_ID() || received->get_payload().get_tree() != nullptr) {
+                IoT_device::recv_handler(p);
+                return;
+            }
+            compute_tree();
+            if (tree->get_end(0) == 1) { // no device is under the sink
+                return;
+            }
+            auto &packet = std::get<DIS_ctrl_packet>(p.mutate());
+            packet.set_tree(tree.get(), 1, tree->get_end(0)); // held by the body, and by every copy that the devices forward
+            packet.set_pre_ID(get_node_ID());
+            packet.set_nex_ID(BROADCAST_ID);
+            packet.set_dst_ID(BROADCAST_ID);
+            send_handler(p);
         }
 };
-std::priority_queue<std::unique_ptr<event>, std::vector<std::unique_ptr<event>>, mycomp> event::events;
 
-bool mycomp::operator() (const std::unique_ptr<event> &lhs, const std::unique_ptr<event> &rhs) const  {
-    // cout << lhs->get_trigger_time() << ", " << rhs->get_trigger_time() << '\n';
-    // cout << lhs->type() << ", " << rhs->type() << '\n';
-    size_t lhs_pri = lhs->event_priority();
-    size_t rhs_pri = rhs->event_priority();
-    // cout << "lhs hash = " << lhs_pri << '\n';
-    // cout << "rhs hash = " << rhs_pri << '\n';
+using node_types = type_list<IoT_device, sink_device>;
+void node::print () { node_types::print("node"); }
 
-    bool result = lhs->get_trigger_time() == rhs->get_trigger_time() ? lhs_pri > rhs_pri : lhs->get_trigger_time() > rhs->get_trigger_time();
-    return result ^ reverse;
-}
+/*
+The encoding of a checkpoint. The values are written as their bytes in the
+order they are read back, and an array is 8-byte aligned in the file, so the
+reader uses it in place in the mapped snapshot. The objects that the packets and
+the chains point to (the parts of the nblist_chains and the spanning_trees) are
+numbered in the order they are added, and a pointer is written as the number.
+Such an object is written where it is first pointed to, after the objects it
+points to, since a packet of an older flood may keep a tree that its sink has
+replaced, and a part may be reached from many chains. A packet body that several
+events share is written with the first of them, and the others write its number.
+*/
+class snapshot_writer {
+        std::ostream &out;
+        std::uint64_t position = 0;
+        std::unordered_map<const void *, std::uint64_t> object_numbers;
+        std::unordered_map<const node::PacketTypes *, std::uint32_t> packet_numbers;
 
-class recv_event : public event {
     public:
-        class recv_data; // forward declaration
+        static constexpr std::uint64_t NONE = UINT64_MAX; // the number of nullptr
 
-    private:
-        unsigned int sender_id; // the sender
-        unsigned int receiver_id; // the receiver; the packet will be given to the receiver
-        node::PacketTypes pkt; // the packet
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("recv_event");
-        )
-        // this constructor cannot be directly called by users; only by generator
-        // the packet will be given to the receiver
-        recv_event(unsigned int _trigger_time, const recv_data &data) : event(_trigger_time), sender_id(data.s_id), receiver_id(data.r_id), pkt(data._pkt) {}
+        explicit snapshot_writer(std::ostream &_out): out(_out) {}
 
-    public:
-        // recv_event will trigger the recv function
-        void trigger() override {
-            if (!node::id_to_node(receiver_id)){
-                std::cerr << "recv_event error: no node " << receiver_id << "!" << '\n';
-                return ;
+        GET(position)
+        std::size_t get_packet_num() const { return packet_numbers.size(); }
+
+        void write_bytes(std::string_view bytes) {
+            out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+            position += bytes.size();
+        }
+        template <typename T>
+        requires std::is_trivially_copyable_v<T>
+        void write(const T &value) {
+            write_bytes({reinterpret_cast<const char *>(&value), sizeof(T)});
+        }
+        void write_string(std::string_view text) {
+            if (text.size() > UINT32_MAX) {
+                throw std::length_error("A string of the checkpoint is too long");
             }
-            node::id_to_node(receiver_id)->recv(pkt);
+            write(static_cast<std::uint32_t>(text.size()));
+            write_bytes(text);
+        }
+        void align() {
+            static constexpr char zeros[8] = {};
+            write_bytes({zeros, static_cast<std::size_t>((8 - position % 8) % 8)});
+        }
+        template <typename T>
+        requires std::is_trivially_copyable_v<T>
+        void write_array(std::span<const T> values) {
+            write<std::uint64_t>(values.size());
+            align();
+            write_bytes({reinterpret_cast<const char *>(values.data()), values.size_bytes()});
         }
 
-        unsigned int event_priority() const override {
-            std::string string_for_hash;
-            string_for_hash = std::to_string(get_trigger_time()) +
-                std::to_string(sender_id) +
-                std::to_string (receiver_id) +
-                std::to_string (std::visit(overloaded {
-                    [](auto &&packet) { return packet.get_packet_ID(); },
-                    [](std::monostate) -> unsigned { throw std::domain_error("The packet has not been assigned any specific packet type"); }
-                }, pkt));
-            return get_hash_value(string_for_hash);
+        // the next number; an object is added after it is written, and before anything that points to it
+        void add_object(const void *object) { object_numbers.emplace(object, object_numbers.size()); }
+        void write_object(const void *object) {
+            if (object == nullptr) {
+                write(NONE);
+                return;
+            }
+            const auto it = object_numbers.find(object);
+            if (it == object_numbers.end()) {
+                throw std::logic_error("The checkpoint points to an object that it has not written");
+            }
+            write(it->second);
         }
-
-        static void generate(unsigned int _trigger_time, const recv_data &data) {
-            add_event(std::unique_ptr<recv_event>(new recv_event(_trigger_time, data)));
+        bool has_object(const void *object) const { return object_numbers.contains(object); }
+
+        void write_tree(const spanning_tree *tree) {
+            const bool added = tree != nullptr && !has_object(tree);
+            write(added);
+            if (added) {
+                tree->save(*this);
+                add_object(tree);
+            }
+            write_object(tree);
         }
 
-        // this class is used to initialize the recv_event
-        class recv_data{
-            public:
-                unsigned int s_id = 0;
-                unsigned int r_id = 0;
-                node::PacketTypes _pkt;
-        };
-
-        // the recv_event::print() function is used for log file
-        void print () const override {
+        // the bytes of the packet, and then the long msg, the nblist_chain or the spanning_tree that it points to
+        void write_packet(const node::SharedPacket &p) {
+            const node::PacketTypes &body = p.get();
+            const auto [it, added] = packet_numbers.emplace(&body, static_cast<std::uint32_t>(packet_numbers.size()));
+            write(it->second);
+            if (!added) {
+                return;
+            }
             std::visit(overloaded {
-                [&](auto &&packet) {
-                    std::cout << "time "    << std::setw(11) << event::get_cur_time()
-                        << "   recID"       << std::setw(11) << receiver_id
-                        << "   pktID"       << std::setw(11) << packet.get_packet_ID()
-                        << "   srcID"       << std::setw(11) << packet.get_header().get_src_ID()
-                        << "   dstID"       << std::setw(11) << packet.get_header().get_dst_ID()
-                        << "   preID"       << std::setw(11) << packet.get_header().get_pre_ID()
-                        << "   nexID"       << std::setw(11) << packet.get_header().get_nex_ID()
-                        << "   "            << packet.type()
-                        << packet.addition_information();
+                [&](const auto &packet) {
+                    using Packet = std::remove_cvref_t<decltype(packet)>;
+                    const auto &payload = packet.get_payload();
+                    write(Packet::type_tag);
+                    write(packet);
+                    write_string(packet_msg::is_inline(payload.get_msg()) ? std::string_view{} : payload.get_msg());
+                    if constexpr (std::is_same_v<Packet, AGG_ctrl_packet>) {
+                        payload.get_nblists().save(*this);
+                    }
+                    else if constexpr (std::is_same_v<Packet, DIS_ctrl_packet>) {
+                        write_tree(payload.get_tree());
+                    }
                 },
-                [](std::monostate) {}
-            }, pkt);
-            //  if ( pkt->type() == "IoT_ctrl_packet" ) cout << "   " << ((IoT_ctrl_payload*)pkt->get_payload())->getCounter();
-            std::cout << '\n';
-            // cout << pkt->type()
-            //      << "   time "       << setw(11) << event::getCurTime()
-            //      << "   recID "      << setw(11) << receiver_id
-            //      << "   pktID"       << setw(11) << pkt->get_packet_ID()
-            //      << "   srcID "      << setw(11) << pkt->get_header()->get_src_ID()
-            //      << "   dstID"       << setw(11) << pkt->get_header()->get_dst_ID()
-            //      << "   preID"       << setw(11) << pkt->get_header()->get_pre_ID()
-            //      << "   nexID"       << setw(11) << pkt->get_header()->get_nex_ID()
-            //      << '\n';
+                [&](std::monostate) { write(std::uint32_t{0}); }
+            }, body);
         }
 };
 
-class send_event : public event {
+// reads what snapshot_writer wrote from a snapshot in memory
+class snapshot_reader {
+        std::string_view bytes;
+        std::size_t position = 0;
+        std::vector<const void *> objects;
+        // hold what was read until the nodes and the packets that point to it hold it
+        std::vector<nblist_chain> parts;
+        std::vector<std::shared_ptr<const spanning_tree>> trees;
+        std::vector<node::SharedPacket> packets;
+
     public:
-        class send_data; // forward declaration
+        explicit snapshot_reader(std::string_view _bytes): bytes(_bytes) {}
 
-    private:
-        // this constructor cannot be directly called by users; only by generator
-        unsigned int sender_id; // the sender
-        unsigned int receiver_id; // the receiver
-        node::PacketTypes pkt; // the packet
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("send_event");
-        )
-        send_event(unsigned int _trigger_time, const send_data &data) : event(_trigger_time), sender_id(data.s_id), receiver_id(data.r_id), pkt(data._pkt) {}
+        [[noreturn]] static void fail() { throw std::runtime_error("The snapshot is truncated or corrupt"); }
 
-    public:
-        // send_event will trigger the send function
-        void trigger() override {
-            if (!node::id_to_node(sender_id)){
-                std::cerr << "send_event error: no node " << sender_id << "!" << '\n';
-                return ;
+        GET(position)
+        bool at_end() const { return position == bytes.size(); }
+        std::size_t get_packet_num() const { return packets.size(); }
+
+        std::string_view read_bytes(std::size_t size) {
+            if (size > bytes.size() - position) {
+                fail();
             }
-            node::id_to_node(sender_id)->send(pkt);
+            const std::string_view read = bytes.substr(position, size);
+            position += size;
+            return read;
         }
-
-        unsigned int event_priority() const override {
-            std::string string_for_hash;
-            string_for_hash = std::to_string(get_trigger_time()) +
-                std::to_string(sender_id) +
-                std::to_string (receiver_id) +
-                std::to_string (std::visit(overloaded {
-                    [](auto &&packet) { return packet.get_packet_ID(); },
-                    [](std::monostate) -> unsigned { throw std::domain_error("The packet has not been assigned any specific packet type"); }
-                }, pkt));
-            return get_hash_value(string_for_hash);
+        // a packet is read without its constructor, which would take a new packet ID
+        template <typename T>
+        requires std::is_trivially_copyable_v<T>
+        T read() {
+            std::array<char, sizeof(T)> raw;
+            std::memcpy(raw.data(), read_bytes(sizeof(T)).data(), sizeof(T));
+            return std::bit_cast<T>(raw);
+        }
+        // points into the snapshot
+        std::string_view read_string() { return read_bytes(read<std::uint32_t>()); }
+        void align() { read_bytes((8 - position % 8) % 8); }
+        template <typename T>
+        requires std::is_trivially_copyable_v<T> && (alignof(T) <= 8)
+        std::span<const T> read_array() {
+            const auto num = read<std::uint64_t>();
+            align();
+            if (num > (bytes.size() - position) / sizeof(T)) {
+                fail();
+            }
+            return {reinterpret_cast<const T *>(read_bytes(num * sizeof(T)).data()), static_cast<std::size_t>(num)};
         }
 
-        static void generate(unsigned int _trigger_time, const send_data &data) {
-            add_event(std::unique_ptr<send_event>(new send_event(_trigger_time, data)));
+        void add_object(const void *object) { objects.push_back(object); }
+        template <typename T>
+        const T *read_object() {
+            const auto number = read<std::uint64_t>();
+            if (number == snapshot_writer::NONE) {
+                return nullptr;
+            }
+            if (number >= objects.size()) {
+                fail();
+            }
+            return static_cast<const T *>(objects[number]);
         }
+        void hold_part(nblist_chain part) { parts.push_back(std::move(part)); }
 
-        // this class is used to initialize the send_event
-        class send_data{
-            public:
-                unsigned int s_id = 0;
-                unsigned int r_id = 0;
-                node::PacketTypes _pkt;
-                unsigned int t = 0;
-        };
+        std::shared_ptr<const spanning_tree> read_tree() {
+            if (read<bool>()) {
+                trees.push_back(std::make_shared<const spanning_tree>(spanning_tree::restore(*this)));
+                add_object(trees.back().get());
+            }
+            const spanning_tree *tree = read_object<spanning_tree>();
+            if (tree == nullptr) {
+                return nullptr;
+            }
+            const auto it = std::find_if(trees.begin(), trees.end(), [&](const auto &read) { return read.get() == tree; });
+            if (it == trees.end()) {
+                fail();
+            }
+            return *it;
+        }
 
-        void print () const override { // the send_event::print() function is used for log file
-            std::visit(overloaded {
-                [&](auto &&packet) {
-                    std::cout << "time "     << std::setw(11) << event::get_cur_time()
-                        << "   senID"       << std::setw(11) << sender_id
-                        << "   pktID"       << std::setw(11) << packet.get_packet_ID()
-                        << "   srcID"       << std::setw(11) << packet.get_header().get_src_ID()
-                        << "   dstID"       << std::setw(11) << packet.get_header().get_dst_ID()
-                        << "   preID"       << std::setw(11) << packet.get_header().get_pre_ID()
-                        << "   nexID"       << std::setw(11) << packet.get_header().get_nex_ID()
-                        << "   "            << packet.type()
-                        << packet.addition_information()
-                        // << "   msg"         << setw(11) << dynamic_cast<IoT_data_payload*>(pkt->get_payload())->getMsg()
-                        << '\n';
-                },
-                [](std::monostate) {}
-            }, pkt);
-            
-            // cout << pkt->type()
-            //      << "   time "       << setw(11) << event::getCurTime()
-            //      << "   senID "      << setw(11) << sender_id
-            //      << "   pktID"       << setw(11) << pkt->get_packet_ID()
-            //      << "   srcID "      << setw(11) << pkt->get_header()->get_src_ID()
-            //      << "   dstID"       << setw(11) << pkt->get_header()->get_dst_ID()
-            //      << "   preID"       << setw(11) << pkt->get_header()->get_pre_ID()
-            //      << "   nexID"       << setw(11) << pkt->get_header()->get_nex_ID()
-            //      << '\n';
+        node::SharedPacket read_packet() {
+            const auto number = read<std::uint32_t>();
+            if (number < packets.size()) {
+                return packets[number];
+            }
+            if (number > packets.size()) {
+                fail();
+            }
+            node::SharedPacket p;
+            const auto tag = read<std::uint32_t>();
+            const bool known = tag == 0 || packet_types::visit(tag, [&](auto type) {
+                using Packet = typename decltype(type)::type;
+                auto packet = read<Packet>();
+                if (const std::string_view msg = read_string(); !msg.empty()) {
+                    packet.set_msg(msg);
+                }
+                // the body holds the msg, the lists and the tree (see packet_refs)
+                nblist_chain nblists;
+                std::shared_ptr<const spanning_tree> tree;
+                if constexpr (std::is_same_v<Packet, AGG_ctrl_packet>) {
+                    nblists = nblist_chain::restore(*this);
+                    packet.set_nblists(nblists);
+                }
+                else if constexpr (std::is_same_v<Packet, DIS_ctrl_packet>) {
+                    const DIS_ctrl_payload &payload = packet.get_payload();
+                    tree = read_tree();
+                    packet.set_tree(tree.get(), payload.get_range_begin(), payload.get_range_end());
+                }
+                p = std::move(packet);
+            });
+            if (!known) {
+                fail();
+            }
+            packets.push_back(p);
+            return p;
         }
 };
 
-////////////////////////////////////////////////////////////////////////////////
+void nblist_chain::save(snapshot_writer &out) const {
+    // the parts that the snapshot doesn't have yet, each after the parts it points to
+    std::vector<const part *> added;
+    std::unordered_set<const part *> seen;
+    std::vector<std::pair<const part *, bool>> pending{{chain.head, false}}; // and whether its parts were added
+    while (!pending.empty()) {
+        const auto [current, ready] = pending.back();
+        pending.pop_back();
+        if (ready) {
+            added.push_back(current);
+        }
+        else if (current != nullptr && !out.has_object(current) && seen.insert(current).second) {
+            pending.emplace_back(current, true);
+            pending.emplace_back(current->next, false);
+            pending.emplace_back(current->nested, false);
+        }
+    }
+    out.write<std::uint64_t>(added.size());
+    for (const part *saved: added) {
+        out.write_object(saved->nested);
+        out.write_object(saved->next);
+        if (saved->nested == nullptr) {
+            out.write_string(saved->bytes());
+        }
+        out.add_object(saved);
+    }
+    out.write_object(chain.head);
+    out.write(chain.byte_num);
+    out.write(chain.nblist_num);
+}
+
+nblist_chain nblist_chain::restore(snapshot_reader &in) {
+    const auto num = in.read<std::uint64_t>();
+    for (std::uint64_t i = 0; i < num; i++) {
+        const part *nested = in.read_object<part>();
+        const part *next = in.read_object<part>();
+        const std::string_view bytes = nested == nullptr ? in.read_string() : std::string_view{};
+        retain(nested);
+        retain(next);
+        nblist_chain read;
+        read.chain.head = make_part(bytes, nested, next);
+        in.add_object(read.chain.head);
+        in.hold_part(std::move(read));
+    }
+    borrowed restored;
+    restored.head = in.read_object<part>();
+    restored.byte_num = in.read<std::uint32_t>();
+    restored.nblist_num = in.read<std::uint32_t>();
+    return nblist_chain(restored);
+}
+
+void route_table::save(snapshot_writer &out) const {
+    out.write<std::uint64_t>(routes.size());
+    for (const route &r: routes) {
+        out.write(r.next_hop);
+        out.write(r.hop_num);
+        out.write(r.flood_ID);
+        out.write(r.repair_parent);
+        out.write<std::uint64_t>(r.pending_reply_num);
+        out.write(r.child_num);
+        out.write(r.held_report_num);
+        r.held_nblists.save(out);
+    }
+}
+
+void route_table::restore(snapshot_reader &in) {
+    const auto num = in.read<std::uint64_t>();
+    if (num > current().root_IDs.size()) {
+        snapshot_reader::fail();
+    }
+    routes.assign(num, route());
+    for (route &r: routes) {
+        r.next_hop = in.read<unsigned int>();
+        r.hop_num = in.read<unsigned int>();
+        r.flood_ID = in.read<unsigned int>();
+        r.repair_parent = in.read<unsigned int>();
+        r.pending_reply_num = in.read<std::uint64_t>();
+        r.child_num = in.read<unsigned int>();
+        r.held_report_num = in.read<unsigned int>();
+        r.held_nblists = nblist_chain::restore(in);
+    }
+}
+
+void route_table::save_roots(snapshot_writer &out) {
+    out.write_array(std::span<const unsigned int>(current().root_IDs));
+    out.write(current().repair_enabled);
+    out.write<std::uint64_t>(current().repair_num);
+    out.write<std::uint64_t>(current().repair_event_num);
+    out.write<std::uint64_t>(current().reflood_event_num);
+}
+
+void route_table::restore_roots(snapshot_reader &in) {
+    current().root_slots = {};
+    current().root_IDs.clear();
+    for (const unsigned int root_id: in.read_array<unsigned int>()) {
+        add_root(root_id);
+    }
+    current().repair_enabled = in.read<bool>();
+    current().repair_num = in.read<std::uint64_t>();
+    current().repair_event_num = in.read<std::uint64_t>();
+    current().reflood_event_num = in.read<std::uint64_t>();
+}
+
+void IoT_device::save(snapshot_writer &out) const {
+    routes.save(out);
+    out.write(delivered_num);
+    out.write(delay_sum);
+    collected_nblists.save(out);
+    out.write(collected_generation);
+    out.write(parent_id);
+}
+
+void IoT_device::restore(snapshot_reader &in) {
+    routes.restore(in);
+    delivered_num = in.read<std::uint64_t>();
+    delay_sum = in.read<std::uint64_t>();
+    collected_nblists = nblist_chain::restore(in);
+    collected_generation = in.read<std::uint64_t>();
+    parent_id = in.read<unsigned int>();
+}
+
+void spanning_tree::save(snapshot_writer &out) const {
+    out.write_array(std::span<const unsigned int>(IDs));
+    out.write_array(std::span<const unsigned int>(parents));
+    out.write_array(std::span<const unsigned int>(ends));
+    out.write(stats);
+}
+
+spanning_tree spanning_tree::restore(snapshot_reader &in) {
+    spanning_tree tree;
+    for (std::vector<unsigned int> *values: {&tree.IDs, &tree.parents, &tree.ends}) {
+        const std::span<const unsigned int> read = in.read_array<unsigned int>();
+        values->assign(read.begin(), read.end());
+    }
+    if (tree.parents.size() != tree.IDs.size() || tree.ends.size() != tree.IDs.size()) {
+        snapshot_reader::fail();
+    }
+    for (std::size_t number = 0; number < tree.IDs.size(); number++) {
+        tree.numbers.insert(tree.IDs[number], static_cast<unsigned int>(number));
+    }
+    tree.stats = in.read<statistics>();
+    return tree;
+}
+
+void sink_device::save(snapshot_writer &out) const {
+    IoT_device::save(out);
+    out.write_tree(tree.get());
+    out.write(tree_generation);
+    out.write(compute_thread_num);
+}
+
+void sink_device::restore(snapshot_reader &in) {
+    IoT_device::restore(in);
+    tree = in.read_tree();
+    tree_generation = in.read<std::uint64_t>();
+    compute_thread_num = in.read<unsigned int>();
+}
+
+class mycomp {
+    bool reverse;
 
-class IoT_data_pkt_gen_event : public event {
     public:
-        class gen_data; // forward declaration
+        explicit mycomp(bool revparam = false) : reverse(revparam) {}
+        bool operator() (const std::unique_ptr<event> &lhs, const std::unique_ptr<event> &rhs) const;
+};
 
-    // this class is used to initialize the IoT_data_pkt_gen_event
-        class pkt_gen_data {
-            public:
-                unsigned int src_id = 0;
-                unsigned int dst_id = 0;
-                std::string msg;
-                // packet *_pkt;
+/*
+A free list of fixed-size blocks for one event type. Every event type has its
+own pool (see POOL_ALLOCATED), and an event's block goes back to the free list
+when the event is deleted after trigger(), so once the pools have grown to the
+peak number of pending events, the simulation doesn't allocate anymore. The
+blocks are never given back to the system.
+
+Every thread that runs events uses its own pools, so the pools need no locks.
+The main thread uses slot 0, and the other threads lease a free slot (see
+slot_lease), so the threads of concurrent simulations don't share one. An
+event may be deleted by another thread than the one that created it; its block
+then joins the free list of the deleting thread, so live can be negative for
+a single pool, but not for the sum of the pools of an event type.
+*/
+class event_pool {
+        union block {
+            block *next;
+            std::max_align_t align;
         };
 
-    private:
-        // this constructor cannot be directly called by users; only by generator
-        unsigned int src; // the src
-        unsigned int dst; // the dst
-        // packet *pkt; // the packet
-        std::string msg;
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("IoT_data_pkt_gen_event");
-        )
-        IoT_data_pkt_gen_event(unsigned int _trigger_time, const pkt_gen_data &data) : event(_trigger_time), src(data.src_id), dst(data.dst_id), msg(data.msg) {}
+        static constexpr std::size_t MAX_CHUNK_BLOCK_NUM = 4096;
+        static inline thread_local std::size_t slot = 0; // which pool of each family this thread uses
+        static inline std::mutex slots_mutex;
+        static inline std::vector<bool> leased_slots = {true}; // slot 0 is the main thread's
+
+        std::size_t block_size;
+        std::vector<std::unique_ptr<block[]>> chunks;
+        std::size_t chunk_block_num = 64; // doubles up to MAX_CHUNK_BLOCK_NUM every time the pool grows
+        block *free_list = nullptr;
+
+        std::size_t capacity = 0; // the number of blocks
+        std::ptrdiff_t live = 0;
+        std::ptrdiff_t high_water = 0; // the peak of live
+        std::size_t allocation_num = 0;
+        std::size_t reuse_num = 0; // the allocations served by a block released before
+
+        void grow() {
+            const std::size_t block_num_per_event = (block_size + sizeof(block) - 1) / sizeof(block);
+            std::unique_ptr<block[]> chunk(new block[chunk_block_num * block_num_per_event]);
+            for (std::size_t i = chunk_block_num; i-- > 0;) {
+                block *b = &chunk[i * block_num_per_event];
+                b->next = free_list;
+                free_list = b;
+            }
+            chunks.push_back(std::move(chunk));
+            capacity += chunk_block_num;
+            chunk_block_num = std::min(2 * chunk_block_num, MAX_CHUNK_BLOCK_NUM);
+        }
 
     public:
-        static void generate(unsigned int _trigger_time, const pkt_gen_data &data) {
-            add_event(std::unique_ptr<IoT_data_pkt_gen_event>(new IoT_data_pkt_gen_event(_trigger_time, data)));
-        }
+        // the pools of one event type, one for each slot
+        class family {
+                std::string name;
+                std::size_t block_size;
+                std::mutex pools_mutex;
+                std::vector<std::unique_ptr<event_pool>> pools;
 
-        // IoT_data_pkt_gen_event will trigger the packet gen function
-        void trigger() override {
-            if (!node::id_to_node(src)){
-                std::cerr << "IoT_data_pkt_gen_event error: no node " << src << "!" << '\n';
-                return ;
-            }
-            if ( dst != BROADCAST_ID && !node::id_to_node(dst)) {
-                std::cerr << "IoT_data_pkt_gen_event error: no node " << dst << "!" << '\n';
-                return;
-            }
+                static inline std::mutex families_mutex;
+                static inline std::vector<family *> families; // all families that have been used, for print
 
-            IoT_data_packet pkt;
+            public:
+                family(std::string _name, std::size_t _block_size): name(std::move(_name)), block_size(_block_size) {
+                    std::lock_guard<std::mutex> lock(families_mutex);
+                    families.push_back(this);
+                }
+                family(const family &other) = delete;
+                family(family &&other) = delete;
+                family &operator=(const family &other) = delete;
+                family &operator=(family &&other) = delete;
+                ~family() = default;
+
+                // only called when a thread first uses a slot, so the lock is not on the allocation path
+                event_pool &at(std::size_t _slot) {
+                    std::lock_guard<std::mutex> lock(pools_mutex);
+                    while (pools.size() <= _slot) {
+                        pools.push_back(std::make_unique<event_pool>(block_size));
+                    }
+                    return *pools[_slot];
+                }
 
-            pkt.set_src_ID(src);
-            pkt.set_dst_ID(dst);
-            pkt.set_pre_ID(src); // this column is not important when the packet is first received by the src (i.e., just generated)
-            pkt.set_nex_ID(src); // this column is not important when the packet is first received by the src (i.e., just generated)
+                static void print() {
+                    std::lock_guard<std::mutex> lock(families_mutex);
+                    std::cout << "event pool usage:\n";
+                    for (family *f: families) {
+                        std::lock_guard<std::mutex> pools_lock(f->pools_mutex);
+                        std::size_t capacity = 0;
+                        std::ptrdiff_t live = 0;
+                        std::ptrdiff_t high_water = 0; // the sum of the peaks of the pools, which may be reached at different times
+                        std::size_t allocation_num = 0;
+                        std::size_t reuse_num = 0;
+                        for (const auto &pool: f->pools) {
+                            capacity += pool->capacity;
+                            live += pool->live;
+                            high_water += pool->high_water;
+                            allocation_num += pool->allocation_num;
+                            reuse_num += pool->reuse_num;
+                        }
+                        std::cout << f->name
+                            << ": capacity " << capacity
+                            << ", live " << live
+                            << ", high-water " << high_water
+                            << ", allocations " << allocation_num
+                            << ", reuses " << reuse_num << '\n';
+                    }
+                }
+        };
 
-            pkt.set_msg(msg);
+        explicit event_pool(std::size_t _block_size): block_size(_block_size) {}
+        event_pool(const event_pool &other) = delete;
+        event_pool(event_pool &&other) = delete;
+        event_pool &operator=(const event_pool &other) = delete;
+        event_pool &operator=(event_pool &&other) = delete;
+        ~event_pool() = default;
 
-            recv_event::recv_data e_data;
-            e_data.s_id = src;
-            e_data.r_id = src; // to make the packet start from the src
-            e_data._pkt = pkt;
+        // the pools used by the calling thread; no two running threads may use the same slot
+        static void set_slot(std::size_t _slot) { slot = _slot; }
+        static std::size_t get_slot() { return slot; }
 
-            recv_event::generate(get_trigger_time(), e_data);
-        }
+        // gives the calling thread a slot that no other thread has leased until the lease ends,
+        // and then the slot it had before
+        class slot_lease {
+                std::size_t previous = slot;
+                std::size_t leased;
 
-        unsigned int event_priority() const override {
-            std::string string_for_hash;
-            string_for_hash = std::to_string(get_trigger_time()) + std::to_string(src) + std::to_string (dst) ; //to_string (pkt->get_packet_ID());
-            return get_hash_value(string_for_hash);
+            public:
+                slot_lease() {
+                    std::lock_guard<std::mutex> lock(slots_mutex);
+                    leased = static_cast<std::size_t>(std::find(leased_slots.begin(), leased_slots.end(), false) - leased_slots.begin());
+                    if (leased == leased_slots.size()) {
+                        leased_slots.push_back(true);
+                    }
+                    leased_slots[leased] = true;
+                    slot = leased;
+                }
+                slot_lease(const slot_lease &other) = delete;
+                slot_lease(slot_lease &&other) = delete;
+                slot_lease &operator=(const slot_lease &other) = delete;
+                slot_lease &operator=(slot_lease &&other) = delete;
+                ~slot_lease() {
+                    slot = previous;
+                    std::lock_guard<std::mutex> lock(slots_mutex);
+                    leased_slots[leased] = false;
+                }
+        };
+
+        void *allocate(std::size_t size) {
+            if (size != block_size) { // a subclass that doesn't have its own pool
+                return ::operator new(size);
+            }
+            allocation_num++;
+            if (live < high_water && free_list != nullptr) { // the free list is LIFO, so a released block is on top of the fresh ones
+                reuse_num++;
+            }
+            else if (free_list == nullptr) {
+                grow();
+            }
+            block *b = free_list;
+            free_list = b->next;
+            live++;
+            high_water = std::max(high_water, live);
+            return b;
         }
 
-        // the IoT_data_pkt_gen_event::print() function is used for log file
-        void print () const override {
-            std::cout << "time "     << std::setw(11) << event::get_cur_time()
-                << "        "       << std::setw(11) << " "
-                << "        "       << std::setw(11) << " "
-                << "   srcID"       << std::setw(11) << src
-                << "   dstID"       << std::setw(11) << dst
-                << "        "       << std::setw(11) << " "
-                << "        "       << std::setw(11) << " "
-                << "   IoT_data_packet generating"
-                << '\n';
+        void deallocate(void *p, std::size_t size) {
+            if (p == nullptr) {
+                return;
+            }
+            if (size != block_size) {
+                ::operator delete(p);
+                return;
+            }
+            block *b = static_cast<block *>(p);
+            b->next = free_list;
+            free_list = b;
+            live--;
         }
+
+        GET(capacity)
+        GET(live)
+        GET(high_water)
+        GET(allocation_num)
+        GET(reuse_num)
+
+        static void print() { family::print(); }
 };
 
-class IoT_ctrl_pkt_gen_event : public event {
+/*
+The metrics of the simulation. While they are open, the engines count the
+events of every type, the end-to-end delays of the delivered IoT_data_packets
+(a histogram whose bucket b holds the delays below 2^b but not below 2^(b-1))
+and the number of pending events every sample period of simulated time. At the
+end of every start_simulate the totals since open are written to the file as
+JSON, with the wall-clock events per second of every run and the packets sent
+and received by every node (node::get_sent_packet_num/get_received_packet_num,
+which the nodes always count).
+
+The counters are kept in a shard for each thread that runs events (see
+event_pool::set_slot); a shard fills its own cache lines, so the hot path adds
+to counters that no other thread writes, without atomics. The shards are summed
+when the file is written, while no events run. Only the main thread samples the
+pending events; when there are MAX_SAMPLE_NUM samples, every other one is
+dropped and the period is doubled.
+*/
+class metrics {
     public:
-        class gen_data; // forward declaration
+        static constexpr std::size_t MAX_EVENT_TYPE_NUM = 16; // of a shard; the types after these are counted together as other
+        static constexpr std::size_t DELAY_BUCKET_NUM = 33;
+        static constexpr std::size_t MAX_SAMPLE_NUM = 4096;
 
-    // this class is used to initialize the IoT_ctrl_pkt_gen_event
-        class pkt_gen_data {
+    private:
+        class alignas(64) shard {
             public:
-                unsigned int src_id = 0; // the sink
-                unsigned int dst_id = 0; // the node that should update its rule
-                // unsigned int mat_id; // the target of the rule
-                // unsigned int act_id; // the next hop toward the target recorded in the rule
-                std::string msg;
-                // double per; // the percentage
-                // packet *_pkt;
-    };
+                std::array<std::pair<std::uint32_t, std::uint64_t>, MAX_EVENT_TYPE_NUM> event_nums{}; // by type tag
+                std::size_t event_type_num = 0;
+                std::uint64_t other_event_num = 0;
+                std::array<std::uint64_t, DELAY_BUCKET_NUM> delay_nums{};
+                std::uint64_t delay_sum = 0;
+                std::uint64_t delay_max = 0;
+        };
 
-    private:
-        // this constructor cannot be directly called by users; only by generator
-        unsigned int src; // the src
-        unsigned int dst; // the dst
-        // unsigned int mat;
-        // unsigned int act;
-        // packet *pkt; // the packet
-        std::string msg;
-        // double per; // percentage
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("IoT_ctrl_pkt_gen_event");
-        )
-        IoT_ctrl_pkt_gen_event(unsigned int _trigger_time, const pkt_gen_data &data) : event(_trigger_time), src(data.src_id), dst(data.dst_id), msg(data.msg) {}
+        class run {
+            public:
+                std::string_view engine;
+                unsigned int end_time = 0;
+                std::uint64_t event_num = 0;
+                unsigned int packet_num = 0;
+                double wall_seconds = 0;
+#ifndef NDEBUG
+                unsigned int live_packet_num = 0; // at the end of the run
+#endif
+        };
 
-    public:
-        static void generate(unsigned int _trigger_time, const pkt_gen_data &data) {
-            add_event(std::unique_ptr<IoT_ctrl_pkt_gen_event>(new IoT_ctrl_pkt_gen_event(_trigger_time, data)));
+        static inline bool opened = false;
+        static inline std::string path;
+        static inline std::mutex shards_mutex;
+        static inline std::deque<shard> shards; // by slot; a deque never moves its elements
+        static inline std::vector<run> runs;
+        static inline unsigned int sample_period = 0;
+        static inline std::uint64_t next_sample_time = 0;
+        static inline std::vector<std::pair<unsigned int, std::size_t>> samples; // the time and the pending events
+
+        static shard &local() {
+            thread_local shard *instance = nullptr;
+            thread_local std::size_t instance_slot = 0;
+            if (instance == nullptr || instance_slot != event_pool::get_slot()) {
+                std::lock_guard<std::mutex> lock(shards_mutex);
+                instance_slot = event_pool::get_slot();
+                while (shards.size() <= instance_slot) {
+                    shards.emplace_back();
+                }
+                instance = &shards[instance_slot];
+            }
+            return *instance;
         }
 
-        // IoT_ctrl_pkt_gen_event will trigger the packet gen function
-        void trigger() override {
-            IoT_ctrl_packet pkt;
+        static void write(); // see below
 
-            pkt.set_src_ID(src);
-            pkt.set_dst_ID(dst);
-            pkt.set_pre_ID(src);
-            pkt.set_nex_ID(src);
-
-            // payload
-            pkt.set_msg(msg);
-            // pld->setMatID(mat);
-            // pld->setActID(act);
-            // pld->setPer(per);
+    public:
+        // starts counting from zero; the file is written at the end of every start_simulate until close
+        static void open(const std::string &_path, unsigned int _sample_period = 100);
+        static void close() { opened = false; }
+        static bool is_open() { return opened; }
 
-            recv_event::recv_data e_data;
-            e_data.s_id = src;
-            e_data.r_id = src;
-            e_data._pkt = pkt;
+        static void count_event(std::uint32_t type_tag) {
+            if (!opened) {
+                return;
+            }
+            shard &s = local();
+            for (std::size_t i = 0; i < s.event_type_num; i++) {
+                if (s.event_nums[i].first == type_tag) {
+                    s.event_nums[i].second++;
+                    return;
+                }
+            }
+            if (s.event_type_num < MAX_EVENT_TYPE_NUM) {
+                s.event_nums[s.event_type_num++] = {type_tag, 1};
+            }
+            else {
+                s.other_event_num++;
+            }
+        }
 
-            recv_event::generate(get_trigger_time(), e_data);
+        static void record_delay(std::uint64_t delay) {
+            if (!opened) {
+                return;
+            }
+            shard &s = local();
+            s.delay_nums[std::min<std::size_t>(std::bit_width(delay), DELAY_BUCKET_NUM - 1)]++;
+            s.delay_sum += delay;
+            s.delay_max = std::max(s.delay_max, delay);
         }
 
-        unsigned int event_priority() const override {
-            std::string string_for_hash;
-            // string_for_hash = to_string(get_trigger_time()) + to_string(src) + to_string(dst) + to_string(mat) + to_string(act); //to_string (pkt->get_packet_ID());
-            string_for_hash = std::to_string(get_trigger_time()) + std::to_string(src) + std::to_string(dst) ; //to_string (pkt->get_packet_ID());
-            return get_hash_value(string_for_hash);
+        // pending() returns the number of pending events; it is only called when a sample is due
+        template <typename F>
+        static void sample_pending(unsigned int time, F &&pending) {
+            if (!opened || time < next_sample_time) {
+                return;
+            }
+            samples.emplace_back(time, pending());
+            next_sample_time = std::uint64_t{time} + sample_period;
+            if (samples.size() == MAX_SAMPLE_NUM) {
+                for (std::size_t i = 0; i < MAX_SAMPLE_NUM / 2; i++) {
+                    samples[i] = samples[2 * i];
+                }
+                samples.resize(MAX_SAMPLE_NUM / 2);
+                sample_period *= 2;
+            }
         }
 
-        // the IoT_ctrl_pkt_gen_event::print() function is used for log file
-        void print () const override {
-            std::cout << "time "     << std::setw(11) << event::get_cur_time()
-                << "        "       << std::setw(11) << " "
-                << "        "       << std::setw(11) << " "
-                << "   srcID"       << std::setw(11) << src
-                << "   dstID"       << std::setw(11) << dst
-                << "        "       << std::setw(11) << " "
-                << "        "       << std::setw(11) << " "
-                //  << "   matID"       << setw(11) << mat
-                //  << "   actID"       << setw(11) << act
-                << "   IoT_ctrl_packet generating"
-                << '\n';
+        // called at the end of every start_simulate
+        static void end_run(std::string_view engine, unsigned int end_time, std::uint64_t event_num, unsigned int packet_num, double wall_seconds) {
+            if (!opened) {
+                return;
+            }
+            runs.push_back({engine, end_time, event_num, packet_num, wall_seconds});
+#ifndef NDEBUG
+            runs.back().live_packet_num = IoT_data_packet::get_live_packet_num(); // the same for every packet type
+#endif
+            write();
         }
 };
 
-class AGG_ctrl_pkt_gen_event : public event {
+/*
+The binary trace. While it is open, the engines write every event as one
+fixed-size record instead of formatting it to std::cout, and a writer thread
+drains the records from a lock-free ring buffer to the file, so the simulation
+only copies a few integers per event. render prints a trace in the text format,
+byte for byte; run the program with "render <file>" to do it offline.
+
+A name (a packet type or the label of addition_information) is written once,
+before the first record that uses it. An event that doesn't write a record of
+its own (see event::trace) is kept as the text it prints, so any event can be
+traced. The records are in the byte order of the machine.
+*/
+class binary_trace {
     public:
-        class gen_data; // forward declaration
+        enum class kind : std::uint8_t { name, text, recv, send, gen };
+        static constexpr std::uint16_t NO_NAME = UINT16_MAX;
 
-    // this class is used to initialize the AGG_ctrl_pkt_gen_event
-        class pkt_gen_data {
+        class record {
             public:
-                unsigned int src_id = 0; // the sink
-                unsigned int dst_id = 0; // the node that should update its rule
-                // unsigned int mat_id; // the target of the rule
-                // unsigned int act_id; // the next hop toward the target recorded in the rule
-                std::string msg;
-                // double per; // the percentage
-                // packet *_pkt;
-    };
+                std::uint32_t time = 0;
+                kind type = kind::text;
+                std::uint8_t reserved = 0;
+                std::uint16_t name = NO_NAME; // the packet type; the defined name of a name record
+                std::uint32_t node_ID = 0; // the receiver or the sender; the length of a name or text record's string
+                std::uint32_t packet_ID = 0;
+                std::uint32_t src_ID = 0;
+                std::uint32_t dst_ID = 0;
+                std::uint32_t pre_ID = 0;
+                std::uint32_t nex_ID = 0;
+                std::uint16_t label = NO_NAME; // the label of addition_information, followed by addition
+                std::uint16_t reserved2 = 0;
+                std::uint32_t addition = 0;
+        };
+        static_assert(std::is_trivially_copyable_v<record> && sizeof(record) == 40);
+
+        using buffer = std::vector<record>;
 
     private:
-        // this constructor cannot be directly called by users; only by generator
-        unsigned int src; // the src
-        unsigned int dst; // the dst
-        // unsigned int mat;
-        // unsigned int act;
-        // packet *pkt; // the packet
-        std::string msg;
-        // double per; // percentage
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("AGG_ctrl_pkt_gen_event");
-        )
-        AGG_ctrl_pkt_gen_event(unsigned int _trigger_time, const pkt_gen_data &data) : event(_trigger_time), src(data.src_id), dst(data.dst_id), msg(data.msg) {}
+        static constexpr char MAGIC[8] = {'I', 'o', 'T', 'T', 'R', 'A', 'C', '1'};
+        static constexpr std::size_t RING_SIZE = std::size_t{1} << 16; // records; a power of 2
+
+        static inline std::mutex names_mutex;
+        static inline std::vector<std::string> names;
+        static inline std::unordered_map<std::string, std::uint16_t> name_index;
+
+        // the ring is written by the thread that runs the engine and read by the writer thread
+        static inline std::unique_ptr<record[]> ring;
+        static inline std::atomic<std::size_t> head; // the number of records written to the ring
+        static inline std::atomic<std::size_t> tail; // the number of records written to the file
+        static inline std::atomic<bool> failed;
+        static inline std::ofstream file;
+        static inline std::jthread writer; // declared after file and ring, so at exit it is stopped and joined before they go
+        static inline bool opened = false;
+        static inline std::size_t written_name_num = 0; // the names already in the ring
+
+        // the record header followed by the string in as many records as needed
+        static void append_string(buffer &out, kind type, std::uint16_t name, std::string_view text) {
+            record r;
+            r.type = type;
+            r.name = name;
+            r.node_ID = static_cast<std::uint32_t>(text.size());
+            out.push_back(r);
+            for (std::size_t i = 0; i < text.size(); i += sizeof(record)) {
+                record chunk;
+                std::memcpy(static_cast<void *>(&chunk), text.data() + i, std::min(sizeof(record), text.size() - i));
+                out.push_back(chunk);
+            }
+        }
+
+        static void push(const record *first, std::size_t num) {
+            std::size_t h = head.load(std::memory_order_relaxed);
+            while (num > 0) {
+                const std::size_t free_num = RING_SIZE - (h - tail.load(std::memory_order_acquire));
+                if (free_num == 0) { // the writer is behind
+                    std::this_thread::yield();
+                    continue;
+                }
+                const std::size_t n = std::min({num, free_num, RING_SIZE - h % RING_SIZE});
+                std::copy(first, first + n, &ring[h % RING_SIZE]);
+                h += n;
+                head.store(h, std::memory_order_release);
+                first += n;
+                num -= n;
+            }
+        }
+
+        // runs until a stop is requested, by close or by the destruction of writer at exit, and then writes the rest
+        static void write_ring(std::stop_token token) {
+            std::size_t t = tail.load(std::memory_order_relaxed);
+            while (true) {
+                const bool stopping = token.stop_requested();
+                const std::size_t h = head.load(std::memory_order_acquire);
+                if (t == h) {
+                    if (stopping) {
+                        return;
+                    }
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    continue;
+                }
+                const std::size_t n = std::min(h - t, RING_SIZE - t % RING_SIZE);
+                file.write(reinterpret_cast<const char *>(&ring[t % RING_SIZE]), static_cast<std::streamsize>(n * sizeof(record)));
+                if (!file) {
+                    failed = true;
+                }
+                t += n;
+                tail.store(t, std::memory_order_release);
+            }
+        }
 
     public:
-        static void generate(unsigned int _trigger_time, const pkt_gen_data &data) {
-            add_event(std::unique_ptr<AGG_ctrl_pkt_gen_event>(new AGG_ctrl_pkt_gen_event(_trigger_time, data)));
+        // the file is overwritten; the trace must not be opened or closed while a simulation runs
+        static void open(const std::string &path) {
+            if (opened) {
+                throw std::logic_error("The binary trace is already open");
+            }
+            file.open(path, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                throw std::runtime_error("Cannot open the binary trace " + path);
+            }
+            file.write(MAGIC, sizeof(MAGIC));
+            if (!ring) {
+                ring = std::make_unique<record[]>(RING_SIZE);
+            }
+            head = tail = 0;
+            failed = false;
+            written_name_num = 0;
+            opened = true;
+            writer = std::jthread(write_ring);
         }
 
-        // AGG_ctrl_pkt_gen_event will trigger the packet gen function
-        void trigger() override {
-            AGG_ctrl_packet pkt;
-            pkt.set_src_ID(src);
-            pkt.set_dst_ID(dst);
-            pkt.set_pre_ID(src);
-            pkt.set_nex_ID(src);
+        // waits for the writer to write all records
+        static void close() {
+            if (!opened) {
+                return;
+            }
+            writer.request_stop();
+            writer.join();
+            file.close();
+            opened = false;
+            if (failed || file.fail()) {
+                throw std::runtime_error("Cannot write the binary trace");
+            }
+        }
 
-            // payload
-            pkt.set_msg(msg);
-            // pld->setMatID(mat);
-            // pld->setActID(act);
-            // pld->setPer(per);
+        static bool is_open() { return opened; }
 
-            recv_event::recv_data e_data;
-            e_data.s_id = src;
-            e_data.r_id = src;
-            e_data._pkt = pkt;
+        // the index of a name; the callers keep it, e.g. in a function-local static, so it is looked up once
+        static std::uint16_t intern(std::string_view name) {
+            std::lock_guard<std::mutex> lock(names_mutex);
+            const auto [it, inserted] = name_index.try_emplace(std::string(name), static_cast<std::uint16_t>(names.size()));
+            if (inserted) {
+                if (names.size() == NO_NAME) {
+                    throw std::length_error("Too many names in the binary trace");
+                }
+                names.emplace_back(name);
+            }
+            return it->second;
+        }
 
-            recv_event::generate(get_trigger_time(), e_data);
+        // the index of the name of the packet's type, which is looked up once per type
+        template <typename Packet>
+        static std::uint16_t type_name(const Packet &packet) {
+            static const std::uint16_t index = intern(packet.type());
+            return index;
+        }
+        // the label of the packet's addition_information; a type may have more than one (see DIS_ctrl_packet),
+        // so each thread keeps the last label of the type and looks a label up only when it changes
+        template <typename Packet>
+        static std::uint16_t label_name(const Packet &packet) {
+            const std::string_view label = packet.addition_label();
+            if (label.empty()) {
+                return NO_NAME;
+            }
+            thread_local std::string_view last_label;
+            thread_local std::uint16_t last_index = NO_NAME;
+            if (label != last_label) {
+                last_index = intern(label);
+                last_label = label;
+            }
+            return last_index;
         }
 
-        unsigned int event_priority() const override {
-            std::string string_for_hash;
-            // string_for_hash = to_string(get_trigger_time()) + to_string(src) + to_string(dst) + to_string(mat) + to_string(act); //to_string (pkt->get_packet_ID());
-            string_for_hash = std::to_string(get_trigger_time()) + std::to_string(src) + std::to_string(dst) ; //to_string (pkt->get_packet_ID());
-            return get_hash_value(string_for_hash);
+        static void append_text(buffer &out, std::string_view text) { append_string(out, kind::text, NO_NAME, text); }
+
+        // the record of a recv or send event; false if the packet's addition_information is only a string
+        template <typename Packet>
+        static bool append_packet(buffer &out, kind type, unsigned int time, unsigned int node_ID, const Packet &packet) {
+            if (packet.addition_label().empty() && !packet.addition_information().empty()) {
+                return false;
+            }
+            record r;
+            r.time = time;
+            r.type = type;
+            r.name = type_name(packet);
+            r.node_ID = node_ID;
+            r.packet_ID = packet.get_packet_ID();
+            r.src_ID = packet.get_header().get_src_ID();
+            r.dst_ID = packet.get_header().get_dst_ID();
+            r.pre_ID = packet.get_header().get_pre_ID();
+            r.nex_ID = packet.get_header().get_nex_ID();
+            r.label = label_name(packet);
+            r.addition = packet.addition_value();
+            out.push_back(r);
+            return true;
         }
 
-        // the AGG_ctrl_pkt_gen_event::print() function is used for log file
-        void print () const override {
-            std::cout << "time "     << std::setw(11) << event::get_cur_time()
-                << "        "       << std::setw(11) << " "
-                << "        "       << std::setw(11) << " "
-                << "   srcID"       << std::setw(11) << src
-                << "   dstID"       << std::setw(11) << dst
-                << "        "       << std::setw(11) << " "
-                << "        "       << std::setw(11) << " "
-                //  << "   matID"       << setw(11) << mat
-                //  << "   actID"       << setw(11) << act
-                << "   AGG_ctrl_packet generating"
-                << '\n';
+        // the record of a packet generating event
+        static void append_generating(buffer &out, unsigned int time, unsigned int src_ID, unsigned int dst_ID, std::uint16_t type_name) {
+            record r;
+            r.time = time;
+            r.type = kind::gen;
+            r.name = type_name;
+            r.src_ID = src_ID;
+            r.dst_ID = dst_ID;
+            out.push_back(r);
+        }
+
+        // writes the records to the ring and clears out; only one thread may write at a time
+        static void write(buffer &out) {
+            write(out.data(), out.size());
+            out.clear();
+        }
+        static void write(const record *first, std::size_t num) {
+            std::size_t name_num = written_name_num;
+            for (std::size_t i = 0; i < num; i++) {
+                if (first[i].type == kind::recv || first[i].type == kind::send || first[i].type == kind::gen) {
+                    name_num = std::max<std::size_t>(name_num, first[i].name + 1u);
+                    if (first[i].label != NO_NAME) {
+                        name_num = std::max<std::size_t>(name_num, first[i].label + 1u);
+                    }
+                }
+            }
+            if (name_num > written_name_num) {
+                buffer definitions;
+                {
+                    std::lock_guard<std::mutex> lock(names_mutex);
+                    for (std::size_t i = written_name_num; i < name_num; i++) {
+                        append_string(definitions, kind::name, static_cast<std::uint16_t>(i), names[i]);
+                    }
+                }
+                push(definitions.data(), definitions.size());
+                written_name_num = name_num;
+            }
+            push(first, num);
+        }
+
+        // prints a binary trace in the format of event::print
+        static void render(std::istream &in, std::ostream &out) {
+            char magic[sizeof(MAGIC)] = {};
+            if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), MAGIC)) {
+                throw std::runtime_error("Not a binary trace");
+            }
+            std::vector<std::string> trace_names;
+            const auto read_string = [&](const record &r) {
+                std::string text(r.node_ID, '\0');
+                for (std::size_t i = 0; i < text.size(); i += sizeof(record)) {
+                    record chunk;
+                    if (!in.read(reinterpret_cast<char *>(&chunk), sizeof(chunk))) {
+                        throw std::runtime_error("The binary trace is truncated");
+                    }
+                    std::memcpy(text.data() + i, static_cast<const void *>(&chunk), std::min(sizeof(record), text.size() - i));
+                }
+                return text;
+            };
+            const auto name_of = [&](std::uint16_t index) -> const std::string & {
+                if (index >= trace_names.size()) {
+                    throw std::runtime_error("The binary trace uses an undefined name");
+                }
+                return trace_names[index];
+            };
+            record r;
+            while (in.read(reinterpret_cast<char *>(&r), sizeof(r))) {
+                switch (r.type) {
+                    case kind::name:
+                        trace_names.resize(std::max<std::size_t>(trace_names.size(), r.name + 1u));
+                        trace_names[r.name] = read_string(r);
+                        break;
+                    case kind::text:
+                        out << read_string(r);
+                        break;
+                    case kind::recv:
+                    case kind::send:
+                        out << "time "    << std::setw(11) << r.time
+                            << (r.type == kind::recv ? "   recID" : "   senID") << std::setw(11) << r.node_ID
+                            << "   pktID"       << std::setw(11) << r.packet_ID
+                            << "   srcID"       << std::setw(11) << r.src_ID
+                            << "   dstID"       << std::setw(11) << r.dst_ID
+                            << "   preID"       << std::setw(11) << r.pre_ID
+                            << "   nexID"       << std::setw(11) << r.nex_ID
+                            << "   "            << name_of(r.name);
+                        if (r.label != NO_NAME) {
+                            out << name_of(r.label) << r.addition;
+                        }
+                        out << '\n';
+                        break;
+                    case kind::gen:
+                        out << "time "     << std::setw(11) << r.time
+                            << "        "       << std::setw(11) << " "
+                            << "        "       << std::setw(11) << " "
+                            << "   srcID"       << std::setw(11) << r.src_ID
+                            << "   dstID"       << std::setw(11) << r.dst_ID
+                            << "        "       << std::setw(11) << " "
+                            << "        "       << std::setw(11) << " "
+                            << "   "            << name_of(r.name) << " generating"
+                            << '\n';
+                        break;
+                    default:
+                        throw std::runtime_error("The binary trace has an unknown record");
+                }
+            }
+            if (in.gcount() != 0) {
+                throw std::runtime_error("The binary trace is truncated");
+            }
         }
 };
 
-class DIS_ctrl_pkt_gen_event : public event {
+// how much the engines print: nothing, a summary after every start_simulate, every event, or every event with its payload's msg
+enum class trace_level : std::uint8_t { off, summary, events, payloads };
+
+// the interface of the schedulers that store the pending events
+// every scheduler must pop the events in the order defined by event::earlier
+class event_queue {
     public:
-        class gen_data; // forward declaration
+        virtual ~event_queue() = default;
+        virtual std::string_view type() const = 0;
 
-    // this class is used to initialize the DIS_ctrl_pkt_gen_event
-        class pkt_gen_data {
+        virtual void push(std::unique_ptr<event> &&e) = 0;
+        virtual std::unique_ptr<event> pop() = 0; // returns nullptr if there is no event
+        virtual bool empty() const = 0;
+        virtual std::size_t size() const = 0;
+
+    protected:
+        DEFAULTED_SPECIAL_MEMBERS_WITHOUT_DESTRUCTOR(event_queue)
+        static void insert_sorted(std::vector<std::unique_ptr<event>> &bucket, std::unique_ptr<event> &&e);
+};
+
+class event {
+    public:
+        class logical_process; // the parallel engine; see below
+
+        static constexpr trace_level max_trace_level = static_cast<trace_level>(MAX_TRACE_LEVEL);
+
+        // the scheduler and the clock of a simulation; see simulation
+        class state {
             public:
-                unsigned int src_id = 0; // the sink
-                unsigned int dst_id = 0; // the node that should update its rule
-                // unsigned int mat_id; // the target of the rule
-                // unsigned int act_id; // the next hop toward the target recorded in the rule
-                unsigned int parent = 0;
-                std::string msg;
-                // double per; // the percentage
-                // packet *_pkt;
-    };
+                std::unique_ptr<event_queue> events;
+                unsigned int end_time = 0;
+                std::uint64_t main_created_event_num = 0; // the events created outside of the nodes' events
+                trace_level cur_trace_level = std::min(trace_level::events, max_trace_level);
+                std::uint64_t last_event_num = 0; // triggered by the last start_simulate
+
+                state(); // with a binary_heap_queue
+        };
 
     private:
-        // this constructor cannot be directly called by users; only by generator
-        unsigned int src; // the src
-        unsigned int dst; // the dst
-        // unsigned int mat;
-        // unsigned int act;
-        // packet *pkt; // the packet
-        std::string msg;
-        // double per; // percentage
-        unsigned int parent;
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("DIS_ctrl_pkt_gen_event");
-        )
-        DIS_ctrl_pkt_gen_event(unsigned int _trigger_time, const pkt_gen_data &data) : event(_trigger_time), src(data.src_id), dst(data.dst_id), msg(data.msg), parent(data.parent) {}
+        static state &current(); // of the current simulation
+        static inline thread_local unsigned int cur_time; // timer; every thread of the parallel engine has its own
 
-    public:
-        static void generate(unsigned int _trigger_time, const pkt_gen_data &data) {
-            add_event(std::unique_ptr<DIS_ctrl_pkt_gen_event>(new DIS_ctrl_pkt_gen_event(_trigger_time, data)));
+        // the node that the running event belongs to, which is the creator of the events it adds;
+        // null cur_creator_event_num stands for main_created_event_num
+        static inline thread_local unsigned int cur_creator = BROADCAST_ID;
+        static inline thread_local std::uint64_t *cur_creator_event_num = nullptr;
+        static inline thread_local logical_process *cur_lp = nullptr; // null in the sequential engine and between windows
+
+        // get the next event; the workload's events are added when their time comes
+        static std::unique_ptr<event> get_next_event();
+        static inline std::hash<std::string> event_seq;
+        unsigned int trigger_time = 0;
+        // The tie-break key is computed once by the derived class' constructor
+        // instead of being rehashed on every comparison in mycomp.
+        std::uint32_t priority = 0;
+        // The creator and the number of events the creator had created before
+        // break the remaining ties, so every scheduler pops the events in
+        // exactly the same order. Unlike a global insertion order, this doesn't
+        // depend on how the events of different nodes interleave, so the
+        // parallel engine pops them in the same order, too.
+        unsigned int creator = BROADCAST_ID;
+        std::uint64_t seq = 0;
+        std::uint64_t parent_record = UINT64_MAX; // the event that added it in a window of the parallel or batched engine; see logical_process
+        friend class workload_stream;
+        friend class benchmark;
+        friend class checkpoint;
+        friend class simulation;
+
+    protected:
+        SET(trigger_time)
+        SET(priority)
+        explicit event(unsigned int _trigger_time): trigger_time(_trigger_time) {}
+        event() = default;
+        event(const event &other) = default;
+        event(event &&other) = default;
+        event &operator=(const event &other) = default;
+        event &operator=(event &&other) = default;
+        static void add_event (std::unique_ptr<event> &&e);
+
+        // prints the event to out (an ostream or a binary_trace::buffer) at Level and triggers it on behalf of its owner
+        template <trace_level Level, typename Output>
+        void run(Output &out) {
+            cur_time = trigger_time;
+            node *owner = is_serial() ? nullptr : node::id_to_node(owner_id());
+            cur_creator = owner != nullptr ? owner->get_node_ID() : BROADCAST_ID;
+            cur_creator_event_num = owner != nullptr ? &owner->created_event_num : nullptr;
+            if constexpr (Level < trace_level::events) {
+                (void)out;
+            }
+            else if constexpr (std::is_base_of_v<std::ostream, Output>) {
+                print(out); // for log
+            }
+            else {
+                trace(out);
+            }
+            metrics::count_event(get_type_tag());
+            trigger();
+            packet_arena::end_event();
+            cur_creator = BROADCAST_ID;
+            cur_creator_event_num = nullptr;
         }
 
-        // DIS_ctrl_pkt_gen_event will trigger the packet gen function
-        void trigger() override {
-            DIS_ctrl_packet pkt;
+    public:
+        virtual void trigger()=0;
+        virtual std::string_view type() const = 0; // see TYPE_TAG
+        virtual std::uint32_t get_type_tag() const = 0;
+        virtual ~event() = default;
 
-            pkt.set_src_ID(src);
-            pkt.set_dst_ID(dst);
-            pkt.set_pre_ID(src);
-            pkt.set_nex_ID(src);
+        std::uint32_t event_priority() const { return priority; }
 
-            // payload
-            pkt.set_parent(parent);
-            pkt.set_msg(msg);
-            // pld->setMatID(mat);
-            // pld->setActID(act);
-            // pld->setPer(per);
+        /*
+        The node whose state the event reads and writes. The parallel engine
+        runs the event on the thread of that node. An event without an owner
+        (BROADCAST_ID) may touch anything, e.g. the packet generating events
+        assign new packet IDs, so it is run by the main thread in order.
+        */
+        virtual unsigned int owner_id() const { return BROADCAST_ID; }
+        bool is_serial() const { return owner_id() == BROADCAST_ID; }
 
-            recv_event::recv_data e_data;
-            e_data.s_id = src;
-            e_data.r_id = src;
-            e_data._pkt = pkt;
+        using sort_key = std::tuple<unsigned int, std::uint32_t, unsigned int, std::uint64_t>;
+        sort_key get_sort_key() const { return {trigger_time, priority, creator, seq}; }
 
-            recv_event::generate(get_trigger_time(), e_data);
+        // the order in which the events are triggered: trigger_time, then priority, then creator and creation order
+        static bool earlier(const event &lhs, const event &rhs) {
+            return lhs.get_sort_key() < rhs.get_sort_key();
         }
 
-        unsigned int event_priority() const override {
-            std::string string_for_hash;
-            // string_for_hash = to_string(get_trigger_time()) + to_string(src) + to_string(dst) + to_string(mat) + to_string(act); //to_string (pkt->get_packet_ID());
-            string_for_hash = std::to_string(get_trigger_time()) + std::to_string(src) + std::to_string(dst) ; //to_string (pkt->get_packet_ID());
-            return get_hash_value(string_for_hash);
+        // replaces the scheduler; the pending events are moved to the new one
+        static void set_scheduler(std::unique_ptr<event_queue> &&queue) {
+            while (std::unique_ptr<event> e = current().events->pop()) {
+                queue->push(std::move(e));
+            }
+            current().events = std::move(queue);
+        }
+        static event_queue &get_scheduler() { return *current().events; }
+        static unsigned int get_hash_value(const std::string &string_for_hash) {
+            size_t priority = event_seq(string_for_hash);
+            return static_cast<unsigned int>(priority);
         }
 
-        // the DIS_ctrl_pkt_gen_event::print() function is used for log file
-        void print () const override {
-            std::cout << "time "     << std::setw(11) << event::get_cur_time()
-                << "        "       << std::setw(11) << " "
-                << "        "       << std::setw(11) << " "
-                << "   srcID"       << std::setw(11) << src
-                << "   dstID"       << std::setw(11) << dst
-                << "        "       << std::setw(11) << " "
-                << "        "       << std::setw(11) << " "
-                //  << "   matID"       << setw(11) << mat
-                //  << "   actID"       << setw(11) << act
-                << "   DIS_ctrl_packet generating"
-                << '\n';
+        static void flush_events () { // only for debug
+            std::cout << "**flush begin" << '\n';
+            while (std::unique_ptr<event> e = current().events->pop()) {
+                std::cout << std::setw(11) << e->trigger_time << ": " << std::setw(11) << e->event_priority() << '\n';
+            }
+            std::cout << "**flush end" << '\n';
+        }
+
+        GET(trigger_time)
+
+    private:
+        // calls f with the current trace level as a std::integral_constant, so every level has its own code
+        // and the levels above max_trace_level are not compiled
+        template <typename Function>
+        static void with_trace_level(Function &&f) {
+            switch (current().cur_trace_level) {
+                case trace_level::off:
+                    f(std::integral_constant<trace_level, trace_level::off>{});
+                    break;
+                case trace_level::summary:
+                    if constexpr (max_trace_level >= trace_level::summary) {
+                        f(std::integral_constant<trace_level, trace_level::summary>{});
+                    }
+                    break;
+                case trace_level::events:
+                    if constexpr (max_trace_level >= trace_level::events) {
+                        f(std::integral_constant<trace_level, trace_level::events>{});
+                    }
+                    break;
+                case trace_level::payloads:
+                    if constexpr (max_trace_level >= trace_level::payloads) {
+                        f(std::integral_constant<trace_level, trace_level::payloads>{});
+                    }
+                    break;
+            }
+        }
+
+        // the summary level's line, printed after every start_simulate
+        static void print_summary(std::uint64_t event_num, unsigned int packet_num) {
+            current().last_event_num = event_num;
+            if (current().cur_trace_level != trace_level::summary) {
+                return;
+            }
+            const std::string summary = "summary: " + std::to_string(event_num) + " events triggered, " +
+                std::to_string(packet_num) + " packets generated\n";
+            if (binary_trace::is_open()) {
+                binary_trace::buffer out;
+                binary_trace::append_text(out, summary);
+                binary_trace::write(out);
+            }
+            else {
+                std::cout << summary;
+            }
+        }
+
+        template <trace_level Level>
+        static void simulate(unsigned int _end_time) {
+            state &sched = current();
+            sched.end_time = _end_time;
+            binary_trace::buffer trace_buffer;
+            std::uint64_t event_num = 0;
+            const unsigned int start_packet_ID_num = IoT_data_packet::get_packet_ID_num();
+            const auto wall_start = std::chrono::steady_clock::now();
+            std::unique_ptr<event> e = get_next_event();
+            while (e && e->trigger_time <= sched.end_time ) {
+                if ( cur_time > e->trigger_time ) {
+                    std::cerr << "cur_time = " << cur_time << ", event trigger_time = " << e->trigger_time << '\n';
+                    break;
+                    
+                }
+                metrics::sample_pending(e->trigger_time, [&] { return sched.events->size() + 1; });
+
+                // cout << "event trigger_time = " << e->trigger_time << '\n';
+                // cout << " event begin" << '\n';
+                if constexpr (Level < trace_level::events) {
+                    e->run<Level>(std::cout);
+                }
+                else if (binary_trace::is_open()) {
+                    e->run<Level>(trace_buffer);
+                    binary_trace::write(trace_buffer);
+                }
+                else {
+                    e->run<Level>(std::cout);
+                }
+                event_num++;
+                // cout << " event end" << '\n';
+                e = event::get_next_event ();
+            }
+            if (e) { // keep it for the next start_simulate
+                sched.events->push(std::move(e));
+            }
+            // cout << "no more event" << '\n';
+            print_summary(event_num, IoT_data_packet::get_packet_ID_num() - start_packet_ID_num);
+            metrics::end_run("sequential", sched.end_time, event_num, IoT_data_packet::get_packet_ID_num() - start_packet_ID_num,
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count());
+        }
+
+    public:
+        static void start_simulate( unsigned int _end_time ) { // the function is used to start the simulation
+            with_trace_level([&](auto level) { simulate<decltype(level)::value>(_end_time); });
+        }
+        // runs the simulation on thread_num threads with the same output; see logical_process
+        static void start_simulate(unsigned int _end_time, unsigned int thread_num);
+        // runs all events of a trigger_time at once, node by node (not by event type), with the same output
+        static void start_simulate_batched(unsigned int _end_time);
+
+        // the level is capped at max_trace_level; it must not be changed while a simulation runs
+        static void set_trace_level(trace_level level) { current().cur_trace_level = std::min(level, max_trace_level); }
+        static trace_level get_trace_level() { return current().cur_trace_level; }
+
+        static unsigned int get_cur_time() { return cur_time; }
+        static std::uint64_t get_last_event_num() { return current().last_event_num; }
+        static void get_cur_time(unsigned int _cur_time) { cur_time = _cur_time; }
+        // static unsigned int getEndTime() { return end_time ; }
+        // static void getEndTime(unsigned int _end_time) { end_time = _end_time; }
+
+        virtual void print(std::ostream &os) const = 0; // the function is used to print the event information
+        void print() const { print(std::cout); }
+        // the function is used to write the event to the binary trace; by default, the text that print writes
+        virtual void trace(binary_trace::buffer &out) const {
+            std::ostringstream os;
+            print(os);
+            binary_trace::append_text(out, os.view());
+        }
+
+        // writes the fields of the derived event to a checkpoint; the derived event reads them back in its static
+        // restore(trigger_time, snapshot_reader &), and checkpoint restores the fields of event
+        virtual void save(snapshot_writer &out) const = 0;
+
+        static void print_registered_event_types (); // prints event_types
+};
+bool mycomp::operator() (const std::unique_ptr<event> &lhs, const std::unique_ptr<event> &rhs) const  {
+    // cout << lhs->get_trigger_time() << ", " << rhs->get_trigger_time() << '\n';
+    // cout << lhs->type() << ", " << rhs->type() << '\n';
+    // std::priority_queue pops the largest element, so the later event is the larger one
+    bool result = event::earlier(*rhs, *lhs);
+    return result ^ reverse;
+}
+
+void event_queue::insert_sorted(std::vector<std::unique_ptr<event>> &bucket, std::unique_ptr<event> &&e) {
+    // the bucket is kept in descending order so that the earliest event can be popped from the back
+    const auto it = std::lower_bound(bucket.begin(), bucket.end(), e, [](const std::unique_ptr<event> &lhs, const std::unique_ptr<event> &rhs) {
+        return event::earlier(*rhs, *lhs);
+    });
+    bucket.insert(it, std::move(e));
+}
+
+// the default scheduler; it costs O(log n) per push and pop
+class binary_heap_queue : public event_queue {
+        std::priority_queue<std::unique_ptr<event>, std::vector<std::unique_ptr<event>>, mycomp> events;
+
+    public:
+        binary_heap_queue() = default;
+        std::string_view type() const override { return "binary_heap_queue"; }
+
+        void push(std::unique_ptr<event> &&e) override { events.push(std::move(e)); }
+        std::unique_ptr<event> pop() override {
+            if(events.empty()) {
+                return nullptr;
+            }
+            // This is safe and the only way to move a unique_ptr out of a priority_queue. The elements are never actually const.
+            std::unique_ptr<event> e = std::move(const_cast<std::unique_ptr<event> &>(events.top())); // NOLINT(cppcoreguidelines-pro-type-const-cast)
+            events.pop();
+            return e;
+        }
+        bool empty() const override { return events.empty(); }
+        std::size_t size() const override { return events.size(); }
+};
+
+/*
+Brown's calendar queue. The events are hashed by trigger_time into buckets
+like the days of a year, and pop scans the days in order starting from the
+current one. The number of buckets follows the number of events and the length
+of a day follows the gaps between the earliest trigger_times, which gives O(1)
+push and pop on average when the trigger_times are clustered near cur_time.
+*/
+class calendar_queue : public event_queue {
+        using bucket = std::vector<std::unique_ptr<event>>; // sorted so that the earliest event is at the back
+
+        std::vector<bucket> buckets = std::vector<bucket>(2); // the number of buckets is always a power of 2
+        std::uint64_t width = 1; // the length of a day
+        std::size_t cur_bucket = 0; // the bucket of the current day
+        std::uint64_t day_end = 1; // the end (exclusive) of the current day
+        std::size_t num = 0;
+
+        std::size_t bucket_of(std::uint64_t t) const { return (t / width) & (buckets.size() - 1); }
+        void move_to_day_of(std::uint64_t t) {
+            cur_bucket = bucket_of(t);
+            day_end = (t / width + 1) * width;
+        }
+        std::unique_ptr<event> take_from(bucket &b) {
+            std::unique_ptr<event> e = std::move(b.back());
+            b.pop_back();
+            num--;
+            if (buckets.size() > 2 && num < buckets.size() / 2) {
+                resize(buckets.size() / 2);
+            }
+            return e;
+        }
+
+        void resize(std::size_t bucket_num) {
+            std::vector<std::unique_ptr<event>> all;
+            all.reserve(num);
+            for (bucket &b: buckets) {
+                for (std::unique_ptr<event> &e: b) {
+                    all.push_back(std::move(e));
+                }
+            }
+            std::sort(all.begin(), all.end(), [](const std::unique_ptr<event> &lhs, const std::unique_ptr<event> &rhs) {
+                return event::earlier(*lhs, *rhs);
+            });
+
+            // a day should hold a few distinct trigger_times, so its length is
+            // estimated from the average gap between the earliest ones
+            const std::size_t SAMPLE_NUM = 25;
+            std::uint64_t gap_sum = 0;
+            std::uint64_t gap_num = 0;
+            for (std::size_t i = 1; i < all.size() && i < SAMPLE_NUM; i++) {
+                if (all[i]->get_trigger_time() != all[i - 1]->get_trigger_time()) {
+                    gap_sum += all[i]->get_trigger_time() - all[i - 1]->get_trigger_time();
+                    gap_num++;
+                }
+            }
+            width = gap_num != 0 ? std::max<std::uint64_t>(1, 3 * gap_sum / gap_num) : 1;
+            const std::uint64_t earliest_time = all.empty() ? 0 : all.front()->get_trigger_time();
+
+            buckets.clear();
+            buckets.resize(bucket_num);
+            for (auto it = all.rbegin(); it != all.rend(); it++) { // the latest first, so every bucket stays sorted
+                bucket &b = buckets[bucket_of((*it)->get_trigger_time())];
+                b.push_back(std::move(*it));
+            }
+            move_to_day_of(earliest_time);
+        }
+
+    public:
+        calendar_queue() = default;
+        std::string_view type() const override { return "calendar_queue"; }
+
+        void push(std::unique_ptr<event> &&e) override {
+            const std::uint64_t t = e->get_trigger_time();
+            if (t + width < day_end) { // the event is earlier than the current day
+                move_to_day_of(t);
+            }
+            insert_sorted(buckets[bucket_of(t)], std::move(e));
+            num++;
+            if (num > 2 * buckets.size()) {
+                resize(2 * buckets.size());
+            }
+        }
+
+        std::unique_ptr<event> pop() override {
+            if (num == 0) {
+                return nullptr;
+            }
+            for (std::size_t i = 0; i < buckets.size(); i++) {
+                bucket &b = buckets[cur_bucket];
+                if (!b.empty() && b.back()->get_trigger_time() < day_end) {
+                    return take_from(b);
+                }
+                cur_bucket = (cur_bucket + 1) & (buckets.size() - 1);
+                day_end += width;
+            }
+
+            // nothing in the whole year, so jump directly to the earliest event
+            const event *earliest = nullptr;
+            for (const bucket &b: buckets) {
+                if (!b.empty() && (earliest == nullptr || event::earlier(*b.back(), *earliest))) {
+                    earliest = b.back().get();
+                }
+            }
+            move_to_day_of(earliest->get_trigger_time());
+            return take_from(buckets[cur_bucket]);
+        }
+
+        bool empty() const override { return num == 0; }
+        std::size_t size() const override { return num; }
+};
+
+/*
+Tang, Goh and Thng's ladder queue. New events are parked unsorted in top, and
+are only split into rungs of finer and finer buckets when they get close to
+being popped. Only the bucket that is about to be popped is sorted (into
+bottom), so most events are never compared individually.
+*/
+class ladder_queue : public event_queue {
+        using bucket = std::vector<std::unique_ptr<event>>;
+
+        class rung {
+            public:
+                std::uint64_t start = 0; // the trigger_time where the first bucket begins
+                std::uint64_t width = 1;
+                std::size_t cur = 0; // the first bucket that has not been moved down
+                std::vector<bucket> buckets;
+
+                std::uint64_t cur_start() const { return start + cur * width; }
+                void put(std::unique_ptr<event> &&e) {
+                    buckets[(e->get_trigger_time() - start) / width].push_back(std::move(e));
+                }
+        };
+
+        static const std::size_t THRESHOLD = 50; // a larger bucket is split into a new rung
+        static const std::size_t MAX_RUNG_NUM = 8;
+
+        bucket top; // unsorted
+        std::uint64_t top_min = UINT64_MAX;
+        std::uint64_t top_max = 0;
+        std::uint64_t top_start = 0; // the events at or after top_start go to top
+        std::vector<rung> rungs; // from the coarsest to the finest
+        bucket bottom; // sorted so that the earliest event is at the back
+        std::size_t num = 0;
+
+        static void sort_latest_first(bucket &b) {
+            std::sort(b.begin(), b.end(), [](const std::unique_ptr<event> &lhs, const std::unique_ptr<event> &rhs) {
+                return event::earlier(*rhs, *lhs);
+            });
+        }
+
+        void drop_empty_rungs() {
+            while (!rungs.empty()) {
+                rung &r = rungs.back();
+                while (r.cur < r.buckets.size() && r.buckets[r.cur].empty()) {
+                    r.cur++;
+                }
+                if (r.cur < r.buckets.size()) {
+                    return;
+                }
+                rungs.pop_back();
+            }
+            // nothing is between bottom and top anymore
+            top_start = bottom.empty() ? 0 : bottom.front()->get_trigger_time() + 1;
+        }
+
+        void refill_bottom() {
+            for (;;) {
+                drop_empty_rungs();
+                if (rungs.empty()) {
+                    if (top_min == top_max) { // a single trigger_time cannot be split any further
+                        bottom = std::move(top);
+                        top.clear();
+                        sort_latest_first(bottom);
+                        top_min = UINT64_MAX;
+                        top_max = 0;
+                        top_start = bottom.front()->get_trigger_time() + 1;
+                        return;
+                    }
+                    rung r;
+                    r.start = top_min;
+                    r.width = (top_max - top_min) / top.size() + 1;
+                    r.buckets.resize(top.size());
+                    for (std::unique_ptr<event> &e: top) {
+                        r.put(std::move(e));
+                    }
+                    top.clear();
+                    top_start = r.start + r.buckets.size() * r.width;
+                    top_min = UINT64_MAX;
+                    top_max = 0;
+                    rungs.push_back(std::move(r));
+                    continue;
+                }
+
+                rung &r = rungs.back();
+                const std::uint64_t bucket_start = r.cur_start();
+                const std::uint64_t bucket_width = r.width;
+                bucket b = std::move(r.buckets[r.cur]);
+                r.buckets[r.cur].clear();
+                r.cur++;
+                if (b.size() > THRESHOLD && bucket_width > 1 && rungs.size() < MAX_RUNG_NUM) {
+                    rung child;
+                    child.start = bucket_start;
+                    const std::size_t bucket_num = std::min<std::uint64_t>(b.size(), bucket_width);
+                    child.width = (bucket_width + bucket_num - 1) / bucket_num;
+                    child.buckets.resize(bucket_num);
+                    for (std::unique_ptr<event> &e: b) {
+                        child.put(std::move(e));
+                    }
+                    rungs.push_back(std::move(child));
+                    continue;
+                }
+                sort_latest_first(b);
+                bottom = std::move(b);
+                drop_empty_rungs();
+                return;
+            }
+        }
+
+    public:
+        ladder_queue() = default;
+        std::string_view type() const override { return "ladder_queue"; }
+
+        void push(std::unique_ptr<event> &&e) override {
+            const std::uint64_t t = e->get_trigger_time();
+            num++;
+            if (t >= top_start) {
+                top_min = std::min(top_min, t);
+                top_max = std::max(top_max, t);
+                top.push_back(std::move(e));
+                return;
+            }
+            for (rung &r: rungs) {
+                if (t >= r.cur_start()) {
+                    r.put(std::move(e));
+                    return;
+                }
+            }
+            insert_sorted(bottom, std::move(e));
+        }
+
+        std::unique_ptr<event> pop() override {
+            if (num == 0) {
+                return nullptr;
+            }
+            if (bottom.empty()) {
+                refill_bottom();
+            }
+            std::unique_ptr<event> e = std::move(bottom.back());
+            bottom.pop_back();
+            num--;
+            return e;
+        }
+
+        bool empty() const override { return num == 0; }
+        std::size_t size() const override { return num; }
+};
+
+/*
+A bucket of events for every trigger_time. A bucket is only sorted when its
+first event is popped, so the events of a trigger_time are sorted once instead
+of being sifted through a heap one by one, which pays off when many events
+share a trigger_time, e.g. the recv_events of a flood. The batched engine takes
+whole buckets from it with pop_batch.
+*/
+class time_bucket_queue : public event_queue {
+        using bucket = std::vector<std::unique_ptr<event>>;
+
+        std::priority_queue<unsigned int, std::vector<unsigned int>, std::greater<>> times; // the trigger_times of the unsorted buckets
+        std::unordered_map<unsigned int, bucket> buckets;
+        bucket front; // the earliest bucket once it is popped from, sorted so that the earliest event is at the back
+        unsigned int front_time = 0;
+        std::size_t num = 0;
+
+        void put(std::unique_ptr<event> &&e) {
+            bucket &b = buckets[e->get_trigger_time()];
+            if (b.empty()) {
+                times.push(e->get_trigger_time());
+            }
+            b.push_back(std::move(e));
+        }
+        bucket take_earliest() {
+            const unsigned int t = times.top();
+            times.pop();
+            bucket b = std::move(buckets[t]);
+            buckets.erase(t);
+            return b;
+        }
+
+    public:
+        time_bucket_queue() = default;
+        std::string_view type() const override { return "time_bucket_queue"; }
+
+        void push(std::unique_ptr<event> &&e) override {
+            num++;
+            if (!front.empty() && e->get_trigger_time() == front_time) {
+                insert_sorted(front, std::move(e));
+                return;
+            }
+            if (!front.empty() && e->get_trigger_time() < front_time) { // the sorted bucket is no longer the earliest
+                for (std::unique_ptr<event> &f: front) {
+                    put(std::move(f));
+                }
+                front.clear();
+            }
+            put(std::move(e));
+        }
+
+        std::unique_ptr<event> pop() override {
+            if (front.empty()) {
+                if (times.empty()) {
+                    return nullptr;
+                }
+                front_time = times.top();
+                front = take_earliest();
+                std::sort(front.begin(), front.end(), [](const std::unique_ptr<event> &lhs, const std::unique_ptr<event> &rhs) {
+                    return event::earlier(*rhs, *lhs);
+                });
+            }
+            std::unique_ptr<event> e = std::move(front.back());
+            front.pop_back();
+            num--;
+            return e;
+        }
+
+        // the earliest trigger_time; UINT64_MAX if there is no event
+        std::uint64_t next_time() const {
+            if (!front.empty()) {
+                return front_time;
+            }
+            return times.empty() ? UINT64_MAX : times.top();
+        }
+
+        // all events of the earliest trigger_time in no particular order; empty if there is no event
+        bucket pop_batch() {
+            bucket b;
+            if (!front.empty()) {
+                b.swap(front);
+            }
+            else if (!times.empty()) {
+                b = take_earliest();
+            }
+            num -= b.size();
+            return b;
+        }
+
+        bool empty() const override { return num == 0; }
+        std::size_t size() const override { return num; }
+};
+
+event::state::state(): events(std::make_unique<binary_heap_queue>()) {}
+
+/*
+The parallel engine is conservative and runs in windows (YAWNS). A node only
+affects another node through a recv_event, which is triggered at least the
+minimum link latency (the lookahead) after the send, so all events in
+[T, T + lookahead), where T is the earliest pending trigger_time, can be run
+without hearing from the other nodes first.
+
+The nodes are split into logical processes by blocks of IDs, and every logical
+process is run by its own thread. In a window, a logical process runs its own
+events in order and keeps the events for the other logical processes in its
+outbox until the window ends. The events without an owner are run by the main
+thread in order before the window. Every logical process records which events
+its events added, and the printed events are merged by replaying the sequential
+engine's scheduler on them when the window ends, so the output is the same as
+the output of the sequential engine.
+
+The handlers must not create packets or change the topology, and the links must
+not be shorter than the lookahead; the engine throws if an event is scheduled
+inside the window of another logical process.
+*/
+class event::logical_process {
+    public:
+        static constexpr unsigned int BLOCK_SIZE = 64; // the number of consecutive node IDs in a block
+        static constexpr std::uint64_t NO_RECORD = UINT64_MAX;
+
+        class trace_record {
+            public:
+                sort_key key;
+                std::size_t begin = 0; // the printed event is trace[begin, end), or binary[begin, end) if the binary trace is open
+                std::size_t end = 0;
+                std::uint64_t parent = NO_RECORD; // the record of the event that added it in the window
+                bool printed = false;
+        };
+
+        std::size_t index; // also the index of this logical process in print_window's argument
+        std::size_t lp_num;
+        std::uint64_t window_end = 0;
+        event_queue *later = nullptr; // if set, the events at window_end or later are pushed to it directly
+        binary_heap_queue pending;
+        std::vector<std::unique_ptr<event>> outbox; // the events for the other logical processes and the main thread
+        std::ostringstream trace;
+        binary_trace::buffer binary;
+        std::vector<trace_record> records;
+        // the records from every sequence begin to the next are in the order of the sequential engine
+        // no begin means that all records are
+        std::vector<std::size_t> sequence_begins;
+        // the events added in the window by the events without an owner, in the order they were added, and the
+        // greatest key run by then; the sequential engine adds an event once every earlier key has been run
+        std::vector<std::pair<sort_key, std::unique_ptr<event>>> deferred;
+        std::exception_ptr error;
+
+        logical_process(std::size_t _index, std::size_t _lp_num): index(_index), lp_num(_lp_num) {}
+
+        static std::size_t index_of(unsigned int owner, std::size_t lp_num) {
+            return (owner / BLOCK_SIZE) % lp_num;
+        }
+
+        // an event that leaves the engine is no longer added by anything
+        static std::unique_ptr<event> &&released(std::unique_ptr<event> &&e) {
+            e->parent_record = NO_RECORD;
+            return std::move(e);
+        }
+
+        void add(std::unique_ptr<event> &&e) {
+            if (e->trigger_time < window_end) {
+                e->parent_record = static_cast<std::uint64_t>(index) << 32 | records.size(); // the running event is recorded next
+            }
+            else if (later != nullptr) {
+                later->push(std::move(e));
+                return;
+            }
+            if (!e->is_serial() && index_of(e->owner_id(), lp_num) == index) {
+                pending.push(std::move(e));
+            }
+            else {
+                outbox.push_back(std::move(e));
+            }
+        }
+
+        template <trace_level Level>
+        void run(event &e) {
+            if constexpr (Level < trace_level::events) { // only counted
+                e.run<Level>(trace);
+                records.push_back({e.get_sort_key(), 0, 0, e.parent_record, false});
+            }
+            else if (binary_trace::is_open()) {
+                const std::size_t begin = binary.size();
+                e.run<Level>(binary);
+                records.push_back({e.get_sort_key(), begin, binary.size(), e.parent_record, false});
+            }
+            else {
+                const std::size_t begin = static_cast<std::size_t>(trace.tellp());
+                e.run<Level>(trace);
+                records.push_back({e.get_sort_key(), begin, static_cast<std::size_t>(trace.tellp()), e.parent_record, false});
+            }
+        }
+        void run(event &e) {
+            with_trace_level([&](auto level) { run<decltype(level)::value>(e); });
+        }
+
+        /*
+        Prints the events run in the window in the order of the sequential
+        engine and clears the traces. Every sequence of records is already in
+        that order, so they are merged like the sequential engine's scheduler
+        would pop them: the next event is the earliest head of a sequence that
+        has been added, i.e. it was pending when the window began, or the event
+        that added it has been printed. Returns the number of events run.
+        */
+        static std::size_t print_window(const std::vector<logical_process *> &lps) {
+            std::size_t event_num = 0;
+            for (logical_process *lp: lps) {
+                event_num += lp->records.size();
+            }
+            const auto clear = [&] {
+                for (logical_process *lp: lps) {
+                    lp->trace.str({});
+                    lp->binary.clear();
+                    lp->records.clear();
+                    lp->sequence_begins.clear();
+                }
+            };
+            if (current().cur_trace_level < trace_level::events) { // nothing was printed
+                clear();
+                return event_num;
+            }
+
+            class sequence {
+                public:
+                    logical_process *lp;
+                    std::size_t next; // the head
+                    std::size_t end;
+            };
+            std::vector<sequence> sequences;
+            for (logical_process *lp: lps) {
+                if (lp->sequence_begins.empty()) {
+                    lp->sequence_begins.push_back(0);
+                }
+                for (std::size_t i = 0; i < lp->sequence_begins.size(); i++) {
+                    const std::size_t end = i + 1 < lp->sequence_begins.size() ? lp->sequence_begins[i + 1] : lp->records.size();
+                    if (lp->sequence_begins[i] < end) {
+                        sequences.push_back({lp, lp->sequence_begins[i], end});
+                    }
+                }
+            }
+
+            const auto record_of = [&](std::uint64_t id) -> trace_record & {
+                return lps[id >> 32]->records[id & UINT32_MAX];
+            };
+            std::priority_queue<std::pair<sort_key, std::size_t>, std::vector<std::pair<sort_key, std::size_t>>, std::greater<>> ready;
+            std::unordered_multimap<std::uint64_t, std::size_t> waiting; // the sequences whose heads wait for their parents
+            std::vector<std::size_t> children;
+            const auto offer = [&](std::size_t i) {
+                const sequence &seq = sequences[i];
+                if (seq.next == seq.end) {
+                    return;
+                }
+                const trace_record &head = seq.lp->records[seq.next];
+                if (head.parent == NO_RECORD || record_of(head.parent).printed) {
+                    ready.emplace(head.key, i);
+                }
+                else {
+                    waiting.emplace(head.parent, i);
+                }
+            };
+            for (std::size_t i = 0; i < sequences.size(); i++) {
+                offer(i);
+            }
+            while (!ready.empty()) {
+                const std::size_t i = ready.top().second;
+                ready.pop();
+                sequence &seq = sequences[i];
+                trace_record &record = seq.lp->records[seq.next];
+                if (binary_trace::is_open()) {
+                    binary_trace::write(seq.lp->binary.data() + record.begin, record.end - record.begin);
+                }
+                else {
+                    std::cout << seq.lp->trace.view().substr(record.begin, record.end - record.begin);
+                }
+                cur_time = std::get<0>(record.key);
+                record.printed = true;
+                const std::uint64_t id = static_cast<std::uint64_t>(seq.lp->index) << 32 | seq.next;
+                seq.next++;
+                offer(i);
+                if (!waiting.empty()) {
+                    const auto [first, last] = waiting.equal_range(id);
+                    children.clear();
+                    for (auto it = first; it != last; it++) {
+                        children.push_back(it->second);
+                    }
+                    waiting.erase(first, last);
+                    for (std::size_t child: children) {
+                        offer(child);
+                    }
+                }
+            }
+            clear();
+            return event_num;
+        }
+
+        // runs the pending and deferred events triggered before window_end; an exception is kept in error
+        void run_window() {
+            cur_lp = this;
+            try {
+                std::size_t next_deferred = 0;
+                while (true) {
+                    std::unique_ptr<event> e = pending.pop();
+                    if (next_deferred < deferred.size() && (!e || deferred[next_deferred].first < e->get_sort_key())) {
+                        if (e) {
+                            pending.push(std::move(e));
+                        }
+                        pending.push(std::move(deferred[next_deferred++].second));
+                        continue;
+                    }
+                    if (!e) {
+                        break;
+                    }
+                    if (e->trigger_time >= window_end) {
+                        pending.push(std::move(e));
+                        break;
+                    }
+                    run(*e);
+                }
+                deferred.clear();
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+            cur_lp = nullptr;
+        }
+};
+
+void event::add_event (std::unique_ptr<event> &&e) {
+    e->creator = cur_creator;
+    e->seq = (cur_creator_event_num != nullptr ? *cur_creator_event_num : current().main_created_event_num)++;
+    if (cur_lp != nullptr) {
+        cur_lp->add(std::move(e));
+    }
+    else {
+        current().events->push(std::move(e));
+    }
+}
+
+class recv_event : public event {
+    public:
+        class recv_data; // forward declaration
+
+    private:
+        unsigned int sender_id; // the sender
+        unsigned int receiver_id; // the receiver; the packet will be given to the receiver
+        node::SharedPacket pkt; // the packet
+        TYPE_TAG(recv_event)
+        POOL_ALLOCATED(recv_event)
+        // this constructor cannot be directly called by users; only by generator
+        // the packet will be given to the receiver
+        template <typename DeducedDataType>
+        requires std::same_as<std::remove_cvref_t<DeducedDataType>, recv_data>
+        recv_event(unsigned int _trigger_time, DeducedDataType &&data) : event(_trigger_time), sender_id(data.s_id), receiver_id(data.r_id), pkt(std::forward<DeducedDataType>(data)._pkt) {
+            set_priority(compute_priority());
+        }
+
+    public:
+        // recv_event will trigger the recv function
+        void trigger() override {
+            node *receiver = node::id_to_node(receiver_id);
+            if (!receiver){
+                std::cerr << "recv_event error: no node " << receiver_id << "!" << '\n';
+                return ;
+            }
+            receiver->recv(pkt);
+        }
+        unsigned int owner_id() const override { return receiver_id; }
+
+        unsigned int compute_priority() const {
+            std::string string_for_hash;
+            string_for_hash = std::to_string(get_trigger_time()) +
+                std::to_string(sender_id) +
+                std::to_string (receiver_id) +
+                std::to_string (std::visit(overloaded {
+                    [](auto &&packet) { return packet.get_packet_ID(); },
+                    [](std::monostate) -> unsigned { throw std::domain_error("The packet has not been assigned any specific packet type"); }
+                }, pkt.get()));
+            return get_hash_value(string_for_hash);
+        }
+
+        // pass an rvalue to move the packet into the event instead of sharing it
+        template <typename DeducedDataType>
+        requires std::same_as<std::remove_cvref_t<DeducedDataType>, recv_data>
+        static void generate(unsigned int _trigger_time, DeducedDataType &&data) {
+            add_event(std::unique_ptr<recv_event>(new recv_event(_trigger_time, std::forward<DeducedDataType>(data))));
+        }
+
+        void save(snapshot_writer &out) const override {
+            out.write(sender_id);
+            out.write(receiver_id);
+            out.write_packet(pkt);
+        }
+        static std::unique_ptr<event> restore(unsigned int _trigger_time, snapshot_reader &in) {
+            recv_data data;
+            data.s_id = in.read<unsigned int>();
+            data.r_id = in.read<unsigned int>();
+            data._pkt = in.read_packet();
+            return std::unique_ptr<event>(new recv_event(_trigger_time, std::move(data)));
+        }
+
+        // this class is used to initialize the recv_event
+        class recv_data{
+            public:
+                unsigned int s_id = 0;
+                unsigned int r_id = 0;
+                node::SharedPacket _pkt;
+        };
+
+        // the recv_event::print() function is used for log file
+        void print (std::ostream &os) const override {
+            std::visit(overloaded {
+                [&](auto &&packet) {
+                    os << "time "    << std::setw(11) << event::get_cur_time()
+                        << "   recID"       << std::setw(11) << receiver_id
+                        << "   pktID"       << std::setw(11) << packet.get_packet_ID()
+                        << "   srcID"       << std::setw(11) << packet.get_header().get_src_ID()
+                        << "   dstID"       << std::setw(11) << packet.get_header().get_dst_ID()
+                        << "   preID"       << std::setw(11) << packet.get_header().get_pre_ID()
+                        << "   nexID"       << std::setw(11) << packet.get_header().get_nex_ID()
+                        << "   "            << packet.type()
+                        << packet.addition_information();
+                    if (get_trace_level() >= trace_level::payloads) {
+                        os << "   msg"        << std::setw(11) << packet.get_payload().get_msg();
+                    }
+                },
+                [](std::monostate) {}
+            }, pkt.get());
+            //  if ( pkt->type() == "IoT_ctrl_packet" ) cout << "   " << ((IoT_ctrl_payload*)pkt->get_payload())->getCounter();
+            os << '\n';
+            // cout << pkt->type()
+            //      << "   time "       << setw(11) << event::getCurTime()
+            //      << "   recID "      << setw(11) << receiver_id
+            //      << "   pktID"       << setw(11) << pkt->get_packet_ID()
+            //      << "   srcID "      << setw(11) << pkt->get_header()->get_src_ID()
+            //      << "   dstID"       << setw(11) << pkt->get_header()->get_dst_ID()
+            //      << "   preID"       << setw(11) << pkt->get_header()->get_pre_ID()
+            //      << "   nexID"       << setw(11) << pkt->get_header()->get_nex_ID()
+            //      << '\n';
+        }
+
+        // the record of the binary trace
+        void trace (binary_trace::buffer &out) const override {
+            std::visit(overloaded {
+                [&](auto &&packet) {
+                    // a record has no room for the msg, so the payloads level is kept as text
+                    if (get_trace_level() >= trace_level::payloads || !binary_trace::append_packet(out, binary_trace::kind::recv, event::get_cur_time(), receiver_id, packet)) {
+                        event::trace(out);
+                    }
+                },
+                [&](std::monostate) { event::trace(out); }
+            }, pkt.get());
+        }
+};
+
+class send_event : public event {
+    public:
+        class send_data; // forward declaration
+
+    private:
+        // this constructor cannot be directly called by users; only by generator
+        unsigned int sender_id; // the sender
+        unsigned int receiver_id; // the receiver
+        node::SharedPacket pkt; // the packet
+        TYPE_TAG(send_event)
+        POOL_ALLOCATED(send_event)
+        template <typename DeducedDataType>
+        requires std::same_as<std::remove_cvref_t<DeducedDataType>, send_data>
+        send_event(unsigned int _trigger_time, DeducedDataType &&data) : event(_trigger_time), sender_id(data.s_id), receiver_id(data.r_id), pkt(std::forward<DeducedDataType>(data)._pkt) {
+            set_priority(compute_priority());
+        }
+
+    public:
+        // send_event will trigger the send function
+        void trigger() override {
+            node *sender = node::id_to_node(sender_id);
+            if (!sender){
+                std::cerr << "send_event error: no node " << sender_id << "!" << '\n';
+                return ;
+            }
+            sender->send(pkt);
+        }
+        unsigned int owner_id() const override { return sender_id; }
+
+        unsigned int compute_priority() const {
+            std::string string_for_hash;
+            string_for_hash = std::to_string(get_trigger_time()) +
+                std::to_string(sender_id) +
+                std::to_string (receiver_id) +
+                std::to_string (std::visit(overloaded {
+                    [](auto &&packet) { return packet.get_packet_ID(); },
+                    [](std::monostate) -> unsigned { throw std::domain_error("The packet has not been assigned any specific packet type"); }
+                }, pkt.get()));
+            return get_hash_value(string_for_hash);
+        }
+
+        // pass an rvalue to move the packet into the event instead of sharing it
+        template <typename DeducedDataType>
+        requires std::same_as<std::remove_cvref_t<DeducedDataType>, send_data>
+        static void generate(unsigned int _trigger_time, DeducedDataType &&data) {
+            add_event(std::unique_ptr<send_event>(new send_event(_trigger_time, std::forward<DeducedDataType>(data))));
+        }
+
+        void save(snapshot_writer &out) const override {
+            out.write(sender_id);
+            out.write(receiver_id);
+            out.write_packet(pkt);
+        }
+        static std::unique_ptr<event> restore(unsigned int _trigger_time, snapshot_reader &in) {
+            send_data data;
+            data.s_id = in.read<unsigned int>();
+            data.r_id = in.read<unsigned int>();
+            data._pkt = in.read_packet();
+            return std::unique_ptr<event>(new send_event(_trigger_time, std::move(data)));
+        }
+
+        // this class is used to initialize the send_event
+        class send_data{
+            public:
+                unsigned int s_id = 0;
+                unsigned int r_id = 0;
+                node::SharedPacket _pkt;
+                unsigned int t = 0;
+        };
+
+        void print (std::ostream &os) const override { // the send_event::print() function is used for log file
+            std::visit(overloaded {
+                [&](auto &&packet) {
+                    os << "time "     << std::setw(11) << event::get_cur_time()
+                        << "   senID"       << std::setw(11) << sender_id
+                        << "   pktID"       << std::setw(11) << packet.get_packet_ID()
+                        << "   srcID"       << std::setw(11) << packet.get_header().get_src_ID()
+                        << "   dstID"       << std::setw(11) << packet.get_header().get_dst_ID()
+                        << "   preID"       << std::setw(11) << packet.get_header().get_pre_ID()
+                        << "   nexID"       << std::setw(11) << packet.get_header().get_nex_ID()
+                        << "   "            << packet.type()
+                        << packet.addition_information();
+                    if (get_trace_level() >= trace_level::payloads) {
+                        os << "   msg"        << std::setw(11) << packet.get_payload().get_msg();
+                    }
+                    os << '\n';
+                },
+                [](std::monostate) {}
+            }, pkt.get());
+            
+            // cout << pkt->type()
+            //      << "   time "       << setw(11) << event::getCurTime()
+            //      << "   senID "      << setw(11) << sender_id
+            //      << "   pktID"       << setw(11) << pkt->get_packet_ID()
+            //      << "   srcID "      << setw(11) << pkt->get_header()->get_src_ID()
+            //      << "   dstID"       << setw(11) << pkt->get_header()->get_dst_ID()
+            //      << "   preID"       << setw(11) << pkt->get_header()->get_pre_ID()
+            //      << "   nexID"       << setw(11) << pkt->get_header()->get_nex_ID()
+            //      << '\n';
+        }
+
+        // the record of the binary trace
+        void trace (binary_trace::buffer &out) const override {
+            std::visit(overloaded {
+                [&](auto &&packet) {
+                    // a record has no room for the msg, so the payloads level is kept as text
+                    if (get_trace_level() >= trace_level::payloads || !binary_trace::append_packet(out, binary_trace::kind::send, event::get_cur_time(), sender_id, packet)) {
+                        event::trace(out);
+                    }
+                },
+                [&](std::monostate) { event::trace(out); }
+            }, pkt.get());
+        }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+class IoT_data_pkt_gen_event : public event {
+    public:
+        class gen_data; // forward declaration
+
+    // this class is used to initialize the IoT_data_pkt_gen_event
+        class pkt_gen_data {
+            public:
+                unsigned int src_id = 0;
+                unsigned int dst_id = 0;
+                std::string msg;
+                // packet *_pkt;
+        };
+
+    private:
+        // this constructor cannot be directly called by users; only by generator
+        unsigned int src; // the src
+        unsigned int dst; // the dst
+        // packet *pkt; // the packet
+        std::string msg;
+        TYPE_TAG(IoT_data_pkt_gen_event)
+        POOL_ALLOCATED(IoT_data_pkt_gen_event)
+        template <typename DeducedDataType>
+        requires std::same_as<std::remove_cvref_t<DeducedDataType>, pkt_gen_data>
+        IoT_data_pkt_gen_event(unsigned int _trigger_time, DeducedDataType &&data) : event(_trigger_time), src(data.src_id), dst(data.dst_id), msg(std::forward<DeducedDataType>(data).msg) {
+            set_priority(compute_priority());
+        }
+
+    public:
+        template <typename DeducedDataType>
+        requires std::same_as<std::remove_cvref_t<DeducedDataType>, pkt_gen_data>
+        static void generate(unsigned int _trigger_time, DeducedDataType &&data) {
+            add_event(std::unique_ptr<IoT_data_pkt_gen_event>(new IoT_data_pkt_gen_event(_trigger_time, std::forward<DeducedDataType>(data))));
+        }
+
+        void save(snapshot_writer &out) const override {
+            out.write(src);
+            out.write(dst);
+            out.write_string(msg);
+        }
+        static std::unique_ptr<event> restore(unsigned int _trigger_time, snapshot_reader &in) {
+            pkt_gen_data data;
+            data.src_id = in.read<unsigned int>();
+            data.dst_id = in.read<unsigned int>();
+            data.msg = in.read_string();
+            return std::unique_ptr<event>(new IoT_data_pkt_gen_event(_trigger_time, std::move(data)));
+        }
+
+        // IoT_data_pkt_gen_event will trigger the packet gen function
+        void trigger() override {
+            if (!node::id_to_node(src)){
+                std::cerr << "IoT_data_pkt_gen_event error: no node " << src << "!" << '\n';
+                return ;
+            }
+            if ( dst != BROADCAST_ID && !node::id_to_node(dst)) {
+                std::cerr << "IoT_data_pkt_gen_event error: no node " << dst << "!" << '\n';
+                return;
+            }
+
+            IoT_data_packet pkt;
+
+            pkt.set_src_ID(src);
+            pkt.set_dst_ID(dst);
+            pkt.set_pre_ID(src); // this column is not important when the packet is first received by the src (i.e., just generated)
+            pkt.set_nex_ID(src); // this column is not important when the packet is first received by the src (i.e., just generated)
+
+            pkt.set_msg(msg);
+            pkt.set_generated_time(get_trigger_time());
+
+            recv_event::recv_data e_data;
+            e_data.s_id = src;
+            e_data.r_id = src; // to make the packet start from the src
+            e_data._pkt = std::move(pkt);
+
+            recv_event::generate(get_trigger_time(), std::move(e_data));
+        }
+
+        unsigned int compute_priority() const {
+            std::string string_for_hash;
+            string_for_hash = std::to_string(get_trigger_time()) + std::to_string(src) + std::to_string (dst) ; //to_string (pkt->get_packet_ID());
+            return get_hash_value(string_for_hash);
+        }
+
+        // the IoT_data_pkt_gen_event::print() function is used for log file
+        void print (std::ostream &os) const override {
+            os << "time "     << std::setw(11) << event::get_cur_time()
+                << "        "       << std::setw(11) << " "
+                << "        "       << std::setw(11) << " "
+                << "   srcID"       << std::setw(11) << src
+                << "   dstID"       << std::setw(11) << dst
+                << "        "       << std::setw(11) << " "
+                << "        "       << std::setw(11) << " "
+                << "   IoT_data_packet generating"
+                << '\n';
+        }
+
+        // the record of the binary trace
+        void trace (binary_trace::buffer &out) const override {
+            static const std::uint16_t type = binary_trace::intern(IoT_data_packet::type_name);
+            binary_trace::append_generating(out, event::get_cur_time(), src, dst, type);
+        }
+};
+
+class IoT_ctrl_pkt_gen_event : public event {
+    public:
+        class gen_data; // forward declaration
+
+    // this class is used to initialize the IoT_ctrl_pkt_gen_event
+        class pkt_gen_data {
+            public:
+                unsigned int src_id = 0; // the sink
+                unsigned int dst_id = 0; // the node that should update its rule
+                // unsigned int mat_id; // the target of the rule
+                // unsigned int act_id; // the next hop toward the target recorded in the rule
+                std::string msg;
+                // double per; // the percentage
+                // packet *_pkt;
+    };
+
+    private:
+        // this constructor cannot be directly called by users; only by generator
+        unsigned int src; // the src
+        unsigned int dst; // the dst
+        // unsigned int mat;
+        // unsigned int act;
+        // packet *pkt; // the packet
+        std::string msg;
+        // double per; // percentage
+        TYPE_TAG(IoT_ctrl_pkt_gen_event)
+        POOL_ALLOCATED(IoT_ctrl_pkt_gen_event)
+        template <typename DeducedDataType>
+        requires std::same_as<std::remove_cvref_t<DeducedDataType>, pkt_gen_data>
+        IoT_ctrl_pkt_gen_event(unsigned int _trigger_time, DeducedDataType &&data) : event(_trigger_time), src(data.src_id), dst(data.dst_id), msg(std::forward<DeducedDataType>(data).msg) {
+            set_priority(compute_priority());
+        }
+
+    public:
+        template <typename DeducedDataType>
+        requires std::same_as<std::remove_cvref_t<DeducedDataType>, pkt_gen_data>
+        static void generate(unsigned int _trigger_time, DeducedDataType &&data) {
+            add_event(std::unique_ptr<IoT_ctrl_pkt_gen_event>(new IoT_ctrl_pkt_gen_event(_trigger_time, std::forward<DeducedDataType>(data))));
+        }
+
+        void save(snapshot_writer &out) const override {
+            out.write(src);
+            out.write(dst);
+            out.write_string(msg);
+        }
+        static std::unique_ptr<event> restore(unsigned int _trigger_time, snapshot_reader &in) {
+            pkt_gen_data data;
+            data.src_id = in.read<unsigned int>();
+            data.dst_id = in.read<unsigned int>();
+            data.msg = in.read_string();
+            return std::unique_ptr<event>(new IoT_ctrl_pkt_gen_event(_trigger_time, std::move(data)));
+        }
+
+        // IoT_ctrl_pkt_gen_event will trigger the packet gen function
+        void trigger() override {
+            route_table::add_root(src); // the flood builds the routes toward src
+            IoT_ctrl_packet pkt;
+
+            pkt.set_src_ID(src);
+            pkt.set_dst_ID(dst);
+            pkt.set_pre_ID(src);
+            pkt.set_nex_ID(src);
+
+            // payload
+            pkt.set_msg(msg);
+            // pld->setMatID(mat);
+            // pld->setActID(act);
+            // pld->setPer(per);
+
+            recv_event::recv_data e_data;
+            e_data.s_id = src;
+            e_data.r_id = src;
+            e_data._pkt = std::move(pkt);
+
+            recv_event::generate(get_trigger_time(), std::move(e_data));
+        }
+
+        unsigned int compute_priority() const {
+            std::string string_for_hash;
+            // string_for_hash = to_string(get_trigger_time()) + to_string(src) + to_string(dst) + to_string(mat) + to_string(act); //to_string (pkt->get_packet_ID());
+            string_for_hash = std::to_string(get_trigger_time()) + std::to_string(src) + std::to_string(dst) ; //to_string (pkt->get_packet_ID());
+            return get_hash_value(string_for_hash);
+        }
+
+        // the IoT_ctrl_pkt_gen_event::print() function is used for log file
+        void print (std::ostream &os) const override {
+            os << "time "     << std::setw(11) << event::get_cur_time()
+                << "        "       << std::setw(11) << " "
+                << "        "       << std::setw(11) << " "
+                << "   srcID"       << std::setw(11) << src
+                << "   dstID"       << std::setw(11) << dst
+                << "        "       << std::setw(11) << " "
+                << "        "       << std::setw(11) << " "
+                //  << "   matID"       << setw(11) << mat
+                //  << "   actID"       << setw(11) << act
+                << "   IoT_ctrl_packet generating"
+                << '\n';
+        }
+
+        // the record of the binary trace
+        void trace (binary_trace::buffer &out) const override {
+            static const std::uint16_t type = binary_trace::intern(IoT_ctrl_packet::type_name);
+            binary_trace::append_generating(out, event::get_cur_time(), src, dst, type);
+        }
+};
+
+class AGG_ctrl_pkt_gen_event : public event {
+    public:
+        class gen_data; // forward declaration
+
+    // this class is used to initialize the AGG_ctrl_pkt_gen_event
+        class pkt_gen_data {
+            public:
+                unsigned int src_id = 0; // the sink
+                unsigned int dst_id = 0; // the node that should update its rule
+                // unsigned int mat_id; // the target of the rule
+                // unsigned int act_id; // the next hop toward the target recorded in the rule
+                std::string msg;
+                // double per; // the percentage
+                // packet *_pkt;
+    };
+
+    private:
+        // this constructor cannot be directly called by users; only by generator
+        unsigned int src; // the src
+        unsigned int dst; // the dst
+        // unsigned int mat;
+        // unsigned int act;
+        // packet *pkt; // the packet
+        std::string msg;
+        // double per; // percentage
+        TYPE_TAG(AGG_ctrl_pkt_gen_event)
+        POOL_ALLOCATED(AGG_ctrl_pkt_gen_event)
+        template <typename DeducedDataType>
+        requires std::same_as<std::remove_cvref_t<DeducedDataType>, pkt_gen_data>
+        AGG_ctrl_pkt_gen_event(unsigned int _trigger_time, DeducedDataType &&data) : event(_trigger_time), src(data.src_id), dst(data.dst_id), msg(std::forward<DeducedDataType>(data).msg) {
+            set_priority(compute_priority());
+        }
+
+    public:
+        template <typename DeducedDataType>
+        requires std::same_as<std::remove_cvref_t<DeducedDataType>, pkt_gen_data>
+        static void generate(unsigned int _trigger_time, DeducedDataType &&data) {
+            add_event(std::unique_ptr<AGG_ctrl_pkt_gen_event>(new AGG_ctrl_pkt_gen_event(_trigger_time, std::forward<DeducedDataType>(data))));
+        }
+
+        void save(snapshot_writer &out) const override {
+            out.write(src);
+            out.write(dst);
+            out.write_string(msg);
+        }
+        static std::unique_ptr<event> restore(unsigned int _trigger_time, snapshot_reader &in) {
+            pkt_gen_data data;
+            data.src_id = in.read<unsigned int>();
+            data.dst_id = in.read<unsigned int>();
+            data.msg = in.read_string();
+            return std::unique_ptr<event>(new AGG_ctrl_pkt_gen_event(_trigger_time, std::move(data)));
+        }
+
+        // AGG_ctrl_pkt_gen_event will trigger the packet gen function
+        void trigger() override {
+            AGG_ctrl_packet pkt;
+            pkt.set_src_ID(src);
+            pkt.set_dst_ID(dst);
+            pkt.set_pre_ID(src);
+            pkt.set_nex_ID(src);
+
+            // payload
+            pkt.set_msg(msg);
+            // pld->setMatID(mat);
+            // pld->setActID(act);
+            // pld->setPer(per);
+
+            recv_event::recv_data e_data;
+            e_data.s_id = src;
+            e_data.r_id = src;
+            e_data._pkt = std::move(pkt);
+
+            recv_event::generate(get_trigger_time(), std::move(e_data));
+        }
+
+        unsigned int compute_priority() const {
+            std::string string_for_hash;
+            // string_for_hash = to_string(get_trigger_time()) + to_string(src) + to_string(dst) + to_string(mat) + to_string(act); //to_string (pkt->get_packet_ID());
+            string_for_hash = std::to_string(get_trigger_time()) + std::to_string(src) + std::to_string(dst) ; //to_string (pkt->get_packet_ID());
+            return get_hash_value(string_for_hash);
+        }
+
+        // the AGG_ctrl_pkt_gen_event::print() function is used for log file
+        void print (std::ostream &os) const override {
+            os << "time "     << std::setw(11) << event::get_cur_time()
+                << "        "       << std::setw(11) << " "
+                << "        "       << std::setw(11) << " "
+                << "   srcID"       << std::setw(11) << src
+                << "   dstID"       << std::setw(11) << dst
+                << "        "       << std::setw(11) << " "
+                << "        "       << std::setw(11) << " "
+                //  << "   matID"       << setw(11) << mat
+                //  << "   actID"       << setw(11) << act
+                << "   AGG_ctrl_packet generating"
+                << '\n';
+        }
+
+        // the record of the binary trace
+        void trace (binary_trace::buffer &out) const override {
+            static const std::uint16_t type = binary_trace::intern(AGG_ctrl_packet::type_name);
+            binary_trace::append_generating(out, event::get_cur_time(), src, dst, type);
+        }
+};
+
+class DIS_ctrl_pkt_gen_event : public event {
+    public:
+        class gen_data; // forward declaration
+
+    // this class is used to initialize the DIS_ctrl_pkt_gen_event
+        class pkt_gen_data {
+            public:
+                unsigned int src_id = 0; // the sink
+                unsigned int dst_id = 0; // the node that should update its rule
+                // unsigned int mat_id; // the target of the rule
+                // unsigned int act_id; // the next hop toward the target recorded in the rule
+                unsigned int parent = 0;
+                std::string msg;
+                // double per; // the percentage
+                // packet *_pkt;
+    };
+
+    private:
+        // this constructor cannot be directly called by users; only by generator
+        unsigned int src; // the src
+        unsigned int dst; // the dst
+        // unsigned int mat;
+        // unsigned int act;
+        // packet *pkt; // the packet
+        std::string msg;
+        // double per; // percentage
+        unsigned int parent;
+        TYPE_TAG(DIS_ctrl_pkt_gen_event)
+        POOL_ALLOCATED(DIS_ctrl_pkt_gen_event)
+        template <typename DeducedDataType>
+        requires std::same_as<std::remove_cvref_t<DeducedDataType>, pkt_gen_data>
+        DIS_ctrl_pkt_gen_event(unsigned int _trigger_time, DeducedDataType &&data) : event(_trigger_time), src(data.src_id), dst(data.dst_id), msg(std::forward<DeducedDataType>(data).msg), parent(data.parent) {
+            set_priority(compute_priority());
+        }
+
+    public:
+        template <typename DeducedDataType>
+        requires std::same_as<std::remove_cvref_t<DeducedDataType>, pkt_gen_data>
+        static void generate(unsigned int _trigger_time, DeducedDataType &&data) {
+            add_event(std::unique_ptr<DIS_ctrl_pkt_gen_event>(new DIS_ctrl_pkt_gen_event(_trigger_time, std::forward<DeducedDataType>(data))));
+        }
+
+        void save(snapshot_writer &out) const override {
+            out.write(src);
+            out.write(dst);
+            out.write_string(msg);
+            out.write(parent);
+        }
+        static std::unique_ptr<event> restore(unsigned int _trigger_time, snapshot_reader &in) {
+            pkt_gen_data data;
+            data.src_id = in.read<unsigned int>();
+            data.dst_id = in.read<unsigned int>();
+            data.msg = in.read_string();
+            data.parent = in.read<unsigned int>();
+            return std::unique_ptr<event>(new DIS_ctrl_pkt_gen_event(_trigger_time, std::move(data)));
+        }
+
+        // DIS_ctrl_pkt_gen_event will trigger the packet gen function
+        void trigger() override {
+            DIS_ctrl_packet pkt;
+
+            pkt.set_src_ID(src);
+            pkt.set_dst_ID(dst);
+            pkt.set_pre_ID(src);
+            pkt.set_nex_ID(src);
+
+            // payload
+            pkt.set_parent(parent);
+            pkt.set_msg(msg);
+            // pld->setMatID(mat);
+            // pld->setActID(act);
+            // pld->setPer(per);
+
+            recv_event::recv_data e_data;
+            e_data.s_id = src;
+            e_data.r_id = src;
+            e_data._pkt = std::move(pkt);
+
+            recv_event::generate(get_trigger_time(), std::move(e_data));
+        }
+
+        unsigned int compute_priority() const {
+            std::string string_for_hash;
+            // string_for_hash = to_string(get_trigger_time()) + to_string(src) + to_string(dst) + to_string(mat) + to_string(act); //to_string (pkt->get_packet_ID());
+            string_for_hash = std::to_string(get_trigger_time()) + std::to_string(src) + std::to_string(dst) ; //to_string (pkt->get_packet_ID());
+            return get_hash_value(string_for_hash);
+        }
+
+        // the DIS_ctrl_pkt_gen_event::print() function is used for log file
+        void print (std::ostream &os) const override {
+            os << "time "     << std::setw(11) << event::get_cur_time()
+                << "        "       << std::setw(11) << " "
+                << "        "       << std::setw(11) << " "
+                << "   srcID"       << std::setw(11) << src
+                << "   dstID"       << std::setw(11) << dst
+                << "        "       << std::setw(11) << " "
+                << "        "       << std::setw(11) << " "
+                //  << "   matID"       << setw(11) << mat
+                //  << "   actID"       << setw(11) << act
+                << "   DIS_ctrl_packet generating"
+                << '\n';
+        }
+
+        // the record of the binary trace
+        void trace (binary_trace::buffer &out) const override {
+            static const std::uint16_t type = binary_trace::intern(DIS_ctrl_packet::type_name);
+            binary_trace::append_generating(out, event::get_cur_time(), src, dst, type);
+        }
+};
+
+using event_types = type_list<recv_event, send_event, IoT_data_pkt_gen_event, IoT_ctrl_pkt_gen_event, AGG_ctrl_pkt_gen_event, DIS_ctrl_pkt_gen_event>;
+void event::print_registered_event_types () { event_types::print("event"); }
+
+////////////////////////////////////////////////////////////////////////////////
+
+class link {
+    public:
+        // the links of a simulation; see simulation
+        class state {
+            public:
+                // all links created in the simulation
+                // the links are grouped by id1, and every group is sorted by id2
+                id_table<std::vector<std::pair<unsigned int, std::shared_ptr<link>>>> id_id_link_table;
+                std::size_t link_num = 0;
+        };
+
+    private:
+        static state &current(); // of the current simulation
+        unsigned int id1; // from
+        unsigned int id2; // to
+        friend class benchmark;
+        friend class checkpoint;
+
+        // the first link in links whose id2 is not less than _id2
+        template <typename Links>
+        static auto find_in(Links &links, unsigned int _id2) {
+            return std::lower_bound(links.begin(), links.end(), _id2, [](const auto &entry, unsigned int id) {
+                return entry.first < id;
+            });
+        }
+
+    protected:
+        link(unsigned int _id1, unsigned int _id2): id1(_id1), id2(_id2) {
+            if(id_id_to_link(_id1, _id2) != nullptr){
+                throw std::invalid_argument("Duplicate link id");
+            }
+            if ( BROADCAST_ID == _id1 || BROADCAST_ID == _id2 ) {
+                throw std::invalid_argument("BROADCAST_ID cannot be used");
+            }
+        }
+        static void register_link(const std::shared_ptr<link> &link) {
+            state &table = current();
+            auto *links = table.id_id_link_table.find(link->id1);
+            if (links == nullptr) {
+                links = &table.id_id_link_table.insert(link->id1, {});
+            }
+            const auto it = find_in(*links, link->id2);
+            if (it != links->end() && it->first == link->id2) {
+                it->second = link;
+                return;
+            }
+            links->emplace(it, link->id2, link);
+            table.link_num++;
+            node::invalidate_frozen_topology();
+        }
+        // registers the links from _id1 at once; the group must be sorted by id2
+        static void register_links(unsigned int _id1, std::vector<std::pair<unsigned int, std::shared_ptr<link>>> &&group) {
+            if (group.empty()) {
+                return;
+            }
+            state &table = current();
+            if (table.id_id_link_table.contains(_id1)) {
+                for (const auto &entry: group) {
+                    register_link(entry.second);
+                }
+                return;
+            }
+            table.link_num += group.size();
+            table.id_id_link_table.insert(_id1, std::move(group));
+            node::invalidate_frozen_topology();
+        }
+
+    public:
+        /*
+        For the same reason as node, the special members are deleted. See node's
+        comment above its special members for more details.
+        */
+        link() = delete;
+        link(const link &other) = delete;
+        link(link &&other) = delete;
+        link &operator=(const link &other) = delete;
+        link &operator=(link &&other) = delete;
+        virtual ~link() = default;
+
+        // the table still owns the link; the returned pointer is valid until del_link
+        static link *id_id_to_link (unsigned int _id1, unsigned int _id2) {
+            const auto *links = current().id_id_link_table.find(_id1);
+            if (links == nullptr) {
+                return nullptr;
+            }
+            const auto it = find_in(*links, _id2);
+            return it != links->end() && it->first == _id2 ? it->second.get() : nullptr;
+        }
+
+    virtual double get_latency() = 0; // you must implement your own latency
+        virtual std::string_view type() const = 0; // see TYPE_TAG
+        virtual std::uint32_t get_type_tag() const = 0;
+
+        static void del_link (unsigned int _id1, unsigned int _id2) {
+            state &table = current();
+            auto *links = table.id_id_link_table.find(_id1);
+            if (links == nullptr) {
+                return;
+            }
+            const auto it = find_in(*links, _id2);
+            if (it != links->end() && it->first == _id2) {
+                links->erase(it);
+                table.link_num--;
+                node::invalidate_frozen_topology();
+                if (links->empty()) {
+                    table.id_id_link_table.erase(_id1);
+                }
+                // a phy_neighbor cannot be sent to without a link
+                if (node *n = node::id_to_node(_id1)) {
+                    n->del_phy_neighbor(_id2);
+                }
+            }
+        }
+
+        static auto get_link_num () { return current().link_num; }
+
+        // the shortest latency as node::send uses it, which is the lookahead of the parallel engine; 0 if there is no link
+        static unsigned int get_min_latency () {
+            unsigned int min_latency = UINT_MAX;
+            current().id_id_link_table.for_each([&](unsigned int, const auto &links) {
+                for (const auto &entry: links) {
+                    min_latency = std::min(min_latency, static_cast<unsigned int>(entry.second->get_latency()));
+                }
+            });
+            return current().link_num == 0 ? 0 : min_latency;
+        }
+
+        static void print (); // prints link_types
+};
+
+class simple_link: public link {
+    private:
+        TYPE_TAG(simple_link)
+        simple_link(unsigned int _id1, unsigned int _id2): link (_id1,_id2){} // this constructor cannot be directly called by users
+
+        // the storage of the links made by generate_adjacency; every one of them shares the ownership of the block
+        class block {
+            public:
+                std::unique_ptr<std::byte[]> storage;
+                std::size_t num = 0; // the links constructed in the storage
+
+                explicit block(std::size_t capacity): storage(new std::byte[capacity * sizeof(simple_link)]) {}
+                block(const block &other) = delete;
+                block &operator=(const block &other) = delete;
+                ~block() {
+                    for (std::size_t i = 0; i < num; i++) {
+                        std::launder(reinterpret_cast<simple_link *>(storage.get() + i * sizeof(simple_link)))->~simple_link();
+                    }
+                }
+        };
+
+    public:
+        static std::shared_ptr<simple_link> generate(unsigned int _id1, unsigned int _id2) {
+            std::shared_ptr<simple_link> link(new simple_link(_id1, _id2));
+            register_link(link);
+            return link;
+        }
+        /*
+        Generates the links from ids[i] to every ID in targets[offsets[i],
+        offsets[i + 1]), which must be sorted, with one allocation for all of
+        them instead of one for each. The allocation is freed when the last of
+        these links is deleted.
+        */
+        static void generate_adjacency(std::span<const unsigned int> ids, std::span<const std::uint64_t> offsets, std::span<const unsigned int> targets) {
+            const auto links = std::make_shared<block>(targets.size());
+            for (std::size_t i = 0; i < ids.size(); i++) {
+                std::vector<std::pair<unsigned int, std::shared_ptr<link>>> group;
+                group.reserve(offsets[i + 1] - offsets[i]);
+                for (std::uint64_t j = offsets[i]; j < offsets[i + 1]; j++) {
+                    auto *l = new (links->storage.get() + links->num * sizeof(simple_link)) simple_link(ids[i], targets[j]);
+                    links->num++;
+                    group.emplace_back(targets[j], std::shared_ptr<link>(links, l));
+                }
+                register_links(ids[i], std::move(group));
+            }
+        }
+        double get_latency() override { return latency(); } // you can implement your own latency
+
+        // the latency of every simple_link of the current simulation, ONE_HOP_DELAY by default
+        static void set_common_latency(unsigned int _latency) {
+            latency() = _latency;
+            node::invalidate_frozen_topology();
+        }
+        static unsigned int get_common_latency() { return latency(); }
+
+    private:
+        static unsigned int &latency(); // of the current simulation
+};
+
+static_assert(alignof(simple_link) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "the links of a simple_link::block are packed in a byte array");
+
+using link_types = type_list<simple_link>;
+void link::print () { link_types::print("link"); }
+
+void node::add_phy_neighbor (unsigned int _id){
+    if (id == _id) {
+        std::cerr << "Failed to add phy_neighbor: the two nodes are the same" << '\n';
+        return;
+    }
+    if (!current().id_node_table.contains(_id)) {
+        std::cerr << "Failed to add phy_neighbor: node " << _id << " does not exist" << '\n';
+        return;
+    }
+    if (phy_neighbors.contains(_id)) {
+        std::cerr << "Failed to add phy_neighbor: node " << _id << " has been added" << '\n';
+        return;
+    }
+    phy_neighbors.insert(_id);
+
+    simple_link::generate(id, _id);
+    invalidate_frozen_topology();
+    phy_neighbor_added(_id);
+}
+
+void node::rebuild_frozen_topology() {
+    current().frozen_adjacencies.clear();
+    current().id_node_table.for_each([](unsigned int, const std::shared_ptr<node> &n) {
+        n->adjacency_begin = current().frozen_adjacencies.size();
+        for (const auto &nb_id: n->phy_neighbors) {
+            auto *l = link::id_id_to_link(n->id, nb_id);
+            if (l == nullptr) {
+                throw std::logic_error("A phy_neighbor has no link");
+            }
+            current().frozen_adjacencies.push_back({nb_id, static_cast<unsigned int>(l->get_latency())});
+        }
+        n->adjacency_end = current().frozen_adjacencies.size();
+    });
+    current().frozen_topology_stale = false;
+}
+
+void IoT_device::phy_neighbor_added(unsigned int _id) {
+    if (!route_table::is_repair_enabled()) {
+        return;
+    }
+    // the new neighbor may be closer to a root through this device
+    routes.for_each([&](unsigned int root_id, route_table::route &r) {
+        const bool is_root = root_id == get_node_ID(); // the root has heard its own flood, but its hop count is 0
+        if (!is_root && (r.next_hop == BROADCAST_ID || r.repair_parent != BROADCAST_ID)) {
+            return;
+        }
+        route_table::count_repair(node::get_node_num() + link::get_link_num() + 2);
+        route_ctrl_packet packet;
+        packet.set_src_ID(root_id);
+        packet.set_dst_ID(_id);
+        packet.set_pre_ID(get_node_ID());
+        packet.set_nex_ID(_id);
+        packet.set_message(route_ctrl_payload::kind::advert);
+        packet.set_hop_num(is_root ? 0 : r.hop_num);
+        route_table::count_repair_event();
+        send_handler(SharedPacket(packet));
+    });
+}
+
+void IoT_device::phy_neighbor_deleted(unsigned int _id) {
+    if (!route_table::is_repair_enabled()) {
+        return;
+    }
+    // a new flood would trigger a gen event, a recv_event at the root, and a send_event at every node and a recv_event at every link
+    routes.for_each([&](unsigned int root_id, route_table::route &r) {
+        if (r.next_hop != _id || root_id == get_node_ID()) {
+            return;
+        }
+        route_table::count_repair(node::get_node_num() + link::get_link_num() + 2);
+        r.next_hop = BROADCAST_ID;
+        r.pending_reply_num = get_phy_neighbors().size();
+        if (r.pending_reply_num == 0) { // there is no other way to the root
+            return;
+        }
+        r.repair_parent = get_node_ID();
+        route_ctrl_packet packet;
+        packet.set_src_ID(root_id);
+        packet.set_dst_ID(BROADCAST_ID);
+        packet.set_pre_ID(get_node_ID());
+        packet.set_nex_ID(BROADCAST_ID);
+        packet.set_message(route_ctrl_payload::kind::query);
+        route_table::count_repair_event();
+        send_handler(SharedPacket(packet));
+    });
+}
+
+void IoT_device::recv_route_ctrl(SharedPacket &p) {
+    using kind = route_ctrl_payload::kind;
+    const auto &received = std::get<route_ctrl_packet>(p.get());
+    const unsigned int root_id = received.get_header().get_src_ID();
+    const unsigned int sender = received.get_header().get_pre_ID();
+    const kind message = received.get_payload().get_message();
+    const unsigned int advert_hop_num = received.get_payload().get_hop_num() + 1;
+    route_table::count_repair_event();
+    route_table::route *r = routes.get(root_id);
+    if (r == nullptr) {
+        return;
+    }
+    if (root_id == get_node_ID()) { // the root answers every query and tells every resolving device its hop count 0
+        if (message == kind::query || message == kind::resolve) {
+            auto &packet = std::get<route_ctrl_packet>(p.mutate());
+            packet.set_message(message == kind::query ? kind::reply : kind::advert);
+            packet.set_hop_num(0);
+            packet.set_pre_ID(get_node_ID());
+            packet.set_nex_ID(sender);
+            packet.set_dst_ID(sender);
+            route_table::count_repair_event();
+            send_handler(p);
+        }
+        return;
+    }
+    // sends the received packet on as the next message, so the repair creates no packet
+    const auto pass_on = [&](kind next, unsigned int nex_ID) {
+        auto &packet = std::get<route_ctrl_packet>(p.mutate());
+        packet.set_message(next);
+        packet.set_hop_num(r->hop_num);
+        packet.set_pre_ID(get_node_ID());
+        packet.set_nex_ID(nex_ID);
+        packet.set_dst_ID(nex_ID);
+        route_table::count_repair_event();
+        send_handler(p);
+    };
+
+    switch (message) {
+        case kind::query:
+            if (r->repair_parent == BROADCAST_ID && r->next_hop == sender) { // the route goes through the lost link, too
+                r->next_hop = BROADCAST_ID;
+                r->repair_parent = sender;
+                r->pending_reply_num = get_phy_neighbors().size();
+                pass_on(kind::query, BROADCAST_ID);
+            }
+            else {
+                pass_on(kind::reply, sender);
+            }
+            break;
+        case kind::reply:
+            if (r->repair_parent == BROADCAST_ID || r->pending_reply_num == 0 || --r->pending_reply_num > 0) {
+                break;
+            }
+            if (r->repair_parent == get_node_ID()) { // every route through the lost link has been dropped
+                r->repair_parent = BROADCAST_ID;
+                pass_on(kind::resolve, BROADCAST_ID);
+            }
+            else {
+                pass_on(kind::reply, r->repair_parent);
+            }
+            break;
+        case kind::resolve:
+            if (r->repair_parent != BROADCAST_ID) {
+                r->repair_parent = BROADCAST_ID;
+                pass_on(kind::resolve, BROADCAST_ID);
+            }
+            else if (r->next_hop != BROADCAST_ID) {
+                pass_on(kind::advert, sender);
+            }
+            break;
+        case kind::advert:
+            if (r->repair_parent == BROADCAST_ID && (r->next_hop == BROADCAST_ID || advert_hop_num < r->hop_num)) {
+                r->next_hop = sender;
+                r->hop_num = advert_hop_num;
+                pass_on(kind::advert, BROADCAST_ID);
+            }
+            break;
+    }
+}
+
+void IoT_device::recv_AGG_ctrl(SharedPacket &p) {
+    const auto &received = std::get<AGG_ctrl_packet>(p.get());
+    const unsigned int dst = received.get_header().get_dst_ID();
+    nblist_chain nblists = received.get_payload().get_nblists();
+    const bool generated = received.get_header().get_pre_ID() == get_node_ID(); // by AGG_ctrl_pkt_gen_event
+    if (generated) {
+        nblists.append(get_node_ID(), get_phy_neighbors());
+    }
+    if (dst == get_node_ID()) {
+        collected_nblists.append(nblists);
+        collected_generation++;
+        return;
+    }
+    // unicast to the next hop toward dst like an IoT_data_packet
+    route_table::route *r = routes.get(dst);
+    if (r == nullptr || r->next_hop == BROADCAST_ID) {
+        return;
+    }
+    if (AGG_merging()) {
+        r->held_nblists.append(nblists);
+        if (++r->held_report_num <= r->child_num) {
+            return;
+        }
+        // the last of them carries the lists of all
+        nblists = r->held_nblists;
+        r->held_nblists = nblist_chain();
+        r->held_report_num = 0;
+    }
+    auto &packet = std::get<AGG_ctrl_packet>(p.mutate());
+    packet.set_nblists(nblists);
+    packet.set_pre_ID(get_node_ID());
+    packet.set_nex_ID(r->next_hop);
+    send_handler(p);
+}
+
+void IoT_device::recv_DIS_ctrl(SharedPacket &p) {
+    const auto &received = std::get<DIS_ctrl_packet>(p.get());
+    const DIS_ctrl_payload &payload = received.get_payload();
+    const spanning_tree *tree = payload.get_tree();
+    if (tree == nullptr) { // the parent of dst only
+        if (received.get_header().get_dst_ID() == get_node_ID()) {
+            parent_id = payload.get_parent();
+        }
+        return;
+    }
+    // only the copy from the new parent is taken; see sink_device
+    const unsigned int sender = received.get_header().get_pre_ID();
+    const unsigned int *number = tree->find(get_node_ID());
+    if (number == nullptr || *number < payload.get_range_begin() || *number >= payload.get_range_end() || tree->get_parent(*number) != sender) {
+        return;
+    }
+    parent_id = sender;
+    const unsigned int end = tree->get_end(*number);
+    if (end == *number + 1) { // no device is under this one
+        return;
+    }
+    auto &packet = std::get<DIS_ctrl_packet>(p.mutate());
+    packet.set_tree(tree, *number + 1, end);
+    packet.set_pre_ID(get_node_ID());
+    packet.set_nex_ID(BROADCAST_ID);
+    packet.set_dst_ID(BROADCAST_ID);
+    send_handler(p);
+}
+
+void IoT_device::deliver(const IoT_data_packet &packet) {
+    const unsigned int delay = event::get_cur_time() - packet.get_payload().get_generated_time();
+    delivered_num++;
+    delay_sum += delay;
+    metrics::record_delay(delay);
+}
+
+// a read-only file mapped into memory
+class mapped_file {
+        const char *data = nullptr;
+        std::size_t size = 0;
+        std::size_t released = 0; // the bytes whose pages have been given back
+
+    public:
+        explicit mapped_file(const std::string &path) {
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::system_error(errno, std::generic_category(), "Cannot open " + path);
+            }
+            struct stat st {};
+            if (::fstat(fd, &st) != 0) {
+                const int error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::generic_category(), "Cannot read " + path);
+            }
+            size = static_cast<std::size_t>(st.st_size);
+            if (size > 0) {
+                void *p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED) {
+                    const int error = errno;
+                    ::close(fd);
+                    throw std::system_error(error, std::generic_category(), "Cannot map " + path);
+                }
+                ::madvise(p, size, MADV_SEQUENTIAL);
+                data = static_cast<const char *>(p);
+            }
+            ::close(fd); // the mapping stays valid
+        }
+        mapped_file(const mapped_file &other) = delete;
+        mapped_file &operator=(const mapped_file &other) = delete;
+        ~mapped_file() {
+            if (data != nullptr) {
+                ::munmap(const_cast<char *>(data), size); // NOLINT(cppcoreguidelines-pro-type-const-cast)
+            }
+        }
+
+        std::string_view view() const { return {data, size}; }
+
+        // gives back the pages before offset, which are not read again, so a long file doesn't stay in memory
+        void release(std::size_t offset) {
+            static const std::size_t page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+            offset = std::min(offset, size) / page_size * page_size;
+            if (offset > released) {
+                ::madvise(const_cast<char *>(data) + released, offset - released, MADV_DONTNEED); // NOLINT(cppcoreguidelines-pro-type-const-cast)
+                released = offset;
+            }
+        }
+};
+
+/*
+Loads a large topology from a file mapped into memory instead of calling
+add_phy_neighbor once for every edge. Two formats are accepted:
+
+- a text edge list: a pair of node IDs "u v" on every line, and anything after
+  them is ignored; both directions are added, as main does by hand, and the
+  lines starting with '#' or '%' are comments
+- a binary CSR file written by write_csr: every directed link is listed, and
+  the neighbors of every node are sorted
+
+The nodes that do not exist yet are generated as Node, the phy_neighbors of a
+node are filled from its sorted row at once, and all the links share one
+allocation (see simple_link::generate_adjacency). Self-loops and duplicate
+links are dropped and counted instead of printing an error for each of them.
+*/
+class topology_loader {
+        friend class topology_generator;
+        friend class checkpoint;
+
+    public:
+        class statistics {
+            public:
+                std::string path;
+                bool binary = false;
+                bool generated = false; // by topology_generator or load_edges instead of read from a file
+                std::size_t byte_num = 0;
+                std::size_t node_num = 0; // the nodes generated
+                std::size_t link_num = 0; // the links generated
+                std::size_t self_loop_num = 0;
+                std::size_t duplicate_num = 0; // the links that were already added; a repeated line of an edge list counts twice
+                double parse_seconds = 0; // mapping, parsing and sorting the file, or generating the rows
+                double build_seconds = 0; // generating the nodes and the links
+
+                void print(std::ostream &out) const {
+                    std::ostringstream line;
+                    line << std::fixed << std::setprecision(3);
+                    line << "topology: " << node_num << " nodes and " << link_num << " links from " << path;
+                    if (!generated) {
+                        line << " (" << (binary ? "binary CSR" : "edge list") << ", " << byte_num / 1e6 << " MB)";
+                    }
+                    line << " in " << parse_seconds + build_seconds << " s (" << (generated ? "generate " : "parse ") << parse_seconds
+                         << " s, build " << build_seconds << " s)";
+                    if (self_loop_num + duplicate_num > 0) {
+                        line << "; dropped " << self_loop_num << " self-loops and " << duplicate_num << " duplicate links";
+                    }
+                    out << line.str() << '\n';
+                }
+        };
+
+    private:
+        static constexpr char MAGIC[8] = {'I', 'o', 'T', 'C', 'S', 'R', '0', '1'};
+
+        // followed by the offsets of the rows (node_num + 1), the node IDs (node_num) and the neighbors (edge_num)
+        class csr_header {
+            public:
+                char magic[8] = {};
+                std::uint32_t node_num = 0;
+                std::uint32_t reserved = 0;
+                std::uint64_t edge_num = 0;
+        };
+        static_assert(std::is_trivially_copyable_v<csr_header> && sizeof(csr_header) == 24);
+
+        // the rows of the adjacency; the spans point either into the mapped file or into the vectors
+        class adjacency {
+            public:
+                std::vector<unsigned int> id_storage;
+                std::vector<std::uint64_t> offset_storage;
+                std::vector<unsigned int> target_storage;
+                std::span<const unsigned int> ids;
+                std::span<const std::uint64_t> offsets;
+                std::span<const unsigned int> targets;
+        };
+
+        static void parse_edge_list(std::string_view text, const std::string &path, adjacency &rows, statistics &stats) {
+            std::vector<std::pair<unsigned int, unsigned int>> edges; // one for each line
+            edges.reserve(text.size() / 12);
+            unsigned int max_id = 0;
+            const char *p = text.data();
+            const char *const end = p + text.size();
+            std::size_t line = 1;
+            const auto skip_blanks = [&] {
+                while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+                    p++;
+                }
+            };
+            const auto skip_line = [&] {
+                const void *newline = std::memchr(p, '\n', static_cast<std::size_t>(end - p));
+                p = newline != nullptr ? static_cast<const char *>(newline) : end;
+            };
+            while (p < end) {
+                skip_blanks();
+                if (p == end) {
+                    break;
+                }
+                if (*p == '\n') {
+                    p++;
+                    line++;
+                    continue;
+                }
+                if (*p == '#' || *p == '%') {
+                    skip_line();
+                    continue;
+                }
+                unsigned int u = 0;
+                unsigned int v = 0;
+                auto result = std::from_chars(p, end, u);
+                if (result.ec == std::errc{}) {
+                    p = result.ptr;
+                    skip_blanks();
+                    result = std::from_chars(p, end, v);
+                }
+                if (result.ec != std::errc{} || u == BROADCAST_ID || v == BROADCAST_ID) {
+                    throw std::runtime_error(path + ":" + std::to_string(line) + ": expected a pair of node IDs");
+                }
+                p = result.ptr;
+                skip_line();
+                if (u == v) {
+                    stats.self_loop_num++;
+                    continue;
+                }
+                edges.emplace_back(u, v);
+                max_id = std::max({max_id, u, v});
+            }
+            group(edges, max_id, rows, stats);
+        }
+
+        // the rows of both directions of the edges, which have no self-loops
+        static void group(const std::vector<std::pair<unsigned int, unsigned int>> &edges, unsigned int max_id, adjacency &rows, statistics &stats) {
+            if (max_id < 4 * edges.size() + 1024) {
+                group_by_counting(edges, max_id, rows);
+            }
+            else {
+                group_by_sorting(edges, rows);
+            }
+            stats.duplicate_num += 2 * edges.size() - rows.target_storage.size();
+            rows.ids = rows.id_storage;
+            rows.offsets = rows.offset_storage;
+            rows.targets = rows.target_storage;
+        }
+
+        // the rows of both directions of the edges, sorted and without duplicates; for dense IDs
+        static void group_by_counting(const std::vector<std::pair<unsigned int, unsigned int>> &edges, unsigned int max_id, adjacency &rows) {
+            std::vector<std::uint64_t> cursors(static_cast<std::size_t>(max_id) + 2, 0); // the start of every row
+            for (const auto &[u, v]: edges) {
+                cursors[u + 1]++;
+                cursors[v + 1]++;
+            }
+            for (std::size_t id = 1; id < cursors.size(); id++) {
+                cursors[id] += cursors[id - 1];
+            }
+            std::vector<unsigned int> targets(2 * edges.size());
+            for (const auto &[u, v]: edges) {
+                targets[cursors[u]++] = v;
+                targets[cursors[v]++] = u;
+            }
+            // now cursors[id] is the end of the row of id
+            rows.target_storage.reserve(targets.size());
+            std::uint64_t begin = 0;
+            for (std::size_t id = 0; id <= max_id; id++) {
+                const auto first = targets.begin() + static_cast<std::ptrdiff_t>(begin);
+                const auto last = targets.begin() + static_cast<std::ptrdiff_t>(cursors[id]);
+                begin = cursors[id];
+                if (first == last) {
+                    continue;
+                }
+                std::sort(first, last);
+                rows.id_storage.push_back(static_cast<unsigned int>(id));
+                rows.offset_storage.push_back(rows.target_storage.size());
+                std::unique_copy(first, last, std::back_inserter(rows.target_storage));
+            }
+            rows.offset_storage.push_back(rows.target_storage.size());
+        }
+
+        // the same rows as group_by_counting; for sparse IDs
+        static void group_by_sorting(const std::vector<std::pair<unsigned int, unsigned int>> &edges, adjacency &rows) {
+            std::vector<std::uint64_t> keys; // (u << 32) | v
+            keys.reserve(2 * edges.size());
+            for (const auto &[u, v]: edges) {
+                keys.push_back(std::uint64_t{u} << 32 | v);
+                keys.push_back(std::uint64_t{v} << 32 | u);
+            }
+            std::sort(keys.begin(), keys.end());
+            keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+            rows.target_storage.reserve(keys.size());
+            for (const std::uint64_t key: keys) {
+                const auto u = static_cast<unsigned int>(key >> 32);
+                if (rows.id_storage.empty() || rows.id_storage.back() != u) {
+                    rows.id_storage.push_back(u);
+                    rows.offset_storage.push_back(rows.target_storage.size());
+                }
+                rows.target_storage.push_back(static_cast<unsigned int>(key));
+            }
+            rows.offset_storage.push_back(rows.target_storage.size());
+        }
+
+        static void parse_csr(std::string_view bytes, adjacency &rows) {
+            csr_header header;
+            if (bytes.size() < sizeof(header)) {
+                throw std::runtime_error("The CSR file is truncated");
+            }
+            std::memcpy(&header, bytes.data(), sizeof(header));
+            const std::size_t node_num = header.node_num;
+            const std::size_t expected = sizeof(header) + (node_num + 1) * sizeof(std::uint64_t)
+                                         + node_num * sizeof(unsigned int) + header.edge_num * sizeof(unsigned int);
+            if (bytes.size() != expected) {
+                throw std::runtime_error("The CSR file is truncated");
+            }
+            // the mapping is page-aligned, and the header keeps the offsets 8-byte aligned
+            const char *p = bytes.data() + sizeof(header);
+            rows.offsets = {reinterpret_cast<const std::uint64_t *>(p), node_num + 1};
+            p += (node_num + 1) * sizeof(std::uint64_t);
+            rows.ids = {reinterpret_cast<const unsigned int *>(p), node_num};
+            p += node_num * sizeof(unsigned int);
+            rows.targets = {reinterpret_cast<const unsigned int *>(p), header.edge_num};
+
+            if (rows.offsets.front() != 0 || rows.offsets.back() != header.edge_num) {
+                throw std::runtime_error("The CSR file has invalid offsets");
+            }
+            for (std::size_t i = 0; i < node_num; i++) {
+                if (rows.offsets[i] > rows.offsets[i + 1] || (i > 0 && rows.ids[i - 1] >= rows.ids[i]) || rows.ids[i] == BROADCAST_ID) {
+                    throw std::runtime_error("The CSR file has invalid rows");
+                }
+                for (std::uint64_t j = rows.offsets[i]; j < rows.offsets[i + 1]; j++) {
+                    if ((j > rows.offsets[i] && rows.targets[j - 1] >= rows.targets[j]) || rows.targets[j] == rows.ids[i]) {
+                        throw std::runtime_error("The neighbors of node " + std::to_string(rows.ids[i]) + " in the CSR file are not sorted");
+                    }
+                }
+            }
+        }
+
+        static constexpr std::size_t CHUNK = 4096;
+
+        // runs work on the calling thread and on thread_num - 1 threads of the current simulation; see below
+        static void run_on_threads(std::size_t thread_num, const std::function<void()> &work);
+
+        // calls f(chunk, begin, end) for the chunks of [0, num) on thread_num threads, and rethrows the error of the first
+        // chunk that failed
+        template <typename F>
+        static void for_chunks(std::size_t num, unsigned int thread_num, F &&f) {
+            const std::size_t chunk_num = (num + CHUNK - 1) / CHUNK;
+            std::vector<std::exception_ptr> errors(chunk_num);
+            std::atomic<std::size_t> next = 0;
+            const auto work = [&] {
+                for (std::size_t chunk = next++; chunk < chunk_num; chunk = next++) {
+                    try {
+                        f(chunk, chunk * CHUNK, std::min(num, (chunk + 1) * CHUNK));
+                    }
+                    catch (...) {
+                        errors[chunk] = std::current_exception();
+                    }
+                }
+            };
+            run_on_threads(std::min<std::size_t>(thread_num, chunk_num), work);
+            for (const std::exception_ptr &error: errors) {
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+            }
+        }
+
+        template <typename Node>
+        static void build(const adjacency &rows, statistics &stats, unsigned int thread_num = 1) {
+            for (const unsigned int id: rows.ids) {
+                if (!node::current().id_node_table.contains(id)) {
+                    Node::generate(id);
+                    stats.node_num++;
+                }
+            }
+
+            // the nodes of the rows exist now, so most targets are checked without a lookup in id_node_table
+            const bool dense = !rows.ids.empty() && rows.ids.back() < 4 * rows.ids.size() + 1024;
+            std::vector<bool> is_row(dense ? static_cast<std::size_t>(rows.ids.back()) + 1 : 0);
+            for (const unsigned int id: is_row.empty() ? std::span<const unsigned int>{} : rows.ids) {
+                is_row[id] = true;
+            }
+
+            // drops the neighbors that were added before the file was loaded; every node's row is read and its phy_neighbors
+            // are filled by one thread
+            std::vector<std::uint64_t> offsets(rows.ids.size() + 1, 0); // the neighbors kept in every row, then the offsets
+            std::vector<char> kept(rows.targets.size());
+            for_chunks(rows.ids.size(), thread_num, [&](std::size_t, std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; i++) {
+                    const auto &n = *node::current().id_node_table.find(rows.ids[i]);
+                    for (std::uint64_t j = rows.offsets[i]; j < rows.offsets[i + 1]; j++) {
+                        const unsigned int target = rows.targets[j];
+                        if ((target >= is_row.size() || !is_row[target]) && !node::current().id_node_table.contains(target)) {
+                            throw std::runtime_error("The topology links node " + std::to_string(rows.ids[i]) + " to node "
+                                                     + std::to_string(target) + ", which does not exist");
+                        }
+                        kept[j] = !n->phy_neighbors.contains(target);
+                        offsets[i + 1] += kept[j] ? 1 : 0;
+                    }
+                }
+            });
+            for (std::size_t i = 1; i < offsets.size(); i++) {
+                offsets[i] += offsets[i - 1];
+            }
+            stats.duplicate_num += rows.targets.size() - offsets.back();
+            std::vector<unsigned int> targets(offsets.back());
+            for_chunks(rows.ids.size(), thread_num, [&](std::size_t, std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; i++) {
+                    const auto first = targets.begin() + static_cast<std::ptrdiff_t>(offsets[i]);
+                    auto last = first;
+                    for (std::uint64_t j = rows.offsets[i]; j < rows.offsets[i + 1]; j++) {
+                        if (kept[j]) {
+                            *last++ = rows.targets[j];
+                        }
+                    }
+                    (*node::current().id_node_table.find(rows.ids[i]))->phy_neighbors.insert(first, last); // linear for a sorted row
+                }
+            });
+
+            simple_link::generate_adjacency(rows.ids, offsets, targets);
+            stats.link_num = targets.size();
+            node::invalidate_frozen_topology();
+        }
+
+    public:
+        // generates the topology in the file; call node::freeze_topology when the setup is done
+        template <typename Node = IoT_device>
+        static statistics load(const std::string &path) {
+            using clock = std::chrono::steady_clock;
+            const auto start = clock::now();
+            statistics stats;
+            stats.path = path;
+            adjacency rows;
+            const mapped_file file(path);
+            const std::string_view bytes = file.view();
+            stats.byte_num = bytes.size();
+            stats.binary = bytes.size() >= sizeof(MAGIC) && std::memcmp(bytes.data(), MAGIC, sizeof(MAGIC)) == 0;
+            if (stats.binary) {
+                parse_csr(bytes, rows);
+            }
+            else {
+                parse_edge_list(bytes, path, rows, stats);
+            }
+            const auto parsed = clock::now();
+            build<Node>(rows, stats);
+            stats.parse_seconds = std::chrono::duration<double>(parsed - start).count();
+            stats.build_seconds = std::chrono::duration<double>(clock::now() - parsed).count();
+            return stats;
+        }
+
+        // generates the topology of the edges as if they were the lines of an edge list; name is only printed
+        template <typename Node = IoT_device>
+        static statistics load_edges(std::vector<std::pair<unsigned int, unsigned int>> edges, const std::string &name) {
+            using clock = std::chrono::steady_clock;
+            const auto start = clock::now();
+            statistics stats;
+            stats.path = name;
+            stats.generated = true;
+            stats.self_loop_num = static_cast<std::size_t>(std::erase_if(edges, [](const auto &edge) { return edge.first == edge.second; }));
+            unsigned int max_id = 0;
+            for (const auto &[u, v]: edges) {
+                if (u == BROADCAST_ID || v == BROADCAST_ID) {
+                    throw std::invalid_argument("BROADCAST_ID cannot be used");
+                }
+                max_id = std::max({max_id, u, v});
+            }
+            adjacency rows;
+            group(edges, max_id, rows, stats);
+            const auto grouped = clock::now();
+            build<Node>(rows, stats);
+            stats.parse_seconds = std::chrono::duration<double>(grouped - start).count();
+            stats.build_seconds = std::chrono::duration<double>(clock::now() - grouped).count();
+            return stats;
+        }
+
+        // generates the topology of a binary CSR in memory, e.g., one written by write_csr, whose rows are read in place;
+        // so many simulations can be built from one copy; name is only printed
+        template <typename Node = IoT_device>
+        static statistics load_csr(std::string_view bytes, const std::string &name, unsigned int thread_num = 1) {
+            using clock = std::chrono::steady_clock;
+            const auto start = clock::now();
+            statistics stats;
+            stats.path = name;
+            stats.binary = true;
+            stats.byte_num = bytes.size();
+            if (bytes.size() < sizeof(MAGIC) || std::memcmp(bytes.data(), MAGIC, sizeof(MAGIC)) != 0) {
+                throw std::runtime_error(name + " is not a binary CSR");
+            }
+            adjacency rows;
+            parse_csr(bytes, rows);
+            const auto parsed = clock::now();
+            build<Node>(rows, stats, thread_num);
+            stats.parse_seconds = std::chrono::duration<double>(parsed - start).count();
+            stats.build_seconds = std::chrono::duration<double>(clock::now() - parsed).count();
+            return stats;
+        }
+
+        // writes the current phy_neighbors of all nodes as a binary CSR file, which loads without parsing
+        static void write_csr(const std::string &path) {
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            write_csr(out);
+            if (!out) {
+                throw std::runtime_error("Cannot write the CSR file " + path);
+            }
+        }
+        static void write_csr(std::ostream &out) {
+            std::vector<std::uint64_t> offsets;
+            std::vector<unsigned int> ids;
+            std::vector<unsigned int> targets;
+            node::current().id_node_table.for_each([&](unsigned int id, const std::shared_ptr<node> &n) {
+                offsets.push_back(targets.size());
+                ids.push_back(id);
+                targets.insert(targets.end(), n->phy_neighbors.begin(), n->phy_neighbors.end());
+            });
+            offsets.push_back(targets.size());
+
+            csr_header header;
+            std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.node_num = static_cast<std::uint32_t>(ids.size());
+            header.edge_num = targets.size();
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char *>(offsets.data()), static_cast<std::streamsize>(offsets.size() * sizeof(std::uint64_t)));
+            out.write(reinterpret_cast<const char *>(ids.data()), static_cast<std::streamsize>(ids.size() * sizeof(unsigned int)));
+            out.write(reinterpret_cast<const char *>(targets.data()), static_cast<std::streamsize>(targets.size() * sizeof(unsigned int)));
+        }
+};
+
+/*
+Generates large synthetic topologies of the nodes 0 to node_num - 1:
+
+- grid: an x by y by z grid; every node is linked to the nodes next to it
+- random_geometric: a unit-disk graph of random points in a unit square; two
+  nodes are linked if they are within the radius, as two devices in range are
+- erdos_renyi: every pair of nodes is linked with the probability; a probability
+  of 1 or more gives the complete graph
+- barabasi_albert: a scale-free graph; every new node links to link_num nodes
+  chosen in proportion to their degrees
+
+The rows of the adjacency are made directly, without an edge list in between,
+and built like a loaded topology (see topology_loader): the missing nodes are
+generated as Node, every node's phy_neighbors are filled from its sorted row at
+once, and all the links share one allocation. The nodes without links are
+generated as well.
+
+The nodes are split into chunks of CHUNK nodes, and every chunk draws from its
+own random engine seeded by the seed and the chunk, so the chunks can be made
+on any number of threads and the topology depends only on the seed (and on the
+standard library's distributions). A Barabási–Albert graph grows one node at a
+time, so only its rows are sorted in parallel.
+*/
+class topology_generator {
+    public:
+        class options {
+            public:
+                std::uint64_t seed = 1;
+                unsigned int thread_num = 1;
+        };
+
+    private:
+        using statistics = topology_loader::statistics;
+        using adjacency = topology_loader::adjacency;
+
+        static constexpr std::size_t CHUNK = topology_loader::CHUNK;
+
+        template <typename F>
+        static void for_chunks(std::size_t num, unsigned int thread_num, F &&f) {
+            topology_loader::for_chunks(num, thread_num, std::forward<F>(f));
+        }
+
+        static std::mt19937_64 chunk_random(std::uint64_t seed, std::size_t chunk) {
+            std::seed_seq seq{static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32), static_cast<std::uint32_t>(chunk),
+                              static_cast<std::uint32_t>(static_cast<std::uint64_t>(chunk) >> 32)};
+            return std::mt19937_64(seq);
+        }
+
+        static void check_node_num(std::uint64_t node_num) {
+            if (node_num >= BROADCAST_ID) {
+                throw std::invalid_argument("Too many nodes; BROADCAST_ID cannot be used");
+            }
+        }
+
+        // a row for every node in [0, node_num); count(id) is the size of its row, and fill(id, row) writes it
+        // the nodes are visited in the order given, if any, e.g. so that the nodes near each other are visited together
+        template <typename Count, typename Fill>
+        static void make_rows(unsigned int node_num, unsigned int thread_num, adjacency &rows, Count &&count, Fill &&fill,
+                              std::span<const unsigned int> order = {}) {
+            rows.id_storage.resize(node_num);
+            rows.offset_storage.assign(static_cast<std::size_t>(node_num) + 1, 0);
+            for_chunks(node_num, thread_num, [&](std::size_t, std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; i++) {
+                    const unsigned int id = order.empty() ? static_cast<unsigned int>(i) : order[i];
+                    rows.id_storage[id] = id;
+                    rows.offset_storage[id + 1] = count(id);
+                }
+            });
+            for (std::size_t id = 1; id <= node_num; id++) {
+                rows.offset_storage[id] += rows.offset_storage[id - 1];
+            }
+            rows.target_storage.resize(rows.offset_storage.back());
+            for_chunks(node_num, thread_num, [&](std::size_t, std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; i++) {
+                    const unsigned int id = order.empty() ? static_cast<unsigned int>(i) : order[i];
+                    const std::span<unsigned int> row(rows.target_storage.data() + rows.offset_storage[id], rows.target_storage.data() + rows.offset_storage[id + 1]);
+                    fill(id, row);
+                    std::sort(row.begin(), row.end());
+                }
+            });
+        }
+
+        // the rows of both directions of the edges, which are neither self-loops nor repeated
+        static void make_rows(unsigned int node_num, unsigned int thread_num, const std::vector<std::pair<unsigned int, unsigned int>> &edges, adjacency &rows) {
+            std::vector<unsigned int> degrees(node_num, 0);
+            for (const auto &[u, v]: edges) {
+                degrees[u]++;
+                degrees[v]++;
+            }
+            std::vector<std::uint64_t> cursors(node_num); // filled in the order of the edges, so the rows don't depend on the threads
+            std::uint64_t offset = 0;
+            for (unsigned int id = 0; id < node_num; id++) {
+                cursors[id] = offset;
+                offset += degrees[id];
+            }
+            std::vector<unsigned int> targets(offset);
+            for (const auto &[u, v]: edges) {
+                targets[cursors[u]++] = v;
+                targets[cursors[v]++] = u;
+            }
+            make_rows(node_num, thread_num, rows, [&](unsigned int id) { return degrees[id]; }, [&](unsigned int id, std::span<unsigned int> row) {
+                std::copy_n(targets.begin() + static_cast<std::ptrdiff_t>(cursors[id] - degrees[id]), row.size(), row.begin());
+            });
+        }
+
+        template <typename Node>
+        static statistics build(std::string name, adjacency &rows, unsigned int thread_num, std::chrono::steady_clock::time_point start) {
+            statistics stats;
+            stats.path = std::move(name);
+            stats.generated = true;
+            rows.ids = rows.id_storage;
+            rows.offsets = rows.offset_storage;
+            rows.targets = rows.target_storage;
+            const auto made = std::chrono::steady_clock::now();
+            topology_loader::build<Node>(rows, stats, thread_num);
+            stats.parse_seconds = std::chrono::duration<double>(made - start).count();
+            stats.build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - made).count();
+            return stats;
+        }
+
+    public:
+        template <typename Node = IoT_device>
+        static statistics grid(unsigned int x, unsigned int y, unsigned int z = 1, const options &opt = {}) {
+            const auto start = std::chrono::steady_clock::now();
+            const std::uint64_t layer = std::uint64_t{x} * y;
+            check_node_num(layer * z);
+            const auto node_num = static_cast<unsigned int>(layer * z);
+            // the neighbors of id in ascending order
+            const auto for_neighbors = [&](unsigned int id, auto &&f) {
+                const unsigned int i = id % x;
+                const unsigned int j = static_cast<unsigned int>(id % layer) / x;
+                const auto k = static_cast<unsigned int>(id / layer);
+                if (k > 0) {
+                    f(static_cast<unsigned int>(id - layer));
+                }
+                if (j > 0) {
+                    f(id - x);
+                }
+                if (i > 0) {
+                    f(id - 1);
+                }
+                if (i + 1 < x) {
+                    f(id + 1);
+                }
+                if (j + 1 < y) {
+                    f(id + x);
+                }
+                if (k + 1 < z) {
+                    f(static_cast<unsigned int>(id + layer));
+                }
+            };
+            adjacency rows;
+            make_rows(node_num, opt.thread_num, rows, [&](unsigned int id) {
+                unsigned int degree = 0;
+                for_neighbors(id, [&](unsigned int) { degree++; });
+                return degree;
+            }, [&](unsigned int id, std::span<unsigned int> row) {
+                std::size_t i = 0;
+                for_neighbors(id, [&](unsigned int nb) { row[i++] = nb; });
+            });
+            return build<Node>("grid " + std::to_string(x) + "x" + std::to_string(y) + "x" + std::to_string(z), rows, opt.thread_num, start);
+        }
+
+        // the radius of a random geometric graph whose nodes have degree neighbors on average
+        static double radius_for_degree(unsigned int node_num, double degree) {
+            return std::sqrt(degree / (std::numbers::pi * std::max(node_num, 1U)));
+        }
+
+        template <typename Node = IoT_device>
+        static statistics random_geometric(unsigned int node_num, double radius, const options &opt = {}) {
+            const auto start = std::chrono::steady_clock::now();
+            check_node_num(node_num);
+            std::vector<std::pair<double, double>> points(node_num);
+            for_chunks(node_num, opt.thread_num, [&](std::size_t chunk, std::size_t begin, std::size_t end) {
+                std::mt19937_64 random = chunk_random(opt.seed, chunk);
+                std::uniform_real_distribution<double> coordinate(0, 1);
+                for (std::size_t id = begin; id < end; id++) {
+                    points[id].first = coordinate(random);
+                    points[id].second = coordinate(random);
+                }
+            });
+
+            // the points by square cells at least as wide as the radius, so a node's neighbors are in the 3 x 3 cells around it
+            const double max_side = std::min(radius > 0 ? 1 / radius : 1.0, std::sqrt(4.0 * node_num) + 1);
+            const auto side = static_cast<unsigned int>(std::max(1.0, std::floor(max_side)));
+            const auto cell_of = [&](double coordinate) { return std::min(side - 1, static_cast<unsigned int>(coordinate * side)); };
+            std::vector<unsigned int> cells(static_cast<std::size_t>(side) * side + 1, 0); // the start of every cell
+            for (const auto &[x, y]: points) {
+                cells[cell_of(y) * side + cell_of(x) + 1]++;
+            }
+            for (std::size_t cell = 1; cell < cells.size(); cell++) {
+                cells[cell] += cells[cell - 1];
+            }
+            // the points in the order of the cells, so the 3 cells next to each other in a row are read at once
+            class cell_point {
+                public:
+                    double x = 0;
+                    double y = 0;
+                    unsigned int id = 0;
+            };
+            std::vector<cell_point> cell_points(node_num);
+            std::vector<unsigned int> order(node_num); // the IDs of cell_points
+            std::vector<unsigned int> cursors(cells.begin(), cells.end() - 1);
+            for (unsigned int id = 0; id < node_num; id++) {
+                const auto [x, y] = points[id];
+                const unsigned int i = cursors[cell_of(y) * side + cell_of(x)]++;
+                cell_points[i] = {x, y, id};
+                order[i] = id;
+            }
+            const auto for_neighbors = [&](unsigned int id, auto &&f) {
+                const auto [x, y] = points[id];
+                const unsigned int cx = cell_of(x);
+                const unsigned int cy = cell_of(y);
+                const unsigned int first_x = cx > 0 ? cx - 1 : 0;
+                const unsigned int last_x = std::min(cx + 1, side - 1);
+                for (unsigned int ny = cy > 0 ? cy - 1 : 0; ny <= std::min(cy + 1, side - 1); ny++) {
+                    for (unsigned int i = cells[ny * side + first_x]; i < cells[ny * side + last_x + 1]; i++) {
+                        const cell_point &other = cell_points[i];
+                        const double dx = other.x - x;
+                        const double dy = other.y - y;
+                        if (other.id != id && dx * dx + dy * dy <= radius * radius) {
+                            f(other.id);
+                        }
+                    }
+                }
+            };
+
+            adjacency rows;
+            make_rows(node_num, opt.thread_num, rows, [&](unsigned int id) {
+                unsigned int degree = 0;
+                for_neighbors(id, [&](unsigned int) { degree++; });
+                return degree;
+            }, [&](unsigned int id, std::span<unsigned int> row) {
+                std::size_t i = 0;
+                for_neighbors(id, [&](unsigned int nb) { row[i++] = nb; });
+            }, order);
+            std::ostringstream name;
+            name << "random geometric graph of " << node_num << " nodes with radius " << radius;
+            return build<Node>(name.str(), rows, opt.thread_num, start);
+        }
+
+        template <typename Node = IoT_device>
+        static statistics erdos_renyi(unsigned int node_num, double probability, const options &opt = {}) {
+            const auto start = std::chrono::steady_clock::now();
+            check_node_num(node_num);
+            // every chunk links its nodes to the larger IDs, skipping a geometric number of pairs between two links
+            std::vector<std::vector<std::pair<unsigned int, unsigned int>>> chunk_edges((node_num + CHUNK - 1) / CHUNK);
+            if (probability > 0) {
+                for_chunks(node_num, opt.thread_num, [&](std::size_t chunk, std::size_t begin, std::size_t end) {
+                    auto &edges = chunk_edges[chunk];
+                    if (probability >= 1) { // the complete graph; a geometric_distribution needs a probability below 1
+                        for (std::size_t u = begin; u < end; u++) {
+                            for (std::size_t v = u + 1; v < node_num; v++) {
+                                edges.emplace_back(static_cast<unsigned int>(u), static_cast<unsigned int>(v));
+                            }
+                        }
+                        return;
+                    }
+                    std::mt19937_64 random = chunk_random(opt.seed, chunk);
+                    std::geometric_distribution<std::uint64_t> skip(probability);
+                    for (std::size_t u = begin; u < end; u++) {
+                        for (std::uint64_t v = u + 1 + skip(random); v < node_num; v += 1 + skip(random)) {
+                            edges.emplace_back(static_cast<unsigned int>(u), static_cast<unsigned int>(v));
+                        }
+                    }
+                });
+            }
+            std::vector<std::pair<unsigned int, unsigned int>> edges;
+            for (auto &chunk: chunk_edges) {
+                edges.insert(edges.end(), chunk.begin(), chunk.end());
+                chunk = {};
+            }
+            adjacency rows;
+            make_rows(node_num, opt.thread_num, edges, rows);
+            std::ostringstream name;
+            name << "Erdos-Renyi graph of " << node_num << " nodes with probability " << probability;
+            return build<Node>(name.str(), rows, opt.thread_num, start);
+        }
+
+        // starts from a clique of link_num + 1 nodes
+        template <typename Node = IoT_device>
+        static statistics barabasi_albert(unsigned int node_num, unsigned int link_num, const options &opt = {}) {
+            const auto start = std::chrono::steady_clock::now();
+            check_node_num(node_num);
+            std::mt19937_64 random = chunk_random(opt.seed, 0);
+            std::vector<std::pair<unsigned int, unsigned int>> edges;
+            edges.reserve(static_cast<std::size_t>(node_num) * link_num);
+            std::vector<unsigned int> ends; // every node once for each of its links
+            ends.reserve(2 * static_cast<std::size_t>(node_num) * link_num);
+            const auto add = [&](unsigned int u, unsigned int v) {
+                edges.emplace_back(u, v);
+                ends.push_back(u);
+                ends.push_back(v);
+            };
+            for (unsigned int u = 0; u <= link_num && u < node_num; u++) {
+                for (unsigned int v = u + 1; v <= link_num && v < node_num; v++) {
+                    add(u, v);
+                }
+            }
+            std::vector<unsigned int> targets;
+            for (unsigned int id = link_num + 1; id < node_num; id++) {
+                targets.clear();
+                while (targets.size() < link_num) {
+                    const unsigned int target = ends[std::uniform_int_distribution<std::size_t>(0, ends.size() - 1)(random)];
+                    if (std::find(targets.begin(), targets.end(), target) == targets.end()) {
+                        targets.push_back(target);
+                    }
+                }
+                for (const unsigned int target: targets) {
+                    add(id, target);
+                }
+            }
+            ends = {};
+            adjacency rows;
+            make_rows(node_num, opt.thread_num, edges, rows);
+            return build<Node>("Barabasi-Albert graph of " + std::to_string(node_num) + " nodes with " + std::to_string(link_num) + " links per node", rows, opt.thread_num, start);
+        }
+};
+
+// the IoT_data_packet_event function is used to add an initial event
+void IoT_data_packet_event(unsigned int src, unsigned int dst = 0, unsigned int t = 0, const std::string &msg = "default") {
+    if (!node::id_to_node(src)) {
+        std::cerr << "src " << src << ": no such node registered\n";
+        return;
+    }
+    if (dst != BROADCAST_ID && !node::id_to_node(dst)) {
+        std::cerr << "dst " << dst << ": no such node registered\n";
+        return;
+    }
+
+    IoT_data_pkt_gen_event::pkt_gen_data e_data;
+    e_data.src_id = src;
+    e_data.dst_id = dst;
+    e_data.msg = msg;
+
+    // recv_event *e = dynamic_cast<recv_event*> ( event::generator::generate("recv_event",t, (void *)&e_data) );
+    IoT_data_pkt_gen_event::generate(t, std::move(e_data));
+}
+
+// the IoT_ctrl_packet_event function is used to add an initial event
+
+void IoT_ctrl_packet_event(unsigned int src = 0, unsigned int t = event::get_cur_time(), const std::string &msg = "default") {
+    // 1st parameter: the source; the destination that want to broadcast a msg with counter 0 (i.e., match ID)
+    // 2nd parameter: time (optional)
+    // 3rd parameter: msg (optional)
+    if (!node::id_to_node(src)) {
+        std::cerr << "src " << src << ": no such node registered\n";
+        return;
+    }
+
+    // unsigned int src = con_id;
+    IoT_ctrl_pkt_gen_event::pkt_gen_data e_data;
+    e_data.src_id = src;
+    e_data.dst_id = BROADCAST_ID;
+    // e_data.mat_id = mat;
+    // e_data.act_id = act;
+    e_data.msg = msg;
+    // e_data.per = per;
+
+    IoT_ctrl_pkt_gen_event::generate(t, std::move(e_data));
+}
+
+// the AGG_ctrl_packet_event function is used to add an initial event
+void AGG_ctrl_packet_event(unsigned int src, unsigned int dst = 0, unsigned int t = event::get_cur_time(), const std::string &msg = "default") {
+    if (!node::id_to_node(src)) {
+        std::cerr << "src " << src << ": no such node registered\n";
+        return;
+    }
+    if (dst != BROADCAST_ID && !node::id_to_node(dst)) {
+        std::cerr << "dst " << dst << ": no such node registered\n";
+        return;
+    }
+
+    AGG_ctrl_pkt_gen_event::pkt_gen_data e_data;
+    e_data.src_id = src;
+    e_data.dst_id = dst;
+    e_data.msg = msg;
+
+    // recv_event *e = dynamic_cast<recv_event*> ( event::generator::generate("recv_event",t, (void *)&e_data) );
+    AGG_ctrl_pkt_gen_event::generate(t, std::move(e_data));
+}
+
+// the DIS_ctrl_packet_event function is used to add an initial event
+void DIS_ctrl_packet_event(unsigned int sink_id = 0, unsigned int t = event::get_cur_time(), const std::string &msg = "default") {
+    if (!node::id_to_node(sink_id)) {
+        std::cerr << "sink_id or id is incorrect" << '\n';
+        return;
+    }
+
+    DIS_ctrl_pkt_gen_event::pkt_gen_data e_data;
+    e_data.src_id = sink_id;
+    e_data.dst_id = sink_id;
+    e_data.parent = sink_id;
+    e_data.msg = msg;
+
+    // recv_event *e = dynamic_cast<recv_event*> ( event::generator::generate("recv_event",t, (void *)&e_data) );
+    DIS_ctrl_pkt_gen_event::generate(t, std::move(e_data));
+}
+
+/*
+Streams the packet generating events of a workload file into the engines
+instead of adding all of them before the simulation. Every line is
+
+    <time> <type> <node ID> [<destination ID>] [<msg>]
+
+where type is IoT_data or AGG_ctrl, which take a destination, or IoT_ctrl or
+DIS_ctrl, which don't, and msg is the rest of the line ("default" if there is
+none). The lines must be sorted by time; blank lines and the lines starting
+with '#' are skipped. The file is mapped into memory and a line is read only
+when the simulation reaches its time, so the pending events hold just the near
+future, and the pages that have been read are given back.
+
+The events are added as if the generating functions had been called in the
+order of the file when the workload was opened: the seq of an event is the
+offset of its line after the seq of the events created before, so the output
+is the same as calling them up front.
+*/
+class workload_stream {
+    public:
+        // the open workload of a simulation; see simulation
+        class state {
+            public:
+                std::unique_ptr<mapped_file> file;
+                std::string path;
+                std::size_t line_begin = 0; // the offset of the next line
+                std::size_t position = 0; // the offset after the time of the next line
+                std::size_t line = 0; // the number of the next line
+                std::uint64_t next = UINT64_MAX; // the time of the next line
+                std::uint64_t seq_base = 0; // the seq of an event whose line begins at offset 0
+        };
+
+    private:
+        static state &current(); // of the current simulation
+
+        static constexpr std::size_t RELEASE_SIZE = std::size_t{64} << 20; // the pages are given back in steps of this many bytes
+        friend class checkpoint;
+
+        [[noreturn]] static void fail(const std::string &message) {
+            throw std::runtime_error(current().path + ":" + std::to_string(current().line) + ": " + message);
+        }
+
+        static void skip_blanks(const char *&p, const char *end) {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+                p++;
+            }
+        }
+
+        static std::string_view read_word(const char *&p, const char *end) {
+            skip_blanks(p, end);
+            const char *const begin = p;
+            while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+                p++;
+            }
+            return {begin, static_cast<std::size_t>(p - begin)};
+        }
+
+        static unsigned int read_ID(const char *&p, const char *end) {
+            skip_blanks(p, end);
+            unsigned int id = 0;
+            const auto result = std::from_chars(p, end, id);
+            if (result.ec != std::errc{}) {
+                fail("expected a node ID");
+            }
+            p = result.ptr;
+            return id;
+        }
+
+        // skips the blank lines and the comments, and reads the time of the next line
+        static void read_next_time() {
+            state &stream = current();
+            const std::string_view text = stream.file->view();
+            const char *p = text.data() + stream.position;
+            const char *const end = text.data() + text.size();
+            while (true) {
+                skip_blanks(p, end);
+                if (p == end) {
+                    stream.next = UINT64_MAX;
+                    return;
+                }
+                if (*p == '\n') {
+                    p++;
+                    stream.line++;
+                    continue;
+                }
+                if (*p == '#') {
+                    const void *newline = std::memchr(p, '\n', static_cast<std::size_t>(end - p));
+                    p = newline != nullptr ? static_cast<const char *>(newline) : end;
+                    continue;
+                }
+                break;
+            }
+            stream.line_begin = static_cast<std::size_t>(p - text.data());
+            unsigned int time = 0;
+            const auto result = std::from_chars(p, end, time);
+            if (result.ec != std::errc{}) {
+                fail("expected a time");
+            }
+            if (stream.next != UINT64_MAX && time < stream.next) {
+                fail("the lines are not sorted by time");
+            }
+            stream.next = time;
+            stream.position = static_cast<std::size_t>(result.ptr - text.data());
+        }
+
+        // adds the event of the next line, whose time has been read
+        static void generate_line() {
+            state &stream = current();
+            const std::string_view text = stream.file->view();
+            const char *p = text.data() + stream.position;
+            const char *const end = text.data() + text.size();
+            const auto t = static_cast<unsigned int>(stream.next);
+            const std::string_view type = read_word(p, end);
+            const unsigned int id = read_ID(p, end);
+            const bool has_dst = type == "IoT_data" || type == "AGG_ctrl";
+            const unsigned int dst = has_dst ? read_ID(p, end) : 0;
+            skip_blanks(p, end);
+            const void *newline = std::memchr(p, '\n', static_cast<std::size_t>(end - p));
+            const char *const line_end = newline != nullptr ? static_cast<const char *>(newline) : end;
+            std::string_view msg(p, static_cast<std::size_t>(line_end - p));
+            while (!msg.empty() && (msg.back() == ' ' || msg.back() == '\t' || msg.back() == '\r')) {
+                msg.remove_suffix(1);
+            }
+            const std::string msg_string = msg.empty() ? std::string("default") : std::string(msg);
+
+            std::uint64_t seq = stream.seq_base + stream.line_begin;
+            event::cur_creator_event_num = &seq;
+            try {
+                if (type == "IoT_data") {
+                    IoT_data_packet_event(id, dst, t, msg_string);
+                }
+                else if (type == "IoT_ctrl") {
+                    IoT_ctrl_packet_event(id, t, msg_string);
+                }
+                else if (type == "AGG_ctrl") {
+                    AGG_ctrl_packet_event(id, dst, t, msg_string);
+                }
+                else if (type == "DIS_ctrl") {
+                    DIS_ctrl_packet_event(id, t, msg_string);
+                }
+                else {
+                    fail("unknown type " + std::string(type));
+                }
+            }
+            catch (...) {
+                event::cur_creator_event_num = nullptr;
+                throw;
+            }
+            event::cur_creator_event_num = nullptr;
+
+            stream.position = static_cast<std::size_t>(line_end - text.data());
+        }
+
+    public:
+        // the workload must not be opened or closed while a simulation runs
+        static void open(const std::string &_path) {
+            state &stream = current();
+            if (stream.file) {
+                throw std::logic_error("The workload is already open");
+            }
+            stream.file = std::make_unique<mapped_file>(_path);
+            stream.path = _path;
+            stream.line_begin = stream.position = 0;
+            stream.line = 1;
+            stream.next = UINT64_MAX;
+            // the seqs of the events of the lines are reserved, so the events created later come after them
+            stream.seq_base = event::current().main_created_event_num;
+            event::current().main_created_event_num += stream.file->view().size();
+            try {
+                read_next_time();
+            }
+            catch (...) {
+                close();
+                throw;
+            }
+        }
+        // the lines that have not been reached are dropped
+        static void close() {
+            state &stream = current();
+            stream.file.reset();
+            stream.next = UINT64_MAX;
+        }
+        static bool is_open() { return current().file != nullptr; }
+
+        // the time of the next line; UINT64_MAX if there is none
+        static std::uint64_t next_time() { return current().next; }
+
+        // adds the events of all lines of next_time(); called by the engines when the simulation reaches it
+        static void generate_next() {
+            state &stream = current();
+            const std::uint64_t time = stream.next;
+            while (stream.next == time) {
+                generate_line();
+                read_next_time();
+            }
+            stream.file->release(stream.position / RELEASE_SIZE * RELEASE_SIZE);
+        }
+};
+
+/*
+The state of one simulation: its nodes, links, routes, pending events, clock,
+workload and settings. The classes keep their part of it in their own state
+class and reach it through current(), which is the simulation of the calling
+thread. That is main_simulation until a scope enters another one, so many
+independent simulations can be built and run at the same time, each on its own
+thread, e.g.
+
+    std::jthread worker([] {
+        simulation sim;
+        const simulation::scope in(sim);
+        const event_pool::slot_lease slot;
+        event::set_trace_level(trace_level::off);
+        ... // generate the nodes and the links, and add the events
+        event::start_simulate(end_time);
+    });
+
+The threads that the engines, topology_loader and topology_generator start work
+on the simulation that started them (see attach).
+
+What is not in a simulation is shared by all of them. The msgs of the packets
+(see packet_msg), the parts of the nblists (see nblist_chain) and the event
+pools are safe to share, as long as every thread that runs a simulation leases
+a slot of the pools. The metrics and the binary_trace are not, so they must be
+closed while simulations run at the same time, and the traces of the
+simulations whose level is above off interleave on std::cout.
+*/
+class simulation {
+#ifndef NDEBUG
+        std::atomic<unsigned int> live_packet_num = 0; // first, so it outlives the packets of the other members
+#endif
+        node::state nodes;
+        link::state links;
+        route_table::state routes;
+        event::state events;
+        workload_stream::state workload;
+        std::atomic<unsigned int> last_packet_id = 0;
+        bool AGG_merging = false;
+        unsigned int simple_link_latency = ONE_HOP_DELAY;
+        unsigned int time = 0; // event::cur_time while no thread is in a scope of the simulation
+
+        static simulation main_simulation; // of the threads that haven't entered another one
+        static inline thread_local simulation *current_simulation = &main_simulation;
+
+        friend class node;
+        friend class link;
+        friend class route_table;
+        friend class event;
+        friend class workload_stream;
+        friend class packet_derived_classes_common_fields_holder;
+        friend class IoT_device;
+        friend class simple_link;
+
+    public:
+        simulation() = default;
+        simulation(const simulation &other) = delete;
+        simulation(simulation &&other) = delete;
+        simulation &operator=(const simulation &other) = delete;
+        simulation &operator=(simulation &&other) = delete;
+        ~simulation() = default;
+
+        static simulation &current() { return *current_simulation; }
+
+        // makes sim the current simulation of the calling thread, with its clock, until the scope ends
+        class scope {
+                simulation *previous = current_simulation;
+                unsigned int previous_time = event::get_cur_time();
+                simulation &sim;
+
+            public:
+                explicit scope(simulation &_sim): sim(_sim) {
+                    current_simulation = &sim;
+                    event::cur_time = sim.time;
+                }
+                scope(const scope &other) = delete;
+                scope(scope &&other) = delete;
+                scope &operator=(const scope &other) = delete;
+                scope &operator=(scope &&other) = delete;
+                ~scope() {
+                    sim.time = event::cur_time;
+                    current_simulation = previous;
+                    event::cur_time = previous_time;
+                }
+        };
+
+        // makes sim the current simulation of a thread that works for a thread in its scope until the thread ends
+        static void attach(simulation &sim) { current_simulation = &sim; }
+};
+
+simulation simulation::main_simulation;
+
+node::state &node::current() { return simulation::current().nodes; }
+link::state &link::current() { return simulation::current().links; }
+route_table::state &route_table::current() { return simulation::current().routes; }
+event::state &event::current() { return simulation::current().events; }
+workload_stream::state &workload_stream::current() { return simulation::current().workload; }
+std::atomic<unsigned int> &packet_derived_classes_common_fields_holder::last_packet_id() { return simulation::current().last_packet_id; }
+#ifndef NDEBUG
+std::atomic<unsigned int> &packet_derived_classes_common_fields_holder::live_packet_num() { return simulation::current().live_packet_num; }
+#endif
+bool &IoT_device::AGG_merging() { return simulation::current().AGG_merging; }
+unsigned int &simple_link::latency() { return simulation::current().simple_link_latency; }
+
+void topology_loader::run_on_threads(std::size_t thread_num, const std::function<void()> &work) {
+    simulation &running = simulation::current();
+    std::vector<std::jthread> threads;
+    for (std::size_t i = 1; i < thread_num; i++) {
+        threads.emplace_back([&] {
+            simulation::attach(running);
+            work();
+        });
+    }
+    work();
+}
+
+/*
+A checkpoint of the whole simulation between two start_simulate calls, so a
+long run can resume after a crash, or many what-if runs can start from one
+warmed-up state. save writes a snapshot, and restore replaces the current
+simulation with the one in a snapshot, which then runs exactly as the saved one
+would have:
+
+- the time, the counters of the events and the packet IDs, and the settings of
+  the routes, the merging and the latency of the simple_links
+- every node with its type, its counters and the state of the derived node (see
+  node::save), e.g. the routes, the collected lists and the trees of a sink
+- the phy_neighbors as a binary CSR of topology_loader, which restore builds in
+  place from the mapped snapshot like a loaded topology, and the links that
+  aren't phy_neighbors
+- the pending events in their order and the packets in flight, each written
+  once however many events share it (see snapshot_writer)
+- the position in the workload, whose file is opened again and must not have
+  changed
+
+The packets are written as their bytes, so a snapshot is only read by a build
+with the same types; the header records their tags and sizes. The outputs (the
+trace, the binary_trace and the metrics) are not state, and are left as they are.
+*/
+class checkpoint {
+    public:
+        class statistics {
+            public:
+                std::string path;
+                bool restored = false;
+                std::size_t byte_num = 0;
+                std::size_t node_num = 0;
+                std::size_t link_num = 0;
+                std::size_t event_num = 0;
+                std::size_t packet_num = 0; // the packet bodies in flight
+                double seconds = 0;
+
+                void print(std::ostream &out) const {
+                    std::ostringstream line;
+                    line << std::fixed << std::setprecision(3);
+                    line << "checkpoint: " << node_num << " nodes, " << link_num << " links, " << event_num << " events and "
+                         << packet_num << " packets " << (restored ? "restored from " : "saved to ") << path << " ("
+                         << byte_num / 1e6 << " MB) in " << seconds << " s";
+                    out << line.str() << '\n';
+                }
+        };
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        static constexpr char MAGIC[8] = {'I', 'o', 'T', 'S', 'N', 'A', 'P', '1'};
+
+        // a link that isn't a phy_neighbor, e.g. after del_phy_neighbor
+        class other_link {
+            public:
+                std::uint32_t type_tag = 0;
+                unsigned int id1 = 0;
+                unsigned int id2 = 0;
+        };
+
+        template <typename... Types>
+        static constexpr std::uint64_t layout_of(std::uint64_t hash, type_list<Types...>) {
+            ((hash = (hash ^ Types::type_tag) * 1099511628211U, hash = (hash ^ sizeof(Types)) * 1099511628211U), ...);
+            return hash;
+        }
+        // the tags and the sizes of the types whose bytes or fields are written
+        static constexpr std::uint64_t layout() {
+            std::uint64_t hash = layout_of(14695981039346656037U, packet_types{});
+            hash = layout_of(hash, event_types{});
+            hash = layout_of(hash, node_types{});
+            return (hash ^ sizeof(spanning_tree::statistics)) * 1099511628211U;
+        }
+
+    public:
+        // drops the pending events, the nodes, the links and the workload
+        static void clear() {
+            while (event::current().events->pop()) {}
+            workload_stream::close();
+            node::unfreeze_topology();
+            node::current().id_node_table = {};
+            link::current() = {};
+        }
+
+        static statistics save(const std::string &path) {
+            const auto start = clock::now();
+            statistics stats;
+            stats.path = path;
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                throw std::runtime_error("Cannot write the snapshot " + path);
+            }
+            snapshot_writer out(file);
+            out.write_bytes({MAGIC, sizeof(MAGIC)});
+            out.write(layout());
+
+            out.write(event::get_cur_time());
+            out.write(event::current().main_created_event_num);
+            out.write(IoT_data_packet::get_packet_ID_num());
+            out.write(node::current().topology_frozen);
+            out.write(IoT_device::is_AGG_merging());
+            out.write(simple_link::get_common_latency());
+            route_table::save_roots(out);
+
+            out.write<std::uint64_t>(node::get_node_num());
+            node::current().id_node_table.for_each([&](unsigned int id, const std::shared_ptr<node> &n) {
+                out.write(n->get_type_tag());
+                out.write(id);
+                out.write(n->created_event_num);
+                out.write(n->sent_packet_num);
+                out.write(n->received_packet_num);
+                n->save(out);
+            });
+            stats.node_num = node::get_node_num();
+
+            std::ostringstream csr;
+            topology_loader::write_csr(csr);
+            out.write<std::uint64_t>(csr.view().size());
+            out.align();
+            out.write_bytes(csr.view());
+            std::vector<other_link> other_links;
+            link::current().id_id_link_table.for_each([&](unsigned int id1, const auto &links) {
+                const node *n = node::id_to_node(id1);
+                for (const auto &[id2, l]: links) {
+                    if (n == nullptr || !n->phy_neighbors.contains(id2)) {
+                        other_links.push_back({l->get_type_tag(), id1, id2});
+                    }
+                }
+            });
+            out.write_array(std::span<const other_link>(other_links));
+            stats.link_num = link::get_link_num();
+
+            // the events are taken out of the scheduler to be written, as the engines do, and then put back
+            std::vector<std::unique_ptr<event>> pending;
+            while (std::unique_ptr<event> e = event::current().events->pop()) {
+                pending.push_back(std::move(e));
+            }
+            try {
+                out.write<std::uint64_t>(pending.size());
+                for (const std::unique_ptr<event> &e: pending) {
+                    out.write(e->get_type_tag());
+                    out.write(e->trigger_time);
+                    out.write(e->priority);
+                    out.write(e->creator);
+                    out.write(e->seq);
+                    e->save(out);
+                }
+            }
+            catch (...) {
+                for (std::unique_ptr<event> &e: pending) {
+                    event::current().events->push(std::move(e));
+                }
+                throw;
+            }
+            stats.event_num = pending.size();
+            stats.packet_num = out.get_packet_num();
+            for (std::unique_ptr<event> &e: pending) {
+                event::current().events->push(std::move(e));
+            }
+
+            out.write(workload_stream::is_open());
+            if (workload_stream::is_open()) {
+                const workload_stream::state &stream = workload_stream::current();
+                out.write_string(stream.path);
+                out.write<std::uint64_t>(stream.file->view().size());
+                out.write<std::uint64_t>(stream.line_begin);
+                out.write<std::uint64_t>(stream.position);
+                out.write<std::uint64_t>(stream.line);
+                out.write(stream.next);
+                out.write(stream.seq_base);
+            }
+
+            file.flush();
+            if (!file) {
+                throw std::runtime_error("Cannot write the snapshot " + path);
+            }
+            stats.byte_num = out.get_position();
+            stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+            return stats;
+        }
+
+        // replaces the simulation with the saved one; the topology is built on thread_num threads
+        static statistics restore(const std::string &path, unsigned int thread_num = 1) {
+            const auto start = clock::now();
+            statistics stats;
+            stats.path = path;
+            stats.restored = true;
+            const mapped_file file(path);
+            stats.byte_num = file.view().size();
+            snapshot_reader in(file.view());
+            if (stats.byte_num < sizeof(MAGIC) || in.read_bytes(sizeof(MAGIC)) != std::string_view(MAGIC, sizeof(MAGIC))) {
+                throw std::runtime_error(path + " is not a snapshot");
+            }
+            if (in.read<std::uint64_t>() != layout()) {
+                throw std::runtime_error(path + " was saved by a build with other packet, event or node types");
+            }
+
+            clear();
+            try {
+                event::cur_time = in.read<unsigned int>();
+                event::current().main_created_event_num = in.read<std::uint64_t>();
+                packet_derived_classes_common_fields_holder::last_packet_id() = in.read<unsigned int>();
+                const bool frozen = in.read<bool>();
+                IoT_device::set_AGG_merging(in.read<bool>());
+                simple_link::set_common_latency(in.read<unsigned int>());
+                route_table::restore_roots(in);
+
+                stats.node_num = in.read<std::uint64_t>();
+                for (std::size_t i = 0; i < stats.node_num; i++) {
+                    const auto tag = in.read<std::uint32_t>();
+                    const auto id = in.read<unsigned int>();
+                    std::shared_ptr<node> n;
+                    if (!node_types::visit(tag, [&](auto type) { n = decltype(type)::type::generate(id); })) {
+                        snapshot_reader::fail();
+                    }
+                    n->created_event_num = in.read<std::uint64_t>();
+                    n->sent_packet_num = in.read<std::uint64_t>();
+                    n->received_packet_num = in.read<std::uint64_t>();
+                    n->restore(in);
+                }
+
+                const auto csr_size = in.read<std::uint64_t>();
+                in.align();
+                topology_loader::adjacency rows;
+                topology_loader::parse_csr(in.read_bytes(csr_size), rows);
+                topology_loader::statistics topology;
+                topology_loader::build<IoT_device>(rows, topology, thread_num);
+                for (const other_link &l: in.read_array<other_link>()) {
+                    if (!link_types::visit(l.type_tag, [&](auto type) { decltype(type)::type::generate(l.id1, l.id2); })) {
+                        snapshot_reader::fail();
+                    }
+                }
+                stats.link_num = link::get_link_num();
+
+                stats.event_num = in.read<std::uint64_t>();
+                for (std::size_t i = 0; i < stats.event_num; i++) {
+                    const auto tag = in.read<std::uint32_t>();
+                    const auto trigger_time = in.read<unsigned int>();
+                    const auto priority = in.read<std::uint32_t>();
+                    const auto creator = in.read<unsigned int>();
+                    const auto seq = in.read<std::uint64_t>();
+                    std::unique_ptr<event> e;
+                    if (!event_types::visit(tag, [&](auto type) { e = decltype(type)::type::restore(trigger_time, in); })) {
+                        snapshot_reader::fail();
+                    }
+                    e->priority = priority;
+                    e->creator = creator;
+                    e->seq = seq;
+                    event::current().events->push(std::move(e));
+                }
+                stats.packet_num = in.get_packet_num();
+
+                if (in.read<bool>()) {
+                    const std::string workload_path(in.read_string());
+                    auto workload = std::make_unique<mapped_file>(workload_path);
+                    if (workload->view().size() != in.read<std::uint64_t>()) {
+                        throw std::runtime_error("The workload " + workload_path + " has changed since the checkpoint");
+                    }
+                    workload_stream::state &stream = workload_stream::current();
+                    stream.file = std::move(workload);
+                    stream.path = workload_path;
+                    stream.line_begin = in.read<std::uint64_t>();
+                    stream.position = in.read<std::uint64_t>();
+                    stream.line = in.read<std::uint64_t>();
+                    stream.next = in.read<std::uint64_t>();
+                    stream.seq_base = in.read<std::uint64_t>();
+                }
+                if (!in.at_end()) {
+                    snapshot_reader::fail();
+                }
+                if (frozen) {
+                    node::freeze_topology();
+                }
+            }
+            catch (...) {
+                clear();
+                throw;
+            }
+            stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+            return stats;
+        }
+};
+
+std::unique_ptr<event> event::get_next_event() {
+    state &sched = current();
+    std::unique_ptr<event> e = sched.events->pop();
+    if (workload_stream::next_time() <= std::min<std::uint64_t>(e ? e->trigger_time : UINT64_MAX, sched.end_time)) {
+        if (e) {
+            sched.events->push(std::move(e));
+        }
+        workload_stream::generate_next();
+        e = sched.events->pop();
+    }
+    return e;
+}
+
+// send_handler function is used to transmit packet p based on the information in the header
+// Note that the packet p will not be discard after send_handler ()
+
+void node::send_handler(const SharedPacket &p){
+    send_handler(SharedPacket(p)); // this only shares the packet body
+}
+
+void node::send_handler(SharedPacket &&p){
+    send_event::send_data e_data;
+    e_data.s_id = std::visit(overloaded {
+        [](auto &&packet){ return packet.get_header().get_pre_ID(); },
+        [](std::monostate) -> unsigned { throw std::domain_error("The packet has not been assigned any specific packet type"); }
+    }, p.get());
+    e_data.r_id = std::visit(overloaded {
+        [](auto &&packet){ return packet.get_header().get_nex_ID(); },
+        [](std::monostate) -> unsigned { throw std::domain_error("The packet has not been assigned any specific packet type"); }
+    }, p.get());
+    e_data._pkt = std::move(p);
+    send_event::generate(event::get_cur_time(), std::move(e_data));
+}
+
+void node::send(const SharedPacket &p){ // this function is called by event; not for the user
+    sent_packet_num++;
+    unsigned int _nexID = std::visit(overloaded {
+        [](auto &&packet){ return packet.get_header().get_nex_ID(); },
+        [](std::monostate) -> unsigned { throw std::domain_error("The packet has not been assigned any specific packet type"); }
+    }, p.get());
+    const auto send_to = [&](unsigned int nb_id, unsigned int latency) {
+        unsigned int trigger_time = event::get_cur_time() + latency; // we simply assume that the delay is fixed
+        // cout << "node " << id << " send to node " <<  nb_id << '\n';
+        recv_event::recv_data e_data;
+        e_data.s_id = id;    // set the sender   (i.e., preID)
+        e_data.r_id = nb_id; // set the receiver (i.e., nexID)
+
+        e_data._pkt = p; // every receiver shares the same packet body
+
+        recv_event::generate(trigger_time, std::move(e_data));
+    };
+
+    if (current().topology_frozen) {
+        if (current().frozen_topology_stale) {
+            rebuild_frozen_topology();
+        }
+        if (_nexID != BROADCAST_ID) { // unicast; the neighbors are sorted by ID
+            const auto first = current().frozen_adjacencies.begin() + static_cast<std::ptrdiff_t>(adjacency_begin);
+            const auto last = current().frozen_adjacencies.begin() + static_cast<std::ptrdiff_t>(adjacency_end);
+            const auto nb = std::lower_bound(first, last, _nexID, [](const adjacency &a, unsigned int nb_id) { return a.id < nb_id; });
+            if (nb != last && nb->id == _nexID) {
+                send_to(nb->id, nb->latency);
+            }
+            return;
+        }
+        for (std::size_t i = adjacency_begin; i < adjacency_end; i++) {
+            const adjacency &nb = current().frozen_adjacencies[i];
+            send_to(nb.id, nb.latency);
+        }
+        return;
+    }
+    if (_nexID != BROADCAST_ID) {
+        if (phy_neighbors.contains(_nexID)) {
+            send_to(_nexID, static_cast<unsigned int>(link::id_id_to_link(id, _nexID)->get_latency()));
+        }
+        return;
+    }
+    for (const auto &nb_id: phy_neighbors) { // neighbor id
+        send_to(nb_id, static_cast<unsigned int>(link::id_id_to_link(id, nb_id)->get_latency()));
+    }
+}
+
+void event::start_simulate(unsigned int _end_time, unsigned int thread_num) {
+    const unsigned int lookahead = link::get_min_latency();
+    if (thread_num <= 1 || lookahead == 0) { // nothing can run in parallel
+        start_simulate(_end_time);
+        return;
+    }
+    state &sched = current();
+    sched.end_time = _end_time;
+    std::uint64_t event_num = 0;
+    const unsigned int start_packet_ID_num = IoT_data_packet::get_packet_ID_num();
+    const auto wall_start = std::chrono::steady_clock::now();
+
+    std::vector<std::unique_ptr<logical_process>> lps;
+    std::vector<logical_process *> lp_ptrs;
+    for (std::size_t i = 0; i < thread_num; i++) {
+        lps.push_back(std::make_unique<logical_process>(i, thread_num));
+        lp_ptrs.push_back(lps.back().get());
+    }
+    logical_process serial_lp(thread_num, thread_num); // runs the events without an owner; everything it adds goes to its outbox
+    lp_ptrs.push_back(&serial_lp);
+    binary_heap_queue serial; // the events without an owner
+    const auto route = [&](std::unique_ptr<event> &&e) {
+        if (e->is_serial()) {
+            serial.push(std::move(e));
+        }
+        else {
+            lps[logical_process::index_of(e->owner_id(), thread_num)]->pending.push(std::move(e));
+        }
+    };
+    while (std::unique_ptr<event> e = sched.events->pop()) {
+        route(std::move(e));
+    }
+
+    // the main thread runs logical process 0, and the workers wait at window_begin between the windows
+    bool stop = false;
+    std::barrier window_begin(static_cast<std::ptrdiff_t>(thread_num));
+    std::barrier window_done(static_cast<std::ptrdiff_t>(thread_num));
+    simulation &running = simulation::current(); // the workers run its events
+    std::vector<std::jthread> workers;
+    for (std::size_t i = 1; i < thread_num; i++) {
+        workers.emplace_back([&, i] {
+            const event_pool::slot_lease slot;
+            simulation::attach(running);
+            while (true) {
+                window_begin.arrive_and_wait();
+                if (stop) {
+                    return;
+                }
+                lps[i]->run_window();
+                window_done.arrive_and_wait();
+            }
+        });
+    }
+
+    std::exception_ptr error;
+    try {
+        while (true) {
+            std::uint64_t window_begin_time = UINT64_MAX;
+            const auto peek = [&](event_queue &queue) {
+                if (std::unique_ptr<event> e = queue.pop()) {
+                    window_begin_time = std::min<std::uint64_t>(window_begin_time, e->trigger_time);
+                    queue.push(std::move(e));
+                }
+            };
+            peek(serial);
+            for (const auto &lp: lps) {
+                peek(lp->pending);
+            }
+            window_begin_time = std::min(window_begin_time, workload_stream::next_time());
+            if (window_begin_time > sched.end_time) {
+                break;
+            }
+            metrics::sample_pending(static_cast<unsigned int>(window_begin_time), [&] {
+                std::size_t pending = serial.size();
+                for (const auto &lp: lps) {
+                    pending += lp->pending.size();
+                }
+                return pending;
+            });
+            const std::uint64_t window_end = std::min<std::uint64_t>(window_begin_time + lookahead, std::uint64_t{sched.end_time} + 1);
+            if (workload_stream::next_time() < window_end) { // the workload's events of this window
+                while (workload_stream::next_time() < window_end) {
+                    workload_stream::generate_next();
+                }
+                while (std::unique_ptr<event> e = sched.events->pop()) {
+                    route(std::move(e));
+                }
+            }
+            for (logical_process *lp: lp_ptrs) {
+                lp->window_end = window_end;
+            }
+
+            if (node::current().frozen_topology_stale) { // the workers only read the topology
+                node::rebuild_frozen_topology();
+            }
+
+            // the events without an owner, and the ones they add for this window
+            cur_lp = &serial_lp;
+            sort_key added_at{};
+            while (std::unique_ptr<event> e = serial.pop()) {
+                if (e->trigger_time >= window_end) {
+                    serial.push(std::move(e));
+                    break;
+                }
+                serial_lp.run(*e);
+                added_at = std::max(added_at, e->get_sort_key());
+                for (auto &added: serial_lp.outbox) {
+                    if (added->trigger_time < window_end && !added->is_serial()) {
+                        lps[logical_process::index_of(added->owner_id(), thread_num)]->deferred.emplace_back(added_at, std::move(added));
+                    }
+                    else {
+                        route(std::move(added));
+                    }
+                }
+                serial_lp.outbox.clear();
+            }
+            cur_lp = nullptr;
+
+            const unsigned int packet_ID_num = IoT_data_packet::get_packet_ID_num();
+            window_begin.arrive_and_wait();
+            lps[0]->run_window();
+            window_done.arrive_and_wait();
+            for (const auto &lp: lps) {
+                if (lp->error) {
+                    std::rethrow_exception(lp->error);
+                }
+            }
+            if (IoT_data_packet::get_packet_ID_num() != packet_ID_num) {
+                throw std::logic_error("A packet was created by an event of a node in the parallel engine");
+            }
+
+            for (const auto &lp: lps) {
+                for (auto &e: lp->outbox) {
+                    if (e->trigger_time < window_end) {
+                        throw std::logic_error("An event was scheduled inside the window of another logical process");
+                    }
+                    route(std::move(e));
+                }
+                lp->outbox.clear();
+            }
+
+            event_num += logical_process::print_window(lp_ptrs);
+        }
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+    cur_lp = nullptr;
+
+    stop = true;
+    window_begin.arrive_and_wait();
+    workers.clear(); // joins the workers
+
+    // keep the rest for the next start_simulate
+    while (std::unique_ptr<event> e = serial.pop()) {
+        sched.events->push(logical_process::released(std::move(e)));
+    }
+    for (logical_process *lp: lp_ptrs) {
+        while (std::unique_ptr<event> e = lp->pending.pop()) {
+            sched.events->push(logical_process::released(std::move(e)));
+        }
+        for (auto &e: lp->outbox) {
+            if (e) { // not routed before an error
+                sched.events->push(logical_process::released(std::move(e)));
+            }
+        }
+        for (auto &entry: lp->deferred) {
+            if (entry.second) { // not run before an error
+                sched.events->push(logical_process::released(std::move(entry.second)));
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    print_summary(event_num, IoT_data_packet::get_packet_ID_num() - start_packet_ID_num);
+    metrics::end_run("parallel", sched.end_time, event_num, IoT_data_packet::get_packet_ID_num() - start_packet_ID_num,
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count());
+}
+
+/*
+The batched engine takes all events of the next trigger_time from a
+time_bucket_queue at once and sorts them once. The events without an owner are
+run first in order, as in the parallel engine, and then the events of every
+node are run together in order, so the node's state and its handler stay in the
+cache. The events of different nodes at the same time are independent because a
+node only affects another node after at least the shortest link latency, and
+the printed events are put back into the order of the sequential engine like a
+window of the parallel engine. The handlers must not schedule an event for
+another node at the current time.
+
+The events are grouped by node only, not by event type within a node: the
+events of a node at one time change its state in the order of their keys (e.g.
+a recv_event and then the send_event that it added), and running them by type
+would change the routes, the packets and the output. The printing is not
+batched either: the events are still formatted one by one into the text trace
+of the logical process (an std::ostringstream) and merged back into order, so
+the gain is in the dispatch, not in the printing.
+*/
+void event::start_simulate_batched(unsigned int _end_time) {
+    state &sched = current();
+    if (link::get_min_latency() == 0) { // the nodes may affect each other at the same time
+        start_simulate(_end_time);
+        return;
+    }
+    sched.end_time = _end_time;
+    std::uint64_t event_num = 0;
+    const unsigned int start_packet_ID_num = IoT_data_packet::get_packet_ID_num();
+    const auto wall_start = std::chrono::steady_clock::now();
+
+    time_bucket_queue buckets;
+    while (std::unique_ptr<event> e = sched.events->pop()) {
+        buckets.push(std::move(e));
+    }
+    logical_process batch(0, 1); // runs the nodes' events; the events they add at the current time go to batch.pending
+    logical_process serial_lp(1, 1); // runs the events without an owner; the events they add at the current time go to its outbox
+    batch.later = &buckets;
+    serial_lp.later = &buckets;
+    const std::vector<logical_process *> lp_ptrs = {&batch, &serial_lp};
+    std::vector<std::unique_ptr<event>> now; // the events of the current time
+    binary_heap_queue serial; // the events without an owner at the current time
+    std::vector<std::pair<unsigned int, std::unique_ptr<event>>> owned; // the other events at the current time and their owners
+    // the events added at the current time by the events without an owner, their owners, and when the sequential engine adds them
+    std::vector<std::tuple<unsigned int, sort_key, std::unique_ptr<event>>> deferred;
+
+    std::exception_ptr error;
+    try {
+        while (true) {
+            if (workload_stream::next_time() <= std::min<std::uint64_t>(buckets.next_time(), sched.end_time)) {
+                workload_stream::generate_next();
+                while (std::unique_ptr<event> e = sched.events->pop()) {
+                    buckets.push(std::move(e));
+                }
+            }
+            now = buckets.pop_batch();
+            if (now.empty()) {
+                break;
+            }
+            const unsigned int time = now.front()->trigger_time;
+            if (time > sched.end_time) {
+                break;
+            }
+            metrics::sample_pending(time, [&] { return now.size() + buckets.size(); });
+            batch.window_end = serial_lp.window_end = std::uint64_t{time} + 1;
+            for (std::unique_ptr<event> &e: now) {
+                if (e->is_serial()) {
+                    serial.push(std::move(e));
+                }
+                else {
+                    const unsigned int owner = e->owner_id();
+                    owned.emplace_back(owner, std::move(e));
+                }
+            }
+            now.clear();
+
+            cur_lp = &serial_lp;
+            sort_key added_at{};
+            while (std::unique_ptr<event> e = serial.pop()) {
+                serial_lp.run(*e);
+                added_at = std::max(added_at, e->get_sort_key());
+                for (auto &added: serial_lp.outbox) {
+                    if (added->is_serial()) {
+                        serial.push(std::move(added));
+                    }
+                    else {
+                        const unsigned int owner = added->owner_id();
+                        deferred.emplace_back(owner, added_at, std::move(added));
+                    }
+                }
+                serial_lp.outbox.clear();
+            }
+
+            // the only sort of the events of this time; the events of a node stay in order, and the nodes are run one by one
+            std::sort(owned.begin(), owned.end(), [](const auto &lhs, const auto &rhs) {
+                if (lhs.first != rhs.first) {
+                    return lhs.first < rhs.first;
+                }
+                return earlier(*lhs.second, *rhs.second);
+            });
+            std::stable_sort(deferred.begin(), deferred.end(), [](const auto &lhs, const auto &rhs) {
+                return std::get<0>(lhs) < std::get<0>(rhs);
+            });
+            cur_lp = &batch;
+            std::size_t next = 0;
+            std::size_t next_deferred = 0;
+            while (next < owned.size() || next_deferred < deferred.size()) {
+                unsigned int owner = next < owned.size() ? owned[next].first : UINT_MAX;
+                if (next_deferred < deferred.size()) {
+                    owner = std::min(owner, std::get<0>(deferred[next_deferred]));
+                }
+                batch.sequence_begins.push_back(batch.records.size());
+                // merges the node's sorted events with the ones added at the current time
+                while (true) {
+                    std::unique_ptr<event> e = batch.pending.pop();
+                    if (next < owned.size() && owned[next].first == owner && (!e || earlier(*owned[next].second, *e))) {
+                        if (e) {
+                            batch.pending.push(std::move(e));
+                        }
+                        e = std::move(owned[next++].second);
+                    }
+                    if (next_deferred < deferred.size() && std::get<0>(deferred[next_deferred]) == owner &&
+                        (!e || std::get<1>(deferred[next_deferred]) < e->get_sort_key())) {
+                        if (e) {
+                            batch.pending.push(std::move(e));
+                        }
+                        batch.pending.push(std::move(std::get<2>(deferred[next_deferred++])));
+                        continue;
+                    }
+                    if (!e) {
+                        break;
+                    }
+                    if (e->owner_id() != owner) {
+                        throw std::logic_error("An event was scheduled for another node at the current time in the batched engine");
+                    }
+                    batch.run(*e);
+                    if (!batch.outbox.empty()) {
+                        throw std::logic_error("An event without an owner was scheduled at the current time in the batched engine");
+                    }
+                }
+            }
+            owned.clear();
+            deferred.clear();
+            cur_lp = nullptr;
+
+            event_num += logical_process::print_window(lp_ptrs);
+        }
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+    cur_lp = nullptr;
+
+    // keep the rest for the next start_simulate
+    const auto keep = [&](std::unique_ptr<event> &&e) {
+        if (e) { // not run or moved before an error
+            sched.events->push(logical_process::released(std::move(e)));
+        }
+    };
+    for (auto &e: now) {
+        keep(std::move(e));
+    }
+    for (auto &entry: owned) {
+        keep(std::move(entry.second));
+    }
+    for (auto &entry: deferred) {
+        keep(std::move(std::get<2>(entry)));
+    }
+    for (logical_process *lp: lp_ptrs) {
+        for (auto &e: lp->outbox) {
+            keep(std::move(e));
+        }
+    }
+    for (event_queue *queue: std::initializer_list<event_queue *>{&serial, &batch.pending, &buckets}) {
+        while (std::unique_ptr<event> e = queue->pop()) {
+            keep(std::move(e));
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    print_summary(event_num, IoT_data_packet::get_packet_ID_num() - start_packet_ID_num);
+    metrics::end_run("batched", sched.end_time, event_num, IoT_data_packet::get_packet_ID_num() - start_packet_ID_num,
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count());
+}
+
+void metrics::open(const std::string &_path, unsigned int _sample_period) {
+    path = _path;
+    if (!std::ofstream(path)) { // fails now instead of after the simulation
+        throw std::runtime_error("Cannot open " + path);
+    }
+    {
+        std::lock_guard<std::mutex> lock(shards_mutex);
+        for (shard &s: shards) {
+            s = shard();
+        }
+    }
+    runs.clear();
+    sample_period = std::max(_sample_period, 1U);
+    next_sample_time = 0;
+    samples.clear();
+    node::current().id_node_table.for_each([](unsigned int, const std::shared_ptr<node> &n) {
+        n->sent_packet_num = 0;
+        n->received_packet_num = 0;
+    });
+    opened = true;
+}
+
+void metrics::write() {
+    // the totals of the shards
+    std::vector<std::pair<std::uint32_t, std::uint64_t>> event_nums;
+    std::uint64_t other_event_num = 0;
+    std::array<std::uint64_t, DELAY_BUCKET_NUM> delay_nums{};
+    std::uint64_t delay_num = 0;
+    std::uint64_t delay_sum = 0;
+    std::uint64_t delay_max = 0;
+    for (const shard &s: shards) {
+        for (std::size_t i = 0; i < s.event_type_num; i++) {
+            const auto it = std::find_if(event_nums.begin(), event_nums.end(), [&](const auto &entry) { return entry.first == s.event_nums[i].first; });
+            if (it != event_nums.end()) {
+                it->second += s.event_nums[i].second;
+            }
+            else {
+                event_nums.push_back(s.event_nums[i]);
+            }
+        }
+        other_event_num += s.other_event_num;
+        for (std::size_t b = 0; b < DELAY_BUCKET_NUM; b++) {
+            delay_nums[b] += s.delay_nums[b];
+            delay_num += s.delay_nums[b];
+        }
+        delay_sum += s.delay_sum;
+        delay_max = std::max(delay_max, s.delay_max);
+    }
+    std::sort(event_nums.begin(), event_nums.end(), [](const auto &lhs, const auto &rhs) {
+        return event_types::name_of(lhs.first) < event_types::name_of(rhs.first);
+    });
+
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    out << std::setprecision(9);
+    out << "{\n  \"runs\": [";
+    for (std::size_t i = 0; i < runs.size(); i++) {
+        const run &r = runs[i];
+        out << (i ? ",\n" : "\n") << "    {\"engine\": \"" << r.engine << "\", \"end_time\": " << r.end_time << ", \"events\": " << r.event_num
+            << ", \"packets\": " << r.packet_num << ", \"wall_seconds\": " << r.wall_seconds << ", \"events_per_second\": "
+            << (r.wall_seconds > 0 ? static_cast<double>(r.event_num) / r.wall_seconds : 0);
+#ifndef NDEBUG
+        out << ", \"live_packets\": " << r.live_packet_num;
+#endif
+        out << '}';
+    }
+    out << "\n  ],\n  \"events\": {";
+    bool first = true;
+    for (const auto &[type_tag, num]: event_nums) {
+        const std::string_view name = event_types::name_of(type_tag);
+        if (name.empty()) { // not registered in event_types
+            other_event_num += num;
+            continue;
+        }
+        out << (first ? "\n" : ",\n") << "    \"" << name << "\": " << num;
+        first = false;
+    }
+    if (other_event_num > 0) {
+        out << (first ? "\n" : ",\n") << "    \"other\": " << other_event_num;
+    }
+    out << "\n  },\n  \"pending_events\": {\"sample_period\": " << sample_period << ", \"samples\": [";
+    for (std::size_t i = 0; i < samples.size(); i++) {
+        out << (i ? ", " : "") << '[' << samples[i].first << ", " << samples[i].second << ']';
+    }
+    out << "]},\n  \"IoT_data_delay\": {\"packets\": " << delay_num << ", \"mean\": "
+        << (delay_num ? static_cast<double>(delay_sum) / static_cast<double>(delay_num) : 0) << ", \"max\": " << delay_max << ", \"buckets\": [";
+    first = true;
+    for (std::size_t b = 0; b < DELAY_BUCKET_NUM; b++) {
+        if (delay_nums[b] > 0) {
+            out << (first ? "" : ", ") << "{\"below\": " << (std::uint64_t{1} << b) << ", \"packets\": " << delay_nums[b] << '}';
+            first = false;
+        }
+    }
+    out << "]},\n  \"nodes\": [";
+    first = true;
+    node::current().id_node_table.for_each([&](unsigned int id, const std::shared_ptr<node> &n) {
+        out << (first ? "\n" : ",\n") << "    {\"id\": " << id << ", \"type\": \"" << n->type() << "\", \"sent\": " << n->sent_packet_num
+            << ", \"received\": " << n->received_packet_num << '}';
+        first = false;
+    });
+    out << "\n  ]\n}\n";
+}
+
+/*
+The benchmark suite: ./a.out bench <output.json> [max node num] [thread num]
+
+The micro benchmarks time one hot path at a time: add_event and get_next_event
+with every scheduler, the mycomp comparison (against one that rehashes the
+priorities like before they were cached), the fan-out of node::send, the copy
+and move of every packet type, and id_to_node. The macro benchmarks generate
+grids, random geometric graphs and scale-free (Barabási–Albert) graphs of 1k
+nodes up to max node num (1M by default), and on every one time the build, a
+flood from node 0 and the forwarding of data packets to node 0 with
+start_simulate(end_time, thread num). The graphs and the traffic are seeded, so
+every run simulates the same events. The scaling benchmark runs the flood and the
+forwarding of one grid (of max node num, but at most SCALING_NODE_NUM nodes) on
+1, 2, 4, ... MAX_SCALING_THREAD_NUM threads of the parallel engine and checks
+that every run has the same events; the JSON records the hardware threads, since
+the speedups only mean something on as many cores.
+
+The results are written as JSON, one record per measurement, so the records of
+two builds can be compared by name, variant and nodes. A micro benchmark is the
+best of REPEAT runs. The suite clears the topology and the pending events, so
+run it on its own.
+*/
+class benchmark {
+    public:
+        class result {
+            public:
+                std::string name;
+                std::string variant;
+                std::size_t node_num = 0;
+                std::uint64_t op_num = 0;
+                double seconds = 0;
+                std::vector<std::pair<std::string, double>> extras; // written after the others
+        };
+
+    private:
+        using clock = std::chrono::steady_clock;
+        using edge_list = std::vector<std::pair<unsigned int, unsigned int>>;
+
+        static constexpr unsigned int REPEAT = 3;
+        static constexpr std::uint64_t SEED = 1;
+        static constexpr std::size_t EVENT_NUM = 1 << 20; // pending at once in the scheduler benchmarks
+        static constexpr std::uint64_t SEND_EVENT_NUM = 1 << 20; // the recv_events of a node::send benchmark
+        static constexpr std::size_t PACKET_NUM = 1024; // the packets copied in a pass
+        static constexpr std::size_t LOOKUP_NUM = 1 << 22;
+        static constexpr double GEOMETRIC_DEGREE = 8; // the mean degree of a random geometric graph
+        static constexpr unsigned int SCALE_FREE_LINK_NUM = 2; // the links of every new node of a scale-free graph
+        static constexpr unsigned int DATA_PACKET_NUM = 1000;
+        static constexpr unsigned int SCALING_NODE_NUM = 100000;
+        static constexpr unsigned int MAX_SCALING_THREAD_NUM = 64;
+
+        static inline std::vector<result> results;
+
+        static double seconds_since(clock::time_point start) {
+            return std::chrono::duration<double>(clock::now() - start).count();
+        }
+
+        static void add(result r) {
+            std::cerr << "bench: " << r.name << (r.variant.empty() ? "" : " (" + r.variant + ")");
+            if (r.node_num > 0) {
+                std::cerr << ", " << r.node_num << " nodes";
+            }
+            std::cerr << ": " << r.op_num << " ops in " << r.seconds << " s\n";
+            results.push_back(std::move(r));
+        }
+
+        // drops the pending events and all nodes and links
+        static void clear() { checkpoint::clear(); }
+
+        // the recv_events of one packet at random times after now, in random order
+        static std::vector<std::unique_ptr<event>> make_events(std::mt19937_64 &random) {
+            std::uniform_int_distribution<unsigned int> delay(0, 1 << 16);
+            recv_event::recv_data data;
+            data._pkt = IoT_data_packet();
+            for (std::size_t i = 0; i < EVENT_NUM; i++) {
+                data.s_id = static_cast<unsigned int>(i % 1024);
+                data.r_id = static_cast<unsigned int>(i / 1024);
+                recv_event::generate(event::get_cur_time() + delay(random), data);
+            }
+            std::vector<std::unique_ptr<event>> pending;
+            pending.reserve(EVENT_NUM);
+            while (std::unique_ptr<event> e = event::current().events->pop()) {
+                pending.push_back(std::move(e));
+            }
+            return pending;
         }
-};
 
-////////////////////////////////////////////////////////////////////////////////
+        // a new Queue for every run, since a scheduler may expect no event earlier than the ones it has popped
+        template <typename Queue>
+        static void bench_scheduler(std::vector<std::unique_ptr<event>> &pending, std::mt19937_64 &random) {
+            const std::string type(Queue().type());
+            double add_seconds = HUGE_VAL;
+            double get_seconds = HUGE_VAL;
+            for (unsigned int r = 0; r < REPEAT; r++) {
+                event::set_scheduler(std::make_unique<Queue>());
+                std::shuffle(pending.begin(), pending.end(), random);
+                auto start = clock::now();
+                for (std::unique_ptr<event> &e: pending) {
+                    event::add_event(std::move(e));
+                }
+                add_seconds = std::min(add_seconds, seconds_since(start));
+                start = clock::now();
+                std::size_t num = 0;
+                while (std::unique_ptr<event> e = event::get_next_event()) {
+                    pending[num++] = std::move(e);
+                }
+                get_seconds = std::min(get_seconds, seconds_since(start));
+                if (num != pending.size()) {
+                    throw std::logic_error("The " + type + " lost events");
+                }
+            }
+            add({"event::add_event", type, 0, pending.size(), add_seconds, {}});
+            add({"event::get_next_event", type, 0, pending.size(), get_seconds, {}});
+        }
 
-class link {
-        // all links created in the program
-        static inline std::map<std::pair<unsigned int, unsigned int>, std::shared_ptr<link>> id_id_link_table;
-        unsigned int id1; // from
-        unsigned int id2; // to
+        static void bench_events() {
+            std::mt19937_64 random(SEED);
+            std::vector<std::unique_ptr<event>> pending = make_events(random);
+            bench_scheduler<binary_heap_queue>(pending, random);
+            bench_scheduler<calendar_queue>(pending, random);
+            bench_scheduler<ladder_queue>(pending, random);
+            bench_scheduler<time_bucket_queue>(pending, random);
+            event::set_scheduler(std::make_unique<binary_heap_queue>());
+
+            // neighbors in a random order, so every comparison reads two events that are not in the cache
+            std::shuffle(pending.begin(), pending.end(), random);
+            const mycomp comp;
+            double seconds = HUGE_VAL;
+            std::uint64_t later_num = 0;
+            for (unsigned int r = 0; r < REPEAT; r++) {
+                later_num = 0;
+                const auto start = clock::now();
+                for (std::size_t i = 1; i < pending.size(); i++) {
+                    later_num += comp(pending[i - 1], pending[i]) ? 1 : 0;
+                }
+                seconds = std::min(seconds, seconds_since(start));
+            }
 
-    protected:
-        link(unsigned int _id1, unsigned int _id2): id1(_id1), id2(_id2) {
-            if(id_id_link_table.find({_id1, _id2}) != id_id_link_table.end()){
-                throw std::invalid_argument("Duplicate link id");
+            // the comparison before the keys were cached: both keys are rebuilt from strings and hashed every time
+            const auto rehashed_later = [](const std::unique_ptr<event> &lhs, const std::unique_ptr<event> &rhs) {
+                const auto key = [](const event &e) {
+                    return std::make_tuple(e.get_trigger_time(), static_cast<const recv_event &>(e).compute_priority(), e.creator, e.seq);
+                };
+                return key(*rhs) < key(*lhs);
+            };
+            double rehashed_seconds = HUGE_VAL;
+            std::uint64_t rehashed_later_num = 0;
+            for (unsigned int r = 0; r < REPEAT; r++) {
+                rehashed_later_num = 0;
+                const auto start = clock::now();
+                for (std::size_t i = 1; i < pending.size(); i++) {
+                    rehashed_later_num += rehashed_later(pending[i - 1], pending[i]) ? 1 : 0;
+                }
+                rehashed_seconds = std::min(rehashed_seconds, seconds_since(start));
             }
-            if ( BROADCAST_ID == _id1 || BROADCAST_ID == _id2 ) {
-                throw std::invalid_argument("BROADCAST_ID cannot be used");
+            if (rehashed_later_num != later_num) {
+                throw std::logic_error("The cached priorities order the events differently");
             }
+            add({"mycomp", "rehashed", 0, pending.size() - 1, rehashed_seconds,
+                 {{"later", static_cast<double>(rehashed_later_num)}, {"comparisons_per_second", static_cast<double>(pending.size() - 1) / rehashed_seconds}}});
+            add({"mycomp", "cached", 0, pending.size() - 1, seconds,
+                 {{"later", static_cast<double>(later_num)}, {"comparisons_per_second", static_cast<double>(pending.size() - 1) / seconds},
+                  {"speedup", rehashed_seconds / seconds}}});
         }
-        static void register_link(const std::shared_ptr<link> &link) {
-            id_id_link_table[{link->id1, link->id2}] = link;
-        }
-        static inline std::vector<std::string> derived_class_names;
 
-    public:
-        /*
-        For the same reason as node, the special members are deleted. See node's
-        comment above its special members for more details.
-        */
-        link() = delete;
-        link(const link &other) = delete;
-        link(link &&other) = delete;
-        link &operator=(const link &other) = delete;
-        link &operator=(link &&other) = delete;
-        virtual ~link() = default;
+        // node 0 sends to degree neighbors; an op is a recv_event
+        static void bench_send() {
+            for (const unsigned int degree: {4U, 16U, 64U, 256U}) {
+                edge_list edges;
+                for (unsigned int id = 1; id <= degree; id++) {
+                    edges.emplace_back(0, id);
+                }
+                topology_loader::load_edges(std::move(edges), "star");
+                node::freeze_topology();
+                node *hub = node::id_to_node(0);
+                for (const bool unicast: {false, true}) {
+                    IoT_ctrl_packet packet;
+                    packet.set_src_ID(0);
+                    packet.set_dst_ID(BROADCAST_ID);
+                    packet.set_pre_ID(0);
+                    packet.set_nex_ID(unicast ? degree : BROADCAST_ID);
+                    const node::SharedPacket p(packet);
+                    const std::uint64_t send_num = unicast ? SEND_EVENT_NUM : SEND_EVENT_NUM / degree;
+                    double seconds = HUGE_VAL;
+                    for (unsigned int r = 0; r < REPEAT; r++) {
+                        const auto start = clock::now();
+                        for (std::uint64_t i = 0; i < send_num; i++) {
+                            hub->send(p);
+                        }
+                        seconds = std::min(seconds, seconds_since(start));
+                        while (event::current().events->pop()) {}
+                    }
+                    add({"node::send", (unicast ? "unicast, degree " : "broadcast, degree ") + std::to_string(degree), degree + 1,
+                         unicast ? send_num : send_num * degree, seconds, {}});
+                }
+                clear();
+            }
+        }
 
-        static std::shared_ptr<link> id_id_to_link (unsigned int _id1, unsigned int _id2) {
-            const auto it = id_id_link_table.find({_id1, _id2});
-            return it != id_id_link_table.cend() ? it->second : nullptr;
+        template <typename Packet>
+        static void bench_packet(std::string_view variant, const Packet &packet) {
+            std::vector<Packet> from(PACKET_NUM, packet);
+            std::vector<Packet> to(PACKET_NUM);
+            const std::size_t pass_num = 1024;
+            const auto time = [&](std::string name, auto move) {
+                double seconds = HUGE_VAL;
+                for (unsigned int r = 0; r < REPEAT; r++) {
+                    const auto start = clock::now();
+                    for (std::size_t pass = 0; pass < pass_num; pass++) {
+                        for (std::size_t i = 0; i < PACKET_NUM; i++) {
+                            // a different slot in every pass, so the passes cannot be merged
+                            if constexpr (decltype(move)::value) {
+                                to[(i + pass) % PACKET_NUM] = std::move(from[i]);
+                            }
+                            else {
+                                to[(i + pass) % PACKET_NUM] = from[i];
+                            }
+                        }
+                    }
+                    seconds = std::min(seconds, seconds_since(start));
+                }
+                add({std::move(name), std::string(variant), 0, pass_num * PACKET_NUM, seconds, {}});
+            };
+            time("packet copy", std::false_type{});
+            time("packet move", std::true_type{});
         }
 
-    virtual double get_latency() = 0; // you must implement your own latency
+        // every packet type in node::PacketTypes, as the variant that the events hold
+        template <std::size_t I = 1>
+        static void bench_packets() {
+            if constexpr (I < std::variant_size_v<node::PacketTypes>) {
+                using packet_type = std::variant_alternative_t<I, node::PacketTypes>;
+                bench_packet(packet_type::type_name, node::PacketTypes(packet_type()));
+                bench_packets<I + 1>();
+            }
+            else {
+                bench_packet("SharedPacket", node::SharedPacket(IoT_data_packet())); // what every receiver of a send gets
+            }
+        }
 
-        static void del_link (unsigned int _id1, unsigned int _id2) {
-            const auto it = id_id_link_table.find({_id1, _id2});
-            if (it != id_id_link_table.cend()) {
-                id_id_link_table.erase(it);
+        static void bench_lookup(const std::string &topology, std::mt19937_64 &random) {
+            const std::size_t node_num = node::get_node_num();
+            std::uniform_int_distribution<unsigned int> id(0, static_cast<unsigned int>(node_num - 1));
+            std::vector<unsigned int> ids(1 << 16);
+            for (unsigned int &i: ids) {
+                i = id(random);
+            }
+            double seconds = HUGE_VAL;
+            std::uint64_t found_num = 0;
+            for (unsigned int r = 0; r < REPEAT; r++) {
+                found_num = 0;
+                const auto start = clock::now();
+                for (std::size_t i = 0; i < LOOKUP_NUM; i++) {
+                    found_num += node::id_to_node(ids[i % ids.size()]) != nullptr ? 1 : 0;
+                }
+                seconds = std::min(seconds, seconds_since(start));
             }
+            add({"node::id_to_node", topology, node_num, LOOKUP_NUM, seconds, {{"found", static_cast<double>(found_num)}}});
         }
 
-        static auto get_link_num () { return id_id_link_table.size(); }
+        // generates the topology, floods it from node 0 and forwards data packets to node 0 over the routes of the flood
+        static void bench_scenarios(const std::string &topology, const std::function<topology_loader::statistics()> &generate,
+                                    unsigned int thread_num, std::mt19937_64 &random) {
+            const topology_loader::statistics stats = generate();
+            auto start = clock::now();
+            node::freeze_topology();
+            const double freeze_seconds = seconds_since(start);
+            const std::size_t node_num = node::get_node_num();
+            add({"build", topology, node_num, stats.link_num, stats.parse_seconds + stats.build_seconds + freeze_seconds,
+                 {{"generate_seconds", stats.parse_seconds}, {"load_seconds", stats.build_seconds}, {"freeze_seconds", freeze_seconds}}});
+            bench_lookup(topology, random);
+
+            IoT_ctrl_packet_event(0, event::get_cur_time() + 1);
+            start = clock::now();
+            event::start_simulate(UINT_MAX, thread_num);
+            add({"flood", topology, node_num, event::get_last_event_num(), seconds_since(start), {}});
+
+            auto *sink = static_cast<IoT_device *>(node::id_to_node(0));
+            const std::uint64_t delivered_num = sink->get_delivered_num();
+            const unsigned int packet_num = std::min<unsigned int>(DATA_PACKET_NUM, static_cast<unsigned int>(node_num - 1));
+            std::uniform_int_distribution<unsigned int> src(1, static_cast<unsigned int>(node_num - 1));
+            const unsigned int data_time = event::get_cur_time() + 1;
+            for (unsigned int i = 0; i < packet_num; i++) {
+                IoT_data_packet_event(src(random), 0, data_time + i % 100);
+            }
+            start = clock::now();
+            event::start_simulate(UINT_MAX, thread_num);
+            add({"data forwarding", topology, node_num, event::get_last_event_num(), seconds_since(start),
+                 {{"packets", packet_num}, {"delivered", static_cast<double>(sink->get_delivered_num() - delivered_num)}}});
+            clear();
+        }
 
-        static void print () {
-            std::cout << "registered link types:\n";
-            for (const auto &name: derived_class_names) {
-                std::cout << name << '\n';
+        // the flood and the data forwarding of a grid with the parallel engine on more and more threads
+        static void bench_scaling(unsigned int node_num) {
+            const auto side = static_cast<unsigned int>(std::lround(std::sqrt(std::min(node_num, SCALING_NODE_NUM))));
+            double one_thread_seconds = 0;
+            std::uint64_t one_thread_event_num = 0;
+            for (unsigned int thread_num = 1; thread_num <= MAX_SCALING_THREAD_NUM; thread_num *= 2) {
+                topology_generator::grid(side, side, 1, {SEED, 1});
+                node::freeze_topology();
+                std::mt19937_64 random(SEED);
+                std::uniform_int_distribution<unsigned int> src(1, side * side - 1);
+                const auto start = clock::now();
+                IoT_ctrl_packet_event(0, event::get_cur_time() + 1);
+                event::start_simulate(UINT_MAX, thread_num);
+                std::uint64_t event_num = event::get_last_event_num();
+                const unsigned int data_time = event::get_cur_time() + 1;
+                for (unsigned int i = 0; i < DATA_PACKET_NUM; i++) {
+                    IoT_data_packet_event(src(random), 0, data_time + i % 100);
+                }
+                event::start_simulate(UINT_MAX, thread_num);
+                event_num += event::get_last_event_num();
+                const double seconds = seconds_since(start);
+                clear();
+                if (thread_num == 1) {
+                    one_thread_seconds = seconds;
+                    one_thread_event_num = event_num;
+                }
+                else if (event_num != one_thread_event_num) {
+                    throw std::logic_error("The parallel engine ran other events on " + std::to_string(thread_num) + " threads");
+                }
+                add({"scaling", "grid, " + std::to_string(thread_num) + " threads", std::size_t{side} * side, event_num, seconds,
+                     {{"threads", thread_num}, {"speedup", one_thread_seconds / seconds}}});
             }
         }
-};
 
-class simple_link: public link {
-    private:
-        STATIC_CONSTRUCTOR (
-            derived_class_names.emplace_back("simple_link");
-        )
-        simple_link(unsigned int _id1, unsigned int _id2): link (_id1,_id2){} // this constructor cannot be directly called by users
+        static void write(const std::string &path, unsigned int max_node_num, unsigned int thread_num) {
+            std::ofstream out(path);
+            if (!out) {
+                throw std::runtime_error("Cannot open " + path);
+            }
+            out << std::setprecision(9);
+            out << "{\n  \"max_trace_level\": " << MAX_TRACE_LEVEL << ", \"max_node_num\": " << max_node_num << ", \"thread_num\": " << thread_num
+                << ", \"hardware_threads\": " << std::thread::hardware_concurrency() << ", \"repeat\": " << REPEAT << ", \"seed\": " << SEED
+                << ",\n  \"results\": [";
+            for (std::size_t i = 0; i < results.size(); i++) {
+                const result &r = results[i];
+                out << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\", \"variant\": \"" << r.variant << "\", \"nodes\": " << r.node_num
+                    << ", \"ops\": " << r.op_num << ", \"seconds\": " << r.seconds << ", \"ns_per_op\": "
+                    << (r.op_num > 0 ? r.seconds * 1e9 / static_cast<double>(r.op_num) : 0);
+                for (const auto &[name, value]: r.extras) {
+                    out << ", \"" << name << "\": " << value;
+                }
+                out << '}';
+            }
+            out << "\n  ]\n}\n";
+        }
 
     public:
-        static std::shared_ptr<simple_link> generate(unsigned int _id1, unsigned int _id2) {
-            std::shared_ptr<simple_link> link(new simple_link(_id1, _id2));
-            register_link(link);
-            return link;
+        // runs the suite and writes the results to path; the graphs have 1k, 10k, ... nodes up to max_node_num
+        static void run(const std::string &path, unsigned int max_node_num = 1000000, unsigned int thread_num = 1) {
+            if (!std::ofstream(path)) { // fails now instead of after the benchmarks
+                throw std::runtime_error("Cannot open " + path);
+            }
+            const trace_level level = event::get_trace_level();
+            event::set_trace_level(trace_level::off);
+            clear();
+            results.clear();
+
+            bench_events();
+            bench_send();
+            bench_packets();
+
+            std::mt19937_64 random(SEED);
+            const topology_generator::options options{SEED, thread_num};
+            for (unsigned int node_num = 1000; node_num <= std::max(max_node_num, 1000U); node_num *= 10) {
+                node_num = std::min(node_num, std::max(max_node_num, 2U));
+                const auto side = static_cast<unsigned int>(std::lround(std::sqrt(node_num)));
+                bench_scenarios("grid", [&] { return topology_generator::grid(side, side, 1, options); }, thread_num, random);
+                bench_scenarios("random geometric", [&] {
+                    return topology_generator::random_geometric(node_num, topology_generator::radius_for_degree(node_num, GEOMETRIC_DEGREE), options);
+                }, thread_num, random);
+                bench_scenarios("scale-free", [&] { return topology_generator::barabasi_albert(node_num, SCALE_FREE_LINK_NUM, options); }, thread_num, random);
+                if (node_num > UINT_MAX / 10) {
+                    break;
+                }
+            }
+            bench_scaling(max_node_num);
+
+            event::set_trace_level(level);
+            write(path, max_node_num, thread_num);
         }
-        double get_latency() override { return ONE_HOP_DELAY; } // you can implement your own latency
 };
 
-void node::add_phy_neighbor (unsigned int _id){
-    if (id == _id) {
-        std::cerr << "Failed to add phy_neighbor: the two nodes are the same" << '\n';
-        return;
-    }
-    if (!id_node_table.contains(_id)) {
-        std::cerr << "Failed to add phy_neighbor: node " << _id << " does not exist" << '\n';
-        return;
-    }
-    if (phy_neighbors.contains(_id)) {
-        std::cerr << "Failed to add phy_neighbor: node " << _id << " has been added" << '\n';
-        return;
-    }
-    phy_neighbors.insert(_id);
+/*
+A parameter sweep over one topology: ./a.out sweep <topology> <spec> <results.csv> [thread num]
+
+A scenario is one combination of a sink, a link latency, a traffic rate and a
+seed, and runs as a simulation of its own (see simulation). The sink floods the
+routes at time 0, and after the flood the other devices send it
+IoT_data_packets for duration, as a Poisson process of the rate (packets per
+unit of time) whose times and sources are drawn from the seed. The topology is
+read once and kept as a binary CSR in memory, from which every scenario builds
+its nodes in place (see topology_loader::load_csr) instead of parsing the file.
+
+The scenarios run on thread num workers (no more than the scenarios) that
+steal work. Every worker starts with an equal range of the scenarios and takes
+them from the front of its range; a worker whose range is empty steals the back
+half of the range of another one, so the workers that got the long scenarios
+(e.g. a high rate or a sink at the edge) are helped until the end. The results
+are one row per scenario in the order of the spec, written as CSV.
+
+A spec has a line for each parameter with its values; a parameter without a
+line keeps its default (see spec), and # starts a comment:
+
+    sinks 0 4950 9999
+    latencies 5 10 20
+    rates 0.5 1 2
+    seeds 1 2 3 4
+    duration 1000
+*/
+class sweep {
+    public:
+        class spec {
+            public:
+                std::vector<unsigned int> sinks = {0};
+                std::vector<unsigned int> latencies = {ONE_HOP_DELAY};
+                std::vector<double> rates = {1};
+                std::vector<std::uint64_t> seeds = {1};
+                unsigned int duration = 1000; // of the traffic
 
-    simple_link::generate(id, _id);
-}
+                static spec read(const std::string &path);
+        };
 
-// the IoT_data_packet_event function is used to add an initial event
-void IoT_data_packet_event(unsigned int src, unsigned int dst = 0, unsigned int t = 0, const std::string &msg = "default") {
-    if (!node::id_to_node(src)) {
-        std::cerr << "src " << src << ": no such node registered\n";
-        return;
-    }
-    if (dst != BROADCAST_ID && !node::id_to_node(dst)) {
-        std::cerr << "dst " << dst << ": no such node registered\n";
-        return;
-    }
+        class scenario {
+            public:
+                unsigned int sink = 0;
+                unsigned int latency = ONE_HOP_DELAY;
+                double rate = 1;
+                std::uint64_t seed = 1;
+        };
 
-    IoT_data_pkt_gen_event::pkt_gen_data e_data;
-    e_data.src_id = src;
-    e_data.dst_id = dst;
-    e_data.msg = msg;
+        class result {
+            public:
+                scenario point;
+                std::size_t node_num = 0;
+                std::size_t link_num = 0;
+                std::uint64_t packet_num = 0; // the IoT_data_packets sent
+                std::uint64_t delivered_num = 0;
+                std::uint64_t delay_sum = 0; // of the delivered packets
+                std::uint64_t event_num = 0;
+                unsigned int flood_time = 0; // when the last event of the flood was triggered
+                unsigned int end_time = 0; // when the last event was triggered
+                double build_seconds = 0;
+                double run_seconds = 0;
+                std::string error; // empty unless the scenario failed
+        };
 
-    // recv_event *e = dynamic_cast<recv_event*> ( event::generator::generate("recv_event",t, (void *)&e_data) );
-    IoT_data_pkt_gen_event::generate(t, e_data);
-}
+    private:
+        using clock = std::chrono::steady_clock;
 
-// the IoT_ctrl_packet_event function is used to add an initial event
+        // the scenarios that a worker hasn't run yet; it takes them from the front, and the others steal from the back
+        class alignas(64) share {
+            public:
+                std::mutex mutex;
+                std::size_t begin = 0;
+                std::size_t end = 0;
+        };
 
-void IoT_ctrl_packet_event(unsigned int src = 0, unsigned int t = event::get_cur_time(), const std::string &msg = "default") {
-    // 1st parameter: the source; the destination that want to broadcast a msg with counter 0 (i.e., match ID)
-    // 2nd parameter: time (optional)
-    // 3rd parameter: msg (optional)
-    if (!node::id_to_node(src)) {
-        std::cerr << "src " << src << ": no such node registered\n";
-        return;
-    }
+        static double seconds_since(clock::time_point start) {
+            return std::chrono::duration<double>(clock::now() - start).count();
+        }
 
-    // unsigned int src = con_id;
-    IoT_ctrl_pkt_gen_event::pkt_gen_data e_data;
-    e_data.src_id = src;
-    e_data.dst_id = BROADCAST_ID;
-    // e_data.mat_id = mat;
-    // e_data.act_id = act;
-    e_data.msg = msg;
-    // e_data.per = per;
+        // takes the next scenario of the worker, or steals half of the scenarios of another one; false if none is left
+        static bool next(std::vector<share> &shares, std::size_t worker, std::size_t &index) {
+            share &own = shares[worker];
+            {
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (own.begin < own.end) {
+                    index = own.begin++;
+                    return true;
+                }
+            }
+            for (std::size_t i = 1; i < shares.size(); i++) {
+                share &victim = shares[(worker + i) % shares.size()];
+                std::size_t begin = 0;
+                std::size_t end = 0;
+                {
+                    std::lock_guard<std::mutex> lock(victim.mutex);
+                    if (victim.begin == victim.end) {
+                        continue;
+                    }
+                    end = victim.end;
+                    begin = victim.end -= (victim.end - victim.begin + 1) / 2;
+                }
+                std::lock_guard<std::mutex> lock(own.mutex);
+                own.begin = begin + 1;
+                own.end = end;
+                index = begin;
+                return true;
+            }
+            return false;
+        }
 
-    IoT_ctrl_pkt_gen_event::generate(t, e_data);
-}
+    public:
+        // every combination of the values, the seeds changing fastest and then the rates, the latencies and the sinks
+        static std::vector<scenario> expand(const spec &s) {
+            std::vector<scenario> points;
+            points.reserve(s.sinks.size() * s.latencies.size() * s.rates.size() * s.seeds.size());
+            for (const unsigned int sink: s.sinks) {
+                for (const unsigned int latency: s.latencies) {
+                    for (const double rate: s.rates) {
+                        for (const std::uint64_t seed: s.seeds) {
+                            points.push_back({sink, latency, rate, seed});
+                        }
+                    }
+                }
+            }
+            return points;
+        }
 
-// the AGG_ctrl_packet_event function is used to add an initial event
-void AGG_ctrl_packet_event(unsigned int src, unsigned int dst = 0, unsigned int t = event::get_cur_time(), const std::string &msg = "default") {
-    if (!node::id_to_node(src)) {
-        std::cerr << "src " << src << ": no such node registered\n";
-        return;
-    }
-    if (dst != BROADCAST_ID && !node::id_to_node(dst)) {
-        std::cerr << "dst " << dst << ": no such node registered\n";
-        return;
-    }
+        // runs a scenario in a new simulation on the calling thread; ids are the nodes of csr
+        static result run_scenario(std::string_view csr, std::span<const unsigned int> ids, const scenario &point, unsigned int duration) {
+            result r;
+            r.point = point;
+            simulation sim;
+            const simulation::scope in(sim);
+            try {
+                event::set_trace_level(trace_level::off);
+                auto start = clock::now();
+                simple_link::set_common_latency(point.latency);
+                const topology_loader::statistics topology = topology_loader::load_csr(csr, "sweep");
+                if (node::id_to_node(point.sink) == nullptr) {
+                    throw std::invalid_argument("The sink " + std::to_string(point.sink) + " is not in the topology");
+                }
+                node::freeze_topology();
+                r.node_num = topology.node_num;
+                r.link_num = topology.link_num;
+                r.build_seconds = seconds_since(start);
+
+                start = clock::now();
+                IoT_ctrl_packet_event(point.sink, 0);
+                event::start_simulate(UINT_MAX);
+                r.event_num = event::get_last_event_num();
+                r.flood_time = event::get_cur_time();
+
+                std::mt19937_64 random(point.seed);
+                std::exponential_distribution<double> gap(point.rate);
+                std::uniform_int_distribution<std::size_t> src(0, ids.size() - 1);
+                for (double t = gap(random); t < duration && ids.size() > 1; t += gap(random)) {
+                    unsigned int id = point.sink;
+                    while (id == point.sink) {
+                        id = ids[src(random)];
+                    }
+                    IoT_data_packet_event(id, point.sink, r.flood_time + 1 + static_cast<unsigned int>(t));
+                    r.packet_num++;
+                }
+                event::start_simulate(UINT_MAX);
+                r.event_num += event::get_last_event_num();
+                r.end_time = event::get_cur_time();
+                r.run_seconds = seconds_since(start);
+                const auto *sink = static_cast<const IoT_device *>(node::id_to_node(point.sink));
+                r.delivered_num = sink->get_delivered_num();
+                r.delay_sum = sink->get_delay_sum();
+            }
+            catch (const std::exception &error) {
+                r.error = error.what();
+            }
+            return r;
+        }
 
-    AGG_ctrl_pkt_gen_event::pkt_gen_data e_data;
-    e_data.src_id = src;
-    e_data.dst_id = dst;
-    e_data.msg = msg;
+        // the threads that run scenario_num scenarios on thread_num threads
+        static std::size_t get_worker_num(unsigned int thread_num, std::size_t scenario_num) {
+            return std::clamp<std::size_t>(thread_num, 1, std::max<std::size_t>(scenario_num, 1));
+        }
 
-    // recv_event *e = dynamic_cast<recv_event*> ( event::generator::generate("recv_event",t, (void *)&e_data) );
-    AGG_ctrl_pkt_gen_event::generate(t, e_data);
-}
+        // runs the scenarios of the spec on thread_num threads; the results are in the order of expand
+        static std::vector<result> run(std::string_view csr, std::span<const unsigned int> ids, const spec &s, unsigned int thread_num) {
+            const std::vector<scenario> points = expand(s);
+            std::vector<result> results(points.size());
+            const std::size_t worker_num = get_worker_num(thread_num, points.size());
+            std::vector<share> shares(worker_num);
+            for (std::size_t w = 0; w < worker_num; w++) {
+                shares[w].begin = points.size() * w / worker_num;
+                shares[w].end = points.size() * (w + 1) / worker_num;
+            }
+            const auto work = [&](std::size_t worker) {
+                const event_pool::slot_lease slot;
+                std::size_t index = 0;
+                while (next(shares, worker, index)) {
+                    results[index] = run_scenario(csr, ids, points[index], s.duration);
+                }
+            };
+            {
+                std::vector<std::jthread> workers;
+                for (std::size_t w = 1; w < worker_num; w++) {
+                    workers.emplace_back(work, w);
+                }
+                work(0);
+            }
+            return results;
+        }
 
-// the DIS_ctrl_packet_event function is used to add an initial event
-void DIS_ctrl_packet_event(unsigned int sink_id = 0, unsigned int t = event::get_cur_time(), const std::string &msg = "default") {
-    if (!node::id_to_node(sink_id)) {
-        std::cerr << "sink_id or id is incorrect" << '\n';
-        return;
-    }
+        static void write(const std::string &path, const std::vector<result> &results) {
+            std::ofstream out(path);
+            if (!out) {
+                throw std::runtime_error("Cannot open " + path);
+            }
+            out << std::setprecision(9);
+            out << "sink,latency,rate,seed,nodes,links,packets,delivered,delivery_ratio,mean_delay,events,flood_time,end_time,"
+                   "build_seconds,run_seconds,error\n";
+            for (const result &r: results) {
+                std::string error = r.error;
+                for (std::size_t i = error.find('"'); i != std::string::npos; i = error.find('"', i + 2)) {
+                    error.insert(i, 1, '"');
+                }
+                out << r.point.sink << ',' << r.point.latency << ',' << r.point.rate << ',' << r.point.seed << ',' << r.node_num << ','
+                    << r.link_num << ',' << r.packet_num << ',' << r.delivered_num << ','
+                    << (r.packet_num > 0 ? static_cast<double>(r.delivered_num) / static_cast<double>(r.packet_num) : 0) << ','
+                    << (r.delivered_num > 0 ? static_cast<double>(r.delay_sum) / static_cast<double>(r.delivered_num) : 0) << ','
+                    << r.event_num << ',' << r.flood_time << ',' << r.end_time << ',' << r.build_seconds << ',' << r.run_seconds << ",\""
+                    << error << "\"\n";
+            }
+            if (!out) {
+                throw std::runtime_error("Cannot write " + path);
+            }
+        }
 
-    DIS_ctrl_pkt_gen_event::pkt_gen_data e_data;
-    e_data.src_id = sink_id;
-    e_data.dst_id = sink_id;
-    e_data.parent = sink_id;
-    e_data.msg = msg;
+        // loads the topology from an edge list or a binary CSR file, runs the sweep of the spec file and writes the results
+        static void run(const std::string &topology_path, const std::string &spec_path, const std::string &path, unsigned int thread_num) {
+            const spec s = spec::read(spec_path);
+            if (!std::ofstream(path)) { // fails now instead of after the sweep
+                throw std::runtime_error("Cannot open " + path);
+            }
+            std::string csr;
+            std::vector<unsigned int> ids;
+            {
+                simulation loaded;
+                const simulation::scope in(loaded);
+                topology_loader::load(topology_path).print(std::cerr);
+                std::ostringstream out;
+                topology_loader::write_csr(out);
+                csr = std::move(out).str();
+                node::current().id_node_table.for_each([&](unsigned int id, const std::shared_ptr<node> &) { ids.push_back(id); });
+            }
+            const auto start = clock::now();
+            const std::vector<result> results = run(csr, ids, s, thread_num);
+            const double seconds = seconds_since(start);
+            const auto failed_num = std::count_if(results.begin(), results.end(), [](const result &r) { return !r.error.empty(); });
+            std::cerr << "sweep: " << results.size() << " scenarios on " << get_worker_num(thread_num, results.size()) << " workers in "
+                      << seconds << " s, " << failed_num << " failed\n";
+            write(path, results);
+        }
+};
 
-    // recv_event *e = dynamic_cast<recv_event*> ( event::generator::generate("recv_event",t, (void *)&e_data) );
-    DIS_ctrl_pkt_gen_event::generate(t, e_data);
+sweep::spec sweep::spec::read(const std::string &path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    spec s;
+    std::string text;
+    for (std::size_t line = 1; std::getline(in, text); line++) {
+        text = text.substr(0, text.find('#'));
+        std::istringstream words(text);
+        std::string key;
+        if (!(words >> key)) {
+            continue;
+        }
+        const auto fail = [&](const std::string &message) {
+            throw std::runtime_error(path + ":" + std::to_string(line) + ": " + message);
+        };
+        const auto read_values = [&](auto &values) {
+            values.clear();
+            typename std::remove_reference_t<decltype(values)>::value_type value{};
+            while (words >> value) {
+                values.push_back(value);
+            }
+            if (!words.eof() || values.empty()) {
+                fail("expected the values of " + key);
+            }
+        };
+        if (key == "sinks") {
+            read_values(s.sinks);
+        }
+        else if (key == "latencies") {
+            read_values(s.latencies);
+        }
+        else if (key == "rates") {
+            read_values(s.rates);
+            if (std::any_of(s.rates.begin(), s.rates.end(), [](double rate) { return !(rate > 0); })) {
+                fail("the rates must be positive");
+            }
+        }
+        else if (key == "seeds") {
+            read_values(s.seeds);
+        }
+        else if (key == "duration") {
+            std::vector<unsigned int> duration;
+            read_values(duration);
+            if (duration.size() != 1) {
+                fail("expected one duration");
+            }
+            s.duration = duration.front();
+        }
+        else {
+            fail("unknown parameter " + key);
+        }
+    }
+    return s;
 }
 
-// send_handler function is used to transmit packet p based on the information in the header
-// Note that the packet p will not be discard after send_handler ()
+#ifndef NDEBUG
+/*
+Checks with assert that the packets move through the event pipeline without
+being copied: ./a.out selftest (a build without NDEBUG)
+
+On a line of three devices, every generating event makes its packet once and
+moves it into the events that give it to the recv_handler of its node, so the
+IoT_data_packet, the AGG_ctrl_packet and the DIS_ctrl_packet are never copied.
+Then a flood runs, and every packet is gone with the events that held it.
+
+Then it runs a small scenario with every packet type (see trace_of) in other
+ways that must print the same trace: with every scheduler instead of the binary
+heap, with the parallel engine on 2 and 4 threads or the batched engine
+instead of the sequential one, and as a binary_trace, rendered to text, in a
+file of the temporary directory. Last it saves a checkpoint halfway, restores it
+in a new simulation and runs on; the two parts must print the whole trace.
+*/
+class self_test {
+        static constexpr unsigned int SIDE = 6; // of the grid of the scenario
+        static constexpr unsigned int END_TIME = 3000;
+        static constexpr unsigned int SAVE_TIME = 850; // in the DIS flood, so the checkpoint holds packets that share a tree
+
+        // runs the events until end_time without printing them
+        static void run_quietly(unsigned int end_time) {
+            std::ostringstream trace;
+            std::streambuf *const printed = std::cout.rdbuf(trace.rdbuf());
+            event::start_simulate(end_time);
+            std::cout.rdbuf(printed);
+        }
 
-void node::send_handler(const PacketTypes &p){
-    send_event::send_data e_data;
-    e_data.s_id = std::visit(overloaded {
-        [](auto &&packet){ return packet.get_header().get_pre_ID(); },
-        [](std::monostate) -> unsigned { throw std::domain_error("The packet has not been assigned any specific packet type"); }
-    }, p);
-    e_data.r_id = std::visit(overloaded {
-        [](auto &&packet){ return packet.get_header().get_nex_ID(); },
-        [](std::monostate) -> unsigned { throw std::domain_error("The packet has not been assigned any specific packet type"); }
-    }, p);
-    e_data._pkt = p;
-    send_event::generate(event::get_cur_time(), e_data);
-}
+        // the trace of a flood, data packets with short and long msgs, merged AGG lists and a DIS tree on a grid with a sink,
+        // in a simulation of its own; run runs the events until END_TIME
+        template <typename Run>
+        static std::string trace_of(const Run &run) {
+            simulation sim;
+            const simulation::scope in(sim);
+            sink_device::generate(0);
+            topology_generator::grid(SIDE, SIDE, 1, {});
+            node::freeze_topology();
+            IoT_device::set_AGG_merging(true);
+            IoT_ctrl_packet_event(0, 0);
+            for (unsigned int id = 1; id < SIDE * SIDE; id++) {
+                IoT_data_packet_event(id, 0, 150 + id, id % 2 ? "x" : "a msg too long to be kept in the payload");
+                AGG_ctrl_packet_event(id, 0, 300);
+            }
+            DIS_ctrl_packet_event(0, 800);
 
-void node::send(const PacketTypes &p){ // this function is called by event; not for the user
-    unsigned int _nexID = std::visit(overloaded {
-        [](auto &&packet){ return packet.get_header().get_nex_ID(); },
-        [](std::monostate) -> unsigned { throw std::domain_error("The packet has not been assigned any specific packet type"); }
-    }, p);
-    for (const auto &nb_id: phy_neighbors) { // neighbor id
-        if (nb_id != _nexID && BROADCAST_ID != _nexID) {continue;} // this neighbor will not receive the packet
+            std::ostringstream trace;
+            std::streambuf *const printed = std::cout.rdbuf(trace.rdbuf());
+            try {
+                run();
+            }
+            catch (...) {
+                std::cout.rdbuf(printed);
+                throw;
+            }
+            std::cout.rdbuf(printed);
+            return trace.str();
+        }
 
-        unsigned int trigger_time = event::get_cur_time() + static_cast<unsigned int>(link::id_id_to_link(id, nb_id)->get_latency()); // we simply assume that the delay is fixed
-        // cout << "node " << id << " send to node " <<  nb_id << '\n';
-        recv_event::recv_data e_data;
-        e_data.s_id = id;    // set the sender   (i.e., preID)
-        e_data.r_id = nb_id; // set the receiver (i.e., nexID)
+        static void expect_same(std::string_view name, const std::string &expected, const std::string &actual) {
+            std::cout << "selftest: " << name << (actual == expected ? " prints the same trace\n" : " prints another trace\n");
+            assert(actual == expected);
+        }
+
+    public:
+        static void run() {
+            for (unsigned int id = 0; id < 3; id++) {
+                IoT_device::generate(id);
+            }
+            for (unsigned int id = 0; id + 1 < 3; id++) {
+                node::id_to_node(id)->add_phy_neighbor(id + 1);
+                node::id_to_node(id + 1)->add_phy_neighbor(id);
+            }
+            const unsigned int live_num = IoT_data_packet::get_live_packet_num();
+            const std::size_t copy_num = IoT_data_packet::get_packet_copy_num();
+            const std::size_t move_num = IoT_data_packet::get_packet_move_num();
+            IoT_data_packet_event(2, 0, 100);
+            AGG_ctrl_packet_event(2, 0, 100);
+            DIS_ctrl_packet_event(0, 100);
+            run_quietly(200);
+            std::cout << "selftest: " << IoT_data_packet::get_packet_copy_num() - copy_num << " copies and "
+                      << IoT_data_packet::get_packet_move_num() - move_num << " moves of 3 generated packets\n";
+            assert(IoT_data_packet::get_packet_copy_num() == copy_num);
+
+            IoT_ctrl_packet_event(0, 300);
+            run_quietly(400);
+            assert(IoT_data_packet::get_live_packet_num() == live_num);
+
+            const std::string expected = trace_of([] { event::start_simulate(END_TIME); });
+            assert(!expected.empty());
+            expect_same("calendar_queue", expected, trace_of([] {
+                event::set_scheduler(std::make_unique<calendar_queue>());
+                event::start_simulate(END_TIME);
+            }));
+            expect_same("ladder_queue", expected, trace_of([] {
+                event::set_scheduler(std::make_unique<ladder_queue>());
+                event::start_simulate(END_TIME);
+            }));
+            expect_same("time_bucket_queue", expected, trace_of([] {
+                event::set_scheduler(std::make_unique<time_bucket_queue>());
+                event::start_simulate(END_TIME);
+            }));
+            expect_same("the parallel engine on 2 threads", expected, trace_of([] { event::start_simulate(END_TIME, 2); }));
+            expect_same("the parallel engine on 4 threads", expected, trace_of([] { event::start_simulate(END_TIME, 4); }));
+            expect_same("the batched engine", expected, trace_of([] { event::start_simulate_batched(END_TIME); }));
+
+            const std::string path = (std::filesystem::temp_directory_path() / "hw2+3-selftest.trace").string();
+            trace_of([&] {
+                binary_trace::open(path);
+                event::start_simulate(END_TIME);
+                binary_trace::close();
+            });
+            std::ostringstream rendered;
+            {
+                std::ifstream in(path, std::ios::binary);
+                binary_trace::render(in, rendered);
+            }
+            std::filesystem::remove(path);
+            expect_same("binary_trace::render", expected, rendered.str());
+
+            const std::string checkpoint_path = (std::filesystem::temp_directory_path() / "hw2+3-selftest.checkpoint").string();
+            const std::string head = trace_of([&] {
+                event::start_simulate(SAVE_TIME);
+                checkpoint::save(checkpoint_path);
+            });
+            const std::string tail = trace_of([&] {
+                checkpoint::restore(checkpoint_path);
+                event::start_simulate(END_TIME);
+            });
+            std::filesystem::remove(checkpoint_path);
+            expect_same("a restored checkpoint", expected, head + tail);
+            std::cout << "selftest: passed\n";
+        }
+};
+#endif
+
+int main(int argc, char *argv[]) {
+    // prints a binary trace offline: ./a.out render trace.bin
+    if (argc == 3 && std::string_view(argv[1]) == "render") {
+        std::ifstream in(argv[2], std::ios::binary);
+        if (!in) {
+            std::cerr << "cannot open " << argv[2] << '\n';
+            return 1;
+        }
+        std::ios::sync_with_stdio(false);
+        try {
+            binary_trace::render(in, std::cout);
+        }
+        catch (const std::exception &error) {
+            std::cerr << error.what() << '\n';
+            return 1;
+        }
+        return 0;
+    }
+    // converts an edge list to a binary CSR file, which loads faster: ./a.out csr edges.txt topology.csr
+    if (argc == 4 && std::string_view(argv[1]) == "csr") {
+        try {
+            topology_loader::load(argv[2]).print(std::cerr);
+            topology_loader::write_csr(argv[3]);
+        }
+        catch (const std::exception &error) {
+            std::cerr << error.what() << '\n';
+            return 1;
+        }
+        return 0;
+    }
+
+    // runs the benchmark suite and writes the results as JSON: ./a.out bench results.json [max node num] [thread num]
+    if (argc >= 3 && argc <= 5 && std::string_view(argv[1]) == "bench") {
+        try {
+            benchmark::run(argv[2], argc > 3 ? static_cast<unsigned int>(std::stoul(argv[3])) : 1000000,
+                           argc > 4 ? static_cast<unsigned int>(std::stoul(argv[4])) : 1);
+        }
+        catch (const std::exception &error) {
+            std::cerr << error.what() << '\n';
+            return 1;
+        }
+        return 0;
+    }
 
-        e_data._pkt = p;
+    // runs the scenarios of a parameter sweep over one topology and writes one row per scenario: ./a.out sweep topology.csr sweep.txt results.csv [thread num]
+    if (argc >= 5 && argc <= 6 && std::string_view(argv[1]) == "sweep") {
+        try {
+            sweep::run(argv[2], argv[3], argv[4],
+                       argc > 5 ? static_cast<unsigned int>(std::stoul(argv[5])) : std::max(std::thread::hardware_concurrency(), 1U));
+        }
+        catch (const std::exception &error) {
+            std::cerr << error.what() << '\n';
+            return 1;
+        }
+        return 0;
+    }
 
-        recv_event::generate(trigger_time, e_data);
+    // checks that the packets move through the events without being copied: ./a.out selftest
+    if (argc == 2 && std::string_view(argv[1]) == "selftest") {
+#ifndef NDEBUG
+        self_test::run();
+        return 0;
+#else
+        std::cerr << "the self test is compiled out with NDEBUG\n";
+        return 1;
+#endif
     }
-}
 
-int main() {
     // header::generator::print(); // print all registered headers
     // payload::generator::print(); // print all registered payloads
     // packet::generator::print(); // print all registered packets
@@ -1456,12 +8117,22 @@ int main() {
     // event::generator::print(); // print all registered events
     // link::generator::print(); // print all registered links
 
+    // the pending events are kept in a binary heap by default; the other schedulers pop them in the same order
+    // event::set_scheduler(std::make_unique<calendar_queue>());
+    // event::set_scheduler(std::make_unique<ladder_queue>());
+    // event::set_scheduler(std::make_unique<time_bucket_queue>());
+
+    // the calls below build and run the simulation of this thread; other threads may run their own at the same time in a simulation::scope; see simulation
     // read the input and generate devices
-    for (unsigned int id = 0; id < 5; id ++){
+    // the sink computes the new parents from the nb lists; see sink_device
+    sink_device::generate(0);
+    for (unsigned int id = 1; id < 5; id ++){
         IoT_device::generate(id);
     }
 
-    // please generate the sink by yourself
+    // a large topology is loaded from a file instead of the calls below; see topology_loader
+    // topology_loader::load("topology.csr").print(std::cerr);
+    // topology_generator::random_geometric(1000000, topology_generator::radius_for_degree(1000000, 8), {.seed = 1, .thread_num = 4}).print(std::cerr); // or a synthetic one; see topology_generator
 
     // set devices' neighbors
     node::id_to_node(0)->add_phy_neighbor(1);
@@ -1475,6 +8146,9 @@ int main() {
     node::id_to_node(2)->add_phy_neighbor(4);
     node::id_to_node(4)->add_phy_neighbor(2);
 
+    // the topology is ready, so pack it for fast broadcasts; it can still be changed later
+    node::freeze_topology();
+
     // node 0 broadcasts a msg with counter 0 at time 100
     IoT_ctrl_packet_event(0, 100);
     // 1st parameter: the source; the destination that want to broadcast a msg with counter 0 (i.e., match ID)
@@ -1492,18 +8166,29 @@ int main() {
     // 1st parameter: the source node
     // 2nd parameter: the destination node (sink)
     // 3rd parameter: time (optional)
-    // 4th parameter: msg (for storing nb list)
+    // 4th parameter: msg for debug (optional)
+    // the source adds its nb list to the packet, and the sink collects it; see nblist_chain
+    // IoT_device::set_AGG_merging(true); // merge the nb lists on the way when every device sends one
 
     DIS_ctrl_packet_event(0, 260);
-    // 1st parameter: the source node (sink)
-    // 2nd parameter: the destination node
-    // 3rd parameter: parent
-    // 4th parameter: time (optional)
-    // 5th parameter: msg for debug (optional)
+    // 1st parameter: the sink
+    // 2nd parameter: time (optional)
+    // 3rd parameter: msg for debug (optional)
+    // the sink computes a spanning tree from the nb lists it has collected by then and sends every device in it its parent
+
+    // event::set_trace_level(trace_level::summary); // print only the number of events; see trace_level
+    // workload_stream::open("workload.txt"); // stream the packet generating events from a file instead of the calls above; see workload_stream
+    // binary_trace::open("trace.bin"); // write the events to a binary file instead of printing them; see binary_trace
+    // metrics::open("metrics.json"); // count the events, packets and delays, and write them as JSON after every start_simulate; see metrics
 
     // start simulation!!
     event::start_simulate(300);
+    // event::start_simulate(300, std::thread::hardware_concurrency()); // the parallel engine prints the same events
+    // checkpoint::save("state.snap").print(std::cerr); // a later run calls checkpoint::restore("state.snap") instead of the setup to go on from here; see checkpoint
+    // binary_trace::close();
+    // static_cast<sink_device *>(node::id_to_node(0))->compute_tree().get_statistics().print(std::cerr); // how long the sink took
     // event::flush_events() ;
+    // event_pool::print(); // print the pool usage of every event type
     // cout << packet::get_live_packet_num() << '\n';
     return 0;
 }